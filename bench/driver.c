@@ -0,0 +1,355 @@
+/*
+ * driver.c - replay sessions through cepl and report its own latency
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "../src/errs.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+/* lines in the generated long session */
+#define LONG_LINES	1000
+/* runs averaged for startup time */
+#define STARTUP_RUNS	5
+/* deepest span nesting tracked in a trace */
+#define SPAN_DEPTH	32
+
+/* struct definition for a growable list of durations */
+struct samples {
+	double *list;
+	size_t cnt, max;
+};
+
+/* struct definition for the measurements of one session */
+struct session {
+	char *name, *args, *input;
+	struct samples line, input_wait;
+	long peak_rss, first_rss, last_rss;
+	double wall_ms, startup_ms;
+	/* signal which killed cepl during any run, its numbers are meaningless then */
+	int crash_sig;
+};
+
+static char const *trace_path = "/tmp/cepl_bench_trace.json";
+
+static void add_sample(struct samples *s, double val)
+{
+	if (s->cnt == s->max && !(s->list = realloc(s->list, sizeof *s->list * (s->max = s->max ? s->max * 2 : 256))))
+		ERR("realloc()");
+	s->list[s->cnt++] = val;
+}
+
+static int cmp_double(void const *a, void const *b)
+{
+	double x = *(double const *)a, y = *(double const *)b;
+	return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile of sorted samples */
+static double percentile(struct samples const *s, double pct)
+{
+	size_t rank;
+	if (!s->cnt)
+		return 0;
+	rank = (size_t)(pct / 100 * s->cnt + 0.999999);
+	return s->list[(rank ? rank : 1) - 1];
+}
+
+static double elapsed_ms(struct timespec const *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* read a whole file, caller frees */
+static char *read_file(char const *path)
+{
+	FILE *file;
+	char *buf = NULL;
+	size_t len = 0;
+	ssize_t ret;
+
+	if (!(file = fopen(path, "rb")))
+		ERR("unable to open %s", path);
+	if ((ret = getdelim(&buf, &len, '\0', file)) == -1) {
+		free(buf);
+		buf = strdup("");
+	}
+	fclose(file);
+	return buf;
+}
+
+/* split a whitespace separated argument string onto `argv` after `cepl`, tokens point into `*copy` */
+static char **build_argv(char **copy, char const *cepl, char const *args, char const *extra, bool trace)
+{
+	char **argv, *saved;
+	size_t cnt = 1;
+
+	if (asprintf(copy, "%s %s", args, extra) == -1)
+		ERR("asprintf()");
+	if (!(argv = calloc(strlen(*copy) + 4, sizeof *argv)))
+		ERR("calloc()");
+	argv[0] = (char *)cepl;
+	for (char *tok = strtok_r(*copy, " \t\n", &saved); tok; tok = strtok_r(NULL, " \t\n", &saved))
+		argv[cnt++] = tok;
+	if (trace) {
+		argv[cnt++] = "-t";
+		argv[cnt++] = (char *)trace_path;
+	}
+	argv[cnt] = NULL;
+	return argv;
+}
+
+/* run cepl once with `input` on stdin, returning its wall time and storing a fatal signal in `*sig` */
+static double run_cepl(char *const argv[], char const *input, struct rusage *ru, int *sig)
+{
+	int null_fd, pipe_in[2], status;
+	struct timespec start;
+	pid_t pid;
+
+	if ((null_fd = open("/dev/null", O_RDWR)) == -1)
+		ERR("open()");
+	if (pipe2(pipe_in, O_CLOEXEC) == -1)
+		ERR("pipe2()");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch ((pid = fork())) {
+	case -1:
+		ERR("fork()");
+		break;
+
+	case 0:
+		/* cepl's fatal signal handler kills its whole process group */
+		setpgid(0, 0);
+		dup2(pipe_in[0], STDIN_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		execv(argv[0], argv);
+		_exit(0xff);
+		break;
+
+	default:
+		close(null_fd);
+		close(pipe_in[0]);
+		for (size_t len = strlen(input), off = 0; off < len;) {
+			ssize_t ret = write(pipe_in[1], input + off, len - off);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0)
+				break;
+			off += ret;
+		}
+		close(pipe_in[1]);
+		if (wait4(pid, &status, 0, ru) == -1)
+			ERR("wait4()");
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0xff)
+			ERRX("unable to run %s", argv[0]);
+		if (WIFSIGNALED(status) && !*sig)
+			*sig = WTERMSIG(status);
+	}
+	return elapsed_ms(&start);
+}
+
+/* value of a numeric field in a trace event line */
+static bool field(char const *line, char const *key, double *val)
+{
+	char const *cur = strstr(line, key);
+	char *end;
+	if (!cur)
+		return false;
+	*val = strtod(cur + strlen(key), &end);
+	return end != cur + strlen(key);
+}
+
+/* collect span durations and memory counters from the trace cepl wrote */
+static void parse_trace(struct session *sess)
+{
+	char *trace = read_file(trace_path), *saved;
+	char const *stack[SPAN_DEPTH];
+	double begin[SPAN_DEPTH], ts, rss;
+	size_t depth = 0;
+
+	for (char *line = strtok_r(trace, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+		if (!field(line, "\"ts\":", &ts))
+			continue;
+		if (strstr(line, "\"ph\":\"B\"")) {
+			if (depth < SPAN_DEPTH) {
+				stack[depth] = strstr(line, "\"name\":\"line\"") ? "line"
+					: strstr(line, "\"name\":\"readline\"") ? "readline" : "";
+				begin[depth] = ts;
+			}
+			depth++;
+		} else if (strstr(line, "\"ph\":\"E\"") && depth) {
+			if (--depth < SPAN_DEPTH) {
+				if (!strcmp(stack[depth], "line"))
+					add_sample(&sess->line, (ts - begin[depth]) / 1e3);
+				else if (!strcmp(stack[depth], "readline"))
+					add_sample(&sess->input_wait, (ts - begin[depth]) / 1e3);
+			}
+		} else if (strstr(line, "\"ph\":\"C\"") && field(line, "\"rss_kb\":", &rss)) {
+			if (!sess->first_rss)
+				sess->first_rss = rss;
+			sess->last_rss = rss;
+			if (field(line, "\"max_rss_kb\":", &rss) && rss > sess->peak_rss)
+				sess->peak_rss = rss;
+		}
+	}
+	free(trace);
+}
+
+/* load `<dir>/<name>.cepl`, whose optional first line `# args: ...` holds cepl flags */
+static void load_session(struct session *sess, char const *dir, char const *file)
+{
+	char *path, *input;
+
+	if (asprintf(&path, "%s/%s", dir, file) == -1)
+		ERR("asprintf()");
+	input = read_file(path);
+	free(path);
+	sess->name = strndup(file, strlen(file) - strlen(".cepl"));
+	if (!strncmp(input, "# args:", 7)) {
+		size_t len = strcspn(input, "\n");
+		sess->args = strndup(input + 7, len - 7);
+		sess->input = strdup(input + len + (input[len] == '\n'));
+		free(input);
+	} else {
+		sess->args = strdup("");
+		sess->input = input;
+	}
+	if (!sess->name || !sess->args || !sess->input)
+		ERR("strdup()");
+}
+
+/* a session long enough to show per-line costs growing with history */
+static void long_session(struct session *sess)
+{
+	FILE *out;
+	size_t len;
+
+	sess->name = strdup("long");
+	sess->args = strdup("");
+	if (!(out = open_memstream(&sess->input, &len)))
+		ERR("open_memstream()");
+	/* constant lines are folded, so this measures cepl rather than the compiler */
+	for (size_t i = 0; i < LONG_LINES; i++)
+		fprintf(out, "printf(\"%%d\\n\", %zu * 3 + 1)\n", i);
+	fclose(out);
+}
+
+static void run_session(struct session *sess, char const *cepl, char const *extra)
+{
+	char **argv, *copy;
+	struct rusage ru;
+	struct samples startup = {0};
+
+	/* startup: exit at the first readline() */
+	argv = build_argv(&copy, cepl, sess->args, extra, false);
+	for (size_t i = 0; i < STARTUP_RUNS; i++)
+		add_sample(&startup, run_cepl(argv, "", &ru, &sess->crash_sig));
+	qsort(startup.list, startup.cnt, sizeof *startup.list, cmp_double);
+	sess->startup_ms = percentile(&startup, 50);
+	free(startup.list);
+	free(copy);
+	free(argv);
+
+	unlink(trace_path);
+	argv = build_argv(&copy, cepl, sess->args, extra, true);
+	sess->wall_ms = run_cepl(argv, sess->input, &ru, &sess->crash_sig);
+	free(copy);
+	free(argv);
+	parse_trace(sess);
+	unlink(trace_path);
+	qsort(sess->line.list, sess->line.cnt, sizeof *sess->line.list, cmp_double);
+	qsort(sess->input_wait.list, sess->input_wait.cnt, sizeof *sess->input_wait.list, cmp_double);
+}
+
+/* one JSON object per session, returning false if cepl crashed during it */
+static bool report(struct session const *sess, char const *rev)
+{
+	if (sess->crash_sig) {
+		fprintf(stdout, "{\"rev\":\"%s\",\"session\":\"%s\",\"error\":\"cepl killed by SIG%s\"}\n",
+				rev, sess->name, sigabbrev_np(sess->crash_sig));
+		fflush(stdout);
+		return false;
+	}
+	fprintf(stdout, "{\"rev\":\"%s\",\"session\":\"%s\",\"lines\":%zu,"
+			"\"line_p50_ms\":%.3f,\"line_p90_ms\":%.3f,\"line_p99_ms\":%.3f,\"line_max_ms\":%.3f,"
+			"\"readline_p99_ms\":%.3f,\"startup_ms\":%.3f,\"wall_ms\":%.3f,"
+			"\"peak_rss_kb\":%ld,\"rss_growth_kb\":%ld}\n",
+			rev, sess->name, sess->line.cnt,
+			percentile(&sess->line, 50), percentile(&sess->line, 90), percentile(&sess->line, 99),
+			percentile(&sess->line, 100), percentile(&sess->input_wait, 99),
+			sess->startup_ms, sess->wall_ms, sess->peak_rss, sess->last_rss - sess->first_rss);
+	fflush(stdout);
+	return true;
+}
+
+static void free_session(struct session *sess)
+{
+	free(sess->name);
+	free(sess->args);
+	free(sess->input);
+	free(sess->line.list);
+	free(sess->input_wait.list);
+}
+
+int main(int argc, char **argv)
+{
+	char const *rev = "unknown", *extra = "";
+	struct dirent **files;
+	int opt, cnt;
+	bool ok = true;
+
+	while ((opt = getopt(argc, argv, "r:x:")) != -1) {
+		switch (opt) {
+		/* revision label for the output */
+		case 'r':
+			rev = *optarg ? optarg : rev;
+			break;
+		/* flags added to every session */
+		case 'x':
+			extra = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-r<revision>] [-x<extra cepl flags>] <cepl> <session directory>\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "Usage: %s [-r<revision>] [-x<extra cepl flags>] <cepl> <session directory>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* recorded sessions in name order, then the generated long session */
+	if ((cnt = scandir(argv[optind + 1], &files, NULL, alphasort)) == -1)
+		ERR("unable to read %s", argv[optind + 1]);
+	for (int i = 0; i < cnt; i++) {
+		struct session sess = {0};
+		size_t len = strlen(files[i]->d_name);
+		if (len > 5 && !strcmp(files[i]->d_name + len - 5, ".cepl")) {
+			load_session(&sess, argv[optind + 1], files[i]->d_name);
+			run_session(&sess, argv[optind], extra);
+			ok &= report(&sess, rev);
+			free_session(&sess);
+		}
+		free(files[i]);
+	}
+	free(files);
+
+	struct session sess = {0};
+	long_session(&sess);
+	run_session(&sess, argv[optind], extra);
+	ok &= report(&sess, rev);
+	free_session(&sess);
+	return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,326 @@
+/*
+ * asmview.c - annotated assembly of the executed build
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "asmview.h"
+#include <glob.h>
+
+/* highest `.file` number tracked */
+#define ASM_FILES	256
+
+static enum asm_mode asm_mode = ASM_OFF;
+/* assembly of the last two captured builds */
+static struct asm_list asm_cur, asm_prev;
+/* a build was captured since the last report */
+static bool asm_fresh;
+/* print the whole listing instead of a diff */
+static bool asm_listing;
+
+static void add_insn(struct asm_list *insns, char const *text, size_t len, size_t entry, bool label)
+{
+	if (insns->cnt == insns->max)
+		xrealloc(&insns->list, sizeof *insns->list * (insns->max = insns->max ? insns->max * 2 : 256), "add_insn()");
+	xcalloc(&insns->list[insns->cnt].text, 1, len + 1, "add_insn()");
+	memcpy(insns->list[insns->cnt].text, text, len);
+	insns->list[insns->cnt].entry = entry;
+	insns->list[insns->cnt].label = label;
+	insns->cnt++;
+}
+
+static void free_insns(struct asm_list *insns)
+{
+	for (size_t i = 0; i < insns->cnt; i++)
+		free(insns->list[i].text);
+	free(insns->list);
+	insns->list = NULL;
+	insns->cnt = insns->max = 0;
+}
+
+/* `;asm [on|off|diff]`, returning whether the program should be rebuilt */
+bool set_asm(struct program *prog, char const *mode)
+{
+	if (!*mode) {
+		/* show the listing of the next build */
+		if (asm_mode == ASM_OFF)
+			asm_mode = ASM_ONCE;
+		asm_listing = true;
+		return true;
+	}
+	if (!strcmp(mode, "on")) {
+		asm_mode = ASM_AUTO;
+		asm_listing = true;
+		return true;
+	}
+	if (!strcmp(mode, "off")) {
+		asm_mode = ASM_OFF;
+		free_insns(&asm_cur);
+		free_insns(&asm_prev);
+		return false;
+	}
+	if (!strcmp(mode, "diff")) {
+		asm_fresh = !!asm_cur.list;
+		asm_listing = false;
+		if (!asm_fresh)
+			fprintf(stdout, "%s\n", "[asm: no build captured yet]");
+		asm_report(prog);
+		return false;
+	}
+	WARNX("%s", "usage: ;asm [on|off|diff]");
+	return false;
+}
+
+/* whether the next compile keeps its assembly */
+bool asm_capture(void)
+{
+	return asm_mode != ASM_OFF;
+}
+
+/* compiler arguments which also leave the assembly next to the output file */
+void asm_args(char *const cc_args[], struct str_list *args)
+{
+	bool line_info = false;
+
+	init_str_list(args, cc_args[0]);
+	for (size_t i = 1; cc_args[i]; i++) {
+		/* `-save-temps` warns about `-pipe` */
+		if (!strcmp(cc_args[i], "-pipe"))
+			continue;
+		if (!strncmp(cc_args[i], "-g", 2))
+			line_info = !!strcmp(cc_args[i], "-g0");
+		append_str(args, cc_args[i], 0);
+	}
+	append_str(args, "-save-temps=obj", 0);
+	/* `.loc` directives map instructions to input lines; `-g` never changes code generation */
+	if (!line_info)
+		append_str(args, "-g1", 0);
+	append_str(args, NULL, 0);
+}
+
+/* whether the quoted name ending a `.file` directive is the piped source */
+static bool is_stdin(char const *line)
+{
+	char const *end = strrchr(line, '"'), *start;
+	if (!end || end == line)
+		return false;
+	for (start = end - 1; start > line && *start != '"'; start--);
+	return (size_t)(end - start - 1) == strlen("<stdin>") && !strncmp(start + 1, "<stdin>", end - start - 1);
+}
+
+/* read the assembly, keeping instructions and function labels with their input line */
+static void parse_asm(FILE *file, struct asm_list *insns)
+{
+	bool stdin_file[ASM_FILES] = {0};
+	char *line = NULL;
+	size_t len = 0, entry = 0;
+	unsigned id;
+
+	while (getline(&line, &len, file) != -1) {
+		size_t line_len = strcspn(line, "\n");
+		line[line_len] = '\0';
+		if (line[0] == '\t' && line[1] == '.') {
+			size_t num;
+			/* nothing executable follows the debug sections */
+			if (!strncmp(line, "\t.section\t.debug", 16))
+				break;
+			if (sscanf(line, "\t.file %u", &id) == 1 && id < ASM_FILES)
+				stdin_file[id] = is_stdin(line);
+			else if (sscanf(line, "\t.loc %u %zu", &id, &num) == 2)
+				entry = (id < ASM_FILES && stdin_file[id]) ? num : 0;
+			continue;
+		}
+		if (line[0] == '\t' && line[1]) {
+			add_insn(insns, line + 1, line_len - 1, entry, false);
+			continue;
+		}
+		/* local labels start with `.` */
+		if (line[0] && line[0] != '.' && line_len > 1 && line[line_len - 1] == ':')
+			add_insn(insns, line, line_len - 1, entry, true);
+	}
+	free(line);
+}
+
+/* remove the temporaries `-save-temps=obj` left next to `out`, keeping the assembly of a successful build */
+void asm_collect(char const *out, bool keep)
+{
+	struct asm_list insns = {0};
+	char *pattern;
+	glob_t temps;
+	FILE *file;
+
+	if (asprintf(&pattern, "%s-*", out) == -1)
+		ERR("asprintf()");
+	if (glob(pattern, 0, NULL, &temps)) {
+		free(pattern);
+		return;
+	}
+	for (size_t i = 0; i < temps.gl_pathc; i++) {
+		char const *path = temps.gl_pathv[i];
+		size_t path_len = strlen(path);
+		if (keep && path_len > 2 && !strcmp(path + path_len - 2, ".s") && !insns.cnt && (file = fopen(path, "rb"))) {
+			parse_asm(file, &insns);
+			fclose(file);
+		}
+		if (unlink(path) == -1)
+			WARN("unable to remove %s", path);
+	}
+	globfree(&temps);
+	free(pattern);
+	if (!keep)
+		return;
+
+	free_insns(&asm_prev);
+	asm_prev = asm_cur;
+	asm_cur = insns;
+	asm_fresh = true;
+}
+
+/* print an instruction's input line when it differs from the previous one's */
+static void print_entry(struct program *prog, size_t entry, size_t *last)
+{
+	/* everything after the last input line is generated main() code */
+	if (entry > prog->src[0].lines.cnt)
+		entry = prog->src[0].lines.cnt;
+	if (entry == *last)
+		return;
+	*last = entry;
+	if (!entry)
+		fprintf(stdout, "  %s\n", "(headers)");
+	else if (entry == prog->src[0].lines.cnt)
+		fprintf(stdout, "  %s\n", "(generated)");
+	else
+		fprintf(stdout, "  [%zu] %.60s\n", entry, prog->src[0].lines.list[entry]);
+}
+
+/* print functions containing code from input lines, grouped by line */
+static void print_listing(struct program *prog, struct asm_list const *insns)
+{
+	size_t hidden = 0, hidden_funcs = 0, shown = 0;
+
+	for (size_t start = 0, end; start < insns->cnt; start = end) {
+		size_t own = 0, entry = SIZE_MAX;
+		/* one function per label */
+		for (end = start + 1; end < insns->cnt && !insns->list[end].label; end++);
+		for (size_t i = start; i < end; i++)
+			own += !insns->list[i].label && insns->list[i].entry;
+		if (!own) {
+			hidden += end - start - insns->list[start].label;
+			hidden_funcs += end - start > 1;
+			continue;
+		}
+		if (insns->list[start].label)
+			fprintf(stdout, "%s:\n", insns->list[start].text);
+		for (size_t i = start + insns->list[start].label; i < end; i++) {
+			print_entry(prog, insns->list[i].entry, &entry);
+			fprintf(stdout, "\t%s\n", insns->list[i].text);
+			shown++;
+		}
+	}
+	fprintf(stdout, "[asm: %zu instructions shown", shown);
+	if (hidden)
+		fprintf(stdout, ", %zu in %zu functions only from headers hidden", hidden, hidden_funcs);
+	fputs("]\n", stdout);
+}
+
+/* compare instructions ignoring the numbering of local labels (`.L12`, `.LC3`) */
+static bool same_insn(struct asm_insn const *a, struct asm_insn const *b)
+{
+	char const *x = a->text, *y = b->text;
+	if (a->label != b->label)
+		return false;
+	while (*x && *x == *y) {
+		if (x[0] == '.' && x[1] == 'L' && y[1] == 'L') {
+			x += 2 + strspn(x + 2, "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+			y += 2 + strspn(y + 2, "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+			x += strspn(x, "0123456789");
+			y += strspn(y, "0123456789");
+			continue;
+		}
+		x++, y++;
+	}
+	return *x == *y;
+}
+
+static void print_change(struct program *prog, char sign, struct asm_insn const *insn, char const **func, size_t *entry)
+{
+	/* name the enclosing function once */
+	if (*func) {
+		fprintf(stdout, "%s:\n", *func);
+		*func = NULL;
+	}
+	if (insn->label) {
+		fprintf(stdout, "%c %s:\n", sign, insn->text);
+		*entry = SIZE_MAX;
+		return;
+	}
+	print_entry(prog, insn->entry, entry);
+	fprintf(stdout, "%c\t%s\n", sign, insn->text);
+}
+
+/* line diff of the last two builds from their longest common subsequence */
+static void print_diff(struct program *prog, struct asm_list const *old, struct asm_list const *new)
+{
+	size_t n = old->cnt, m = new->cnt, added = 0, removed = 0, entry = SIZE_MAX;
+	uint32_t *lcs;
+	char const *func = NULL;
+
+	if ((n + 1) * (m + 1) > ASM_DIFF_MAX) {
+		fprintf(stdout, "[asm: %zu -> %zu instructions, too large to diff]\n", n, m);
+		return;
+	}
+	xcalloc(&lcs, (n + 1) * (m + 1), sizeof *lcs, "print_diff()");
+	/* lcs[i * (m + 1) + j] is the common length of old[i..] and new[j..] */
+	for (size_t i = n; i-- > 0;) {
+		for (size_t j = m; j-- > 0;) {
+			uint32_t skip_old = lcs[(i + 1) * (m + 1) + j], skip_new = lcs[i * (m + 1) + j + 1];
+			if (same_insn(old->list + i, new->list + j))
+				lcs[i * (m + 1) + j] = lcs[(i + 1) * (m + 1) + j + 1] + 1;
+			else
+				lcs[i * (m + 1) + j] = (skip_old > skip_new) ? skip_old : skip_new;
+		}
+	}
+	for (size_t i = 0, j = 0; i < n || j < m;) {
+		if (i < n && j < m && same_insn(old->list + i, new->list + j)) {
+			if (new->list[j].label)
+				func = new->list[j].text;
+			/* each hunk names its input line again */
+			entry = SIZE_MAX;
+			i++, j++;
+		} else if (j < m && (i == n || lcs[i * (m + 1) + j + 1] >= lcs[(i + 1) * (m + 1) + j])) {
+			print_change(prog, '+', new->list + j++, &func, &entry);
+			added++;
+		} else {
+			print_change(prog, '-', old->list + i++, &func, &entry);
+			removed++;
+		}
+	}
+	free(lcs);
+	if (added || removed)
+		fprintf(stdout, "[asm: +%zu -%zu since the previous build]\n", added, removed);
+	else
+		fprintf(stdout, "%s\n", "[asm: no change since the previous build]");
+}
+
+/* after a run, show the listing or the change since the previous build */
+void asm_report(struct program *prog)
+{
+	if (asm_listing && asm_mode != ASM_OFF && !asm_fresh)
+		fprintf(stdout, "%s\n", "[asm: no assembly captured]");
+	if (asm_fresh) {
+		if (asm_listing)
+			print_listing(prog, &asm_cur);
+		else if (!asm_prev.list)
+			fprintf(stdout, "%s\n", "[asm: no previous build to compare]");
+		else
+			print_diff(prog, &asm_prev, &asm_cur);
+	}
+	asm_fresh = asm_listing = false;
+	if (asm_mode == ASM_ONCE)
+		asm_mode = ASM_OFF;
+}
@@ -0,0 +1,43 @@
+/*
+ * asmview.h - annotated assembly of the executed build
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(ASMVIEW_H)
+#define ASMVIEW_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* largest listing pair diffed with the quadratic longest common subsequence */
+#define ASM_DIFF_MAX	(4096 * 4096)
+
+/* when the compiler's assembly is kept */
+enum asm_mode {
+	ASM_OFF, ASM_ONCE, ASM_AUTO,
+};
+
+/* struct definition for one instruction or function label */
+struct asm_insn {
+	char *text;
+	/* input line number (0 for code from headers) */
+	size_t entry;
+	bool label;
+};
+
+/* struct definition for the assembly of one build */
+struct asm_list {
+	struct asm_insn *list;
+	size_t cnt, max;
+};
+
+/* prototypes */
+bool set_asm(struct program *prog, char const *mode);
+bool asm_capture(void);
+void asm_args(char *const cc_args[], struct str_list *args);
+void asm_collect(char const *out, bool keep);
+void asm_report(struct program *prog);
+
+#endif /* !defined(ASMVIEW_H) */
@@ -0,0 +1,550 @@
+/*
+ * bench.c - micro-benchmark harness
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "bench.h"
+#include "cache.h"
+#include "compile.h"
+#include <math.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+
+/* struct definition for stored benchmark results */
+struct bench_entry {
+	long long stamp;
+	char *cc, *flags, *cpu;
+	double median, mad, min;
+};
+
+extern char **environ;
+extern char const *prog_end;
+
+/* helpers defined after the prologue */
+static char const *const bench_funcs =
+	"\n#define cepl_keep(x) __extension__ ({ __typeof__(x) cepl_v = (x); "
+		"__asm__ __volatile__(\"\" : : \"r,m\"(cepl_v) : \"memory\"); })\n"
+	"#define cepl_clobber() __asm__ __volatile__(\"\" : : : \"memory\")\n"
+	"static unsigned long long cepl_bench_now(void)\n"
+	"{\n"
+	"\tstruct timespec ts;\n"
+	"\tclock_gettime(CLOCK_MONOTONIC, &ts);\n"
+	"\treturn (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;\n"
+	"}\n"
+	"static void cepl_bench_report(int n, int cnt, unsigned long long const *iters, unsigned long long const *samples)\n"
+	"{\n"
+	"\tchar const *env = getenv(\"CEPL_BENCH_FD\");\n"
+	"\tint fd = env ? atoi(env) : 1;\n"
+	"\tfor (int i = 0; i < n; i++) {\n"
+	"\t\tdprintf(fd, \"%llu\", iters[i]);\n"
+	"\t\tfor (int j = 0; j < cnt; j++)\n"
+	"\t\t\tdprintf(fd, \" %llu\", samples[i * cnt + j]);\n"
+	"\t\tdprintf(fd, \"\\n\");\n"
+	"\t}\n"
+	"}\n";
+
+static double median(double const *list, size_t cnt)
+{
+	double sorted[cnt];
+	memcpy(sorted, list, sizeof sorted);
+	qsort(sorted, cnt, sizeof *sorted, cmp_double);
+	return (cnt % 2) ? sorted[cnt / 2] : (sorted[cnt / 2 - 1] + sorted[cnt / 2]) / 2;
+}
+
+/* median, median absolute deviation, and minimum */
+static void bench_stats(struct bench_result *res)
+{
+	double dev[res->cnt];
+	res->median = median(res->ns, res->cnt);
+	res->min = res->ns[0];
+	for (size_t i = 0; i < res->cnt; i++) {
+		dev[i] = fabs(res->ns[i] - res->median);
+		if (res->ns[i] < res->min)
+			res->min = res->ns[i];
+	}
+	res->mad = median(dev, res->cnt);
+}
+
+/* emit one timed batch of statement `i` */
+static void emit_batch(FILE *out, char const *body, size_t i, char const *indent)
+{
+	fprintf(out, "%scepl_t0 = cepl_bench_now();\n", indent);
+	fprintf(out, "%sfor (unsigned long long cepl_i = 0; cepl_i < cepl_iters[%zu]; cepl_i++) {\n", indent, i);
+	fprintf(out, "%s\t%s\n", indent, body);
+	fprintf(out, "%s}\n", indent);
+	fprintf(out, "%scepl_t1 = cepl_bench_now();\n", indent);
+}
+
+/* generate the harness around each loop body, appended to the end of `main()` */
+static char *bench_src(struct program *prog, char *const bodies[], size_t cnt)
+{
+	FILE *out;
+	char *src;
+	size_t len;
+
+	if (!(out = open_memstream(&src, &len)))
+		ERR("open_memstream()");
+	fputs(prog->src[1].funcs.buf, out);
+	fputs(bench_funcs, out);
+	fputs(prog->src[1].body.buf, out);
+	fprintf(out, "\n\t{\n\t\tunsigned long long cepl_iters[%zu], cepl_t0, cepl_t1, cepl_samples[%zu];\n",
+			cnt, cnt * BENCH_SAMPLES);
+	for (size_t i = 0; i < cnt; i++) {
+		/* double the batch size until one batch reaches the target time */
+		fprintf(out, "\t\tfor (cepl_iters[%zu] = 1;; cepl_iters[%zu] *= 2) {\n", i, i);
+		emit_batch(out, bodies[i], i, "\t\t\t");
+		fprintf(out, "\t\t\tif (cepl_t1 - cepl_t0 >= %lluull || cepl_iters[%zu] >= (1ull << 40))\n"
+				"\t\t\t\tbreak;\n\t\t}\n", BENCH_TARGET_NS, i);
+		/* one untimed batch at the final size to warm up */
+		emit_batch(out, bodies[i], i, "\t\t");
+	}
+	/* interleave samples, alternating the order to cancel out position effects */
+	fprintf(out, "\t\tfor (int cepl_s = 0; cepl_s < %d; cepl_s++) {\n", BENCH_SAMPLES);
+	for (size_t pass = 0; pass < ((cnt > 1) ? 2 : 1); pass++) {
+		if (cnt > 1)
+			fprintf(out, pass ? "\t\t\t} else {\n" : "\t\t\tif (cepl_s %% 2) {\n");
+		for (size_t j = 0; j < cnt; j++) {
+			size_t i = pass ? j : cnt - j - 1;
+			emit_batch(out, bodies[i], i, "\t\t\t\t");
+			fprintf(out, "\t\t\t\tcepl_samples[%zu + cepl_s] = cepl_t1 - cepl_t0;\n", i * BENCH_SAMPLES);
+		}
+	}
+	if (cnt > 1)
+		fprintf(out, "\t\t\t}\n");
+	fprintf(out, "\t\t}\n\t\tcepl_bench_report(%zu, %d, cepl_iters, cepl_samples);\n\t}\n", cnt, BENCH_SAMPLES);
+	fputs(prog_end, out);
+	fclose(out);
+	return src;
+}
+
+/* run the harness binary with results written to a memfd */
+static bool exec_bench(char const *path, int cpu, size_t cnt, struct bench_result res[])
+{
+	char buf[PAGE_SIZE * 4], *cur, *end;
+	int mem_fd, status;
+	ssize_t len;
+	pid_t pid;
+
+	if ((mem_fd = memfd_create("cepl_bench", 0)) == -1) {
+		WARN("memfd_create()");
+		return false;
+	}
+
+	switch ((pid = fork())) {
+	/* error */
+	case -1:
+		ERR("error forking benchmark");
+		break;
+
+	/* child */
+	case 0:
+		reset_handlers();
+		if (cpu >= 0) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			if (sched_setaffinity(0, sizeof set, &set) == -1)
+				WARN("unable to pin benchmark to cpu %d", cpu);
+		}
+		snprintf(buf, sizeof buf, "%d", mem_fd);
+		setenv("CEPL_BENCH_FD", buf, 1);
+		execle(path, path, (char *)NULL, environ);
+		/* execle() should never return */
+		ERR("error forking benchmark");
+		break;
+
+	/* parent */
+	default:
+		status = wait_status(pid, "benchmark", true);
+	}
+
+	len = pread(mem_fd, buf, sizeof buf - 1, 0);
+	close(mem_fd);
+	if (status || len <= 0)
+		return false;
+	buf[len] = '\0';
+	cur = buf;
+	for (size_t i = 0; i < cnt; i++) {
+		res[i].iters = strtoull(cur, &cur, 10);
+		for (res[i].cnt = 0; res[i].cnt < BENCH_SAMPLES; res[i].cnt++) {
+			unsigned long long ns = strtoull(cur, &end, 10);
+			if (end == cur)
+				break;
+			res[i].ns[res[i].cnt] = (double)ns / res[i].iters;
+			cur = end;
+		}
+		if (!res[i].iters || !res[i].cnt)
+			return false;
+		bench_stats(res + i);
+	}
+	return true;
+}
+
+/* strip the trailing semicolon so expressions can be wrapped */
+static char *trim_stmt(char const *stmt)
+{
+	char *trimmed;
+	size_t len;
+	xmalloc(&trimmed, strlen(stmt) + 1, "trim_stmt()");
+	strmv(0, trimmed, stmt + strspn(stmt, " \t"));
+	for (len = strlen(trimmed); len > 0 && strchr(" \t;", trimmed[len - 1]); len--)
+		trimmed[len - 1] = '\0';
+	return trimmed;
+}
+
+/* loop body for a statement, keeping the value of expressions alive */
+static char *wrap_stmt(char const *stmt, bool keep)
+{
+	char *body;
+	if (asprintf(&body, keep ? "cepl_keep((%s));" : "%s; cepl_clobber();", stmt) == -1)
+		ERR("asprintf()");
+	return body;
+}
+
+/* compile and run statements interleaved in a timing harness using the current program as setup */
+bool run_bench(struct program *prog, char *const stmts[], size_t cnt, int cpu, struct bench_result res[])
+{
+	char const *path = "/tmp/cepl_bench";
+	char *trimmed[BENCH_MAX], *bodies[BENCH_MAX], *src;
+	char *syntax_only[] = {"-fsyntax-only", NULL};
+	bool ret;
+	int status;
+
+	if (cnt > BENCH_MAX)
+		ERRX("too many statements passed to run_bench()");
+	for (size_t i = 0; i < cnt; i++) {
+		trimmed[i] = trim_stmt(stmts[i]);
+		bodies[i] = wrap_stmt(trimmed[i], true);
+	}
+	src = bench_src(prog, bodies, cnt);
+	if ((status = build_program(src, prog->cc_list.list, path, NULL, false))) {
+		/* find which statements can't be wrapped as expressions */
+		for (size_t i = 0; i < cnt; i++) {
+			free(src);
+			if (cnt > 1) {
+				src = bench_src(prog, bodies + i, 1);
+				if (!build_program(src, prog->cc_list.list, path, syntax_only, false))
+					continue;
+				free(src);
+			}
+			free(bodies[i]);
+			bodies[i] = wrap_stmt(trimmed[i], false);
+			src = NULL;
+		}
+		free(src);
+		src = bench_src(prog, bodies, cnt);
+		status = build_program(src, prog->cc_list.list, path, NULL, true);
+	}
+	for (size_t i = 0; i < cnt; i++) {
+		free(bodies[i]);
+		free(trimmed[i]);
+	}
+	free(src);
+	if (status)
+		return false;
+
+	ret = exec_bench(path, cpu, cnt, res);
+	if (unlink(path) == -1)
+		WARN("unable to remove %s", path);
+	return ret;
+}
+
+/* read the first line of a small file, optionally the first one starting with `prefix` */
+static bool read_line_prefix(char const *path, char const *prefix, char *buf, size_t len)
+{
+	FILE *file;
+	bool found = false;
+	if (!(file = fopen(path, "rb")))
+		return false;
+	while (!found && fgets(buf, len, file))
+		found = !prefix || !strncmp(buf, prefix, strlen(prefix));
+	fclose(file);
+	buf[strcspn(buf, "\n")] = '\0';
+	return found;
+}
+
+/* warn about sources of measurement noise */
+static void print_noise(struct bench_result const *res, int cpu)
+{
+	char path[128], buf[128];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	double load;
+
+	snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", (cpu >= 0) ? cpu : 0);
+	if (read_line_prefix(path, NULL, buf, sizeof buf) && strcmp(buf, "performance"))
+		fprintf(stdout, "[noise: cpu frequency governor is \"%s\", not \"performance\"]\n", buf);
+	if ((read_line_prefix("/sys/devices/system/cpu/intel_pstate/no_turbo", NULL, buf, sizeof buf) && !strcmp(buf, "0"))
+			|| (read_line_prefix("/sys/devices/system/cpu/cpufreq/boost", NULL, buf, sizeof buf) && !strcmp(buf, "1")))
+		fprintf(stdout, "%s\n", "[noise: turbo boost is enabled]");
+	if (read_line_prefix("/proc/loadavg", NULL, buf, sizeof buf) && sscanf(buf, "%lf", &load) == 1
+			&& cpus > 0 && load > cpus * 0.25)
+		fprintf(stdout, "[noise: load average %.2f on %ld cpus]\n", load, cpus);
+	if (res && res->median > 0 && res->mad / res->median > 0.05)
+		fprintf(stdout, "[noise: MAD is %.1f%% of the median]\n", res->mad / res->median * 100);
+}
+
+static void print_result(char const *label, struct bench_result const *res)
+{
+	fprintf(stdout, "[%smedian: %.3f ns/iter, MAD: %.3f ns (%.2f%%), min: %.3f ns/iter, %zu samples x %zu iterations]\n",
+			label, res->median, res->mad, res->median > 0 ? res->mad / res->median * 100 : 0,
+			res->min, res->cnt, res->iters);
+}
+
+/* replace field separators in a results store column */
+static char *tsv_field(char *str)
+{
+	for (char *cur = str; *cur; cur++) {
+		if (*cur == '\t' || *cur == '\n')
+			*cur = ' ';
+	}
+	return str;
+}
+
+/* compiler name and version */
+static char *cc_ident(struct program *prog)
+{
+	char *args[] = {prog->cc_list.list[0], "-dumpfullversion", NULL}, *version = NULL, *ident;
+	if (run_cmd(args, &version, false)) {
+		free(version);
+		version = NULL;
+		args[1] = "-dumpversion";
+		run_cmd(args, &version, false);
+	}
+	if (version)
+		version[strcspn(version, "\n")] = '\0';
+	if (asprintf(&ident, "%s %s", prog->cc_list.list[0], version ? version : "") == -1)
+		ERR("asprintf()");
+	free(version);
+	return tsv_field(ident);
+}
+
+/* compiler flags excluding input, output, and cached objects */
+static char *cc_flags(struct program *prog)
+{
+	FILE *out;
+	char *flags;
+	size_t len;
+	bool first = true;
+
+	if (!(out = open_memstream(&flags, &len)))
+		ERR("open_memstream()");
+	for (size_t i = 1; prog->cc_list.list[i]; i++) {
+		char const *arg = prog->cc_list.list[i];
+		if (!strcmp(arg, "-xnone"))
+			break;
+		if (!*arg || !strcmp(arg, "-") || !strncmp(arg, "-o", 2) || !strncmp(arg, "-x", 2))
+			continue;
+		fprintf(out, first ? "%s" : " %s", arg);
+		first = false;
+	}
+	fclose(out);
+	return tsv_field(flags);
+}
+
+/* hash of a statement, the user-visible program it runs after, and the harness (`NULL` for `;bench`) */
+static uint64_t snippet_hash(struct program *prog, char const *stmt, char const *harness)
+{
+	uint64_t hash = hash_str(FNV_OFFSET, prog->src[0].funcs.buf);
+	hash = hash_str(hash, prog->src[0].body.buf);
+	/* harnesses time the same statement differently, so keep their histories apart */
+	if (harness)
+		hash = hash_str(hash, harness);
+	return hash_str(hash, stmt);
+}
+
+/* find the newest stored result for `hash` */
+static bool last_entry(char const *path, uint64_t hash, struct bench_entry *entry)
+{
+	FILE *store;
+	char *line = NULL, *field[9], *cur;
+	size_t len = 0;
+	bool found = false;
+
+	if (!(store = fopen(path, "rb")))
+		return false;
+	while (getline(&line, &len, store) != -1) {
+		size_t i = 0;
+		line[strcspn(line, "\n")] = '\0';
+		for (cur = strtok(line, "\t"); cur && i < arr_len(field); cur = strtok(NULL, "\t"))
+			field[i++] = cur;
+		if (i < arr_len(field) || strtoull(field[1], NULL, 16) != hash)
+			continue;
+		if (found) {
+			free(entry->cc);
+			free(entry->flags);
+			free(entry->cpu);
+		}
+		entry->stamp = strtoll(field[0], NULL, 10);
+		entry->cc = strdup(field[2]);
+		entry->flags = strdup(field[3]);
+		entry->cpu = strdup(field[4]);
+		entry->median = strtod(field[5], NULL);
+		entry->mad = strtod(field[6], NULL);
+		entry->min = strtod(field[7], NULL);
+		found = true;
+	}
+	free(line);
+	fclose(store);
+	return found;
+}
+
+/* flag results which moved by more than the noise since the last run of the same snippet */
+static void check_regression(struct bench_entry const *prev, struct bench_entry const *cur)
+{
+	char date[32];
+	double ratio = cur->median / prev->median;
+	time_t stamp = prev->stamp;
+
+	if (fabs(cur->median - prev->median) <= 2 * (cur->mad + prev->mad) || fabs(ratio - 1) < 0.05)
+		return;
+	strftime(date, sizeof date, "%Y-%m-%d %H:%M", localtime(&stamp));
+	fprintf(stdout, "[%s: %.2fx %s than %s with %s %s%s]\n",
+			(ratio > 1) ? "regression" : "improvement",
+			(ratio > 1) ? ratio : 1 / ratio, (ratio > 1) ? "slower" : "faster",
+			date, prev->cc, prev->flags,
+			strcmp(prev->cpu, cur->cpu) ? " on a different cpu" : "");
+}
+
+/* append a result to `$XDG_DATA_HOME/cepl/bench.tsv` and compare it with the previous one */
+static void store_result(struct program *prog, char const *stmt, char const *harness, struct bench_result const *res)
+{
+	FILE *store;
+	char buf[256], *path, *snippet;
+	uint64_t hash = snippet_hash(prog, stmt, harness);
+	struct bench_entry prev, cur = {
+		.stamp = time(NULL),
+		.cc = cc_ident(prog),
+		.flags = cc_flags(prog),
+		.median = res->median, .mad = res->mad, .min = res->min,
+	};
+
+	if (!read_line_prefix("/proc/cpuinfo", "model name", buf, sizeof buf))
+		strmv(0, buf, "unknown");
+	cur.cpu = strdup(tsv_field(buf + strcspn(buf, ":") + strspn(buf + strcspn(buf, ":"), ": \t")));
+	if (!(path = data_file("bench.tsv")))
+		goto done;
+	if (last_entry(path, hash, &prev)) {
+		check_regression(&prev, &cur);
+		free(prev.cc);
+		free(prev.flags);
+		free(prev.cpu);
+	}
+	if (!(store = fopen(path, "ab"))) {
+		WARN("unable to open %s", path);
+		goto done;
+	}
+	snippet = tsv_field(strdup(stmt));
+	fprintf(store, "%lld\t%016jx\t%s\t%s\t%s\t%.4f\t%.4f\t%.4f\t%s\n", cur.stamp, (uintmax_t)hash,
+			cur.cc, cur.flags, cur.cpu, cur.median, cur.mad, cur.min, snippet);
+	fclose(store);
+	free(snippet);
+
+done:
+	free(path);
+	free(cur.cc);
+	free(cur.flags);
+	free(cur.cpu);
+}
+
+/* parse an optional leading `-c<cpu>` argument */
+static bool parse_cpu(char **args, int *cpu)
+{
+	char *end;
+	*cpu = -1;
+	if (strncmp(*args, "-c", 2))
+		return true;
+	*cpu = strtol(*args + 2, &end, 10);
+	if (end == *args + 2 || *cpu < 0) {
+		WARNX("%s", "invalid cpu for -c");
+		return false;
+	}
+	*args = end + strspn(end, " \t");
+	return true;
+}
+
+/* `;bench [-c<cpu>] <statement>` */
+void bench_cmd(struct program *prog, char *args)
+{
+	struct bench_result res = {0};
+	int cpu;
+
+	if (!parse_cpu(&args, &cpu))
+		return;
+	if (!*args) {
+		WARNX("%s", "usage: ;bench [-c<cpu>] <statement>");
+		return;
+	}
+	if (!run_bench(prog, &args, 1, cpu, &res))
+		return;
+	print_result("", &res);
+	print_noise(&res, cpu);
+	store_result(prog, args, NULL, &res);
+}
+
+/* split off a `{...}` group with balanced braces */
+static char *brace_group(char **args)
+{
+	char *start = *args + strspn(*args, " \t"), *cur;
+	int depth = 0;
+	if (*start != '{')
+		return NULL;
+	for (cur = start; *cur; cur++) {
+		if (*cur == '{')
+			depth++;
+		else if (*cur == '}' && !--depth)
+			break;
+	}
+	if (!*cur)
+		return NULL;
+	*cur = '\0';
+	*args = cur + 1;
+	return start + 1;
+}
+
+/* `;compare [-c<cpu>] {<statement A>} {<statement B>}` */
+void compare_cmd(struct program *prog, char *args)
+{
+	struct bench_result res[2] = {0};
+	double ratio[BENCH_SAMPLES], mid;
+	char *stmts[2];
+	size_t cnt, k;
+	int cpu;
+
+	if (!parse_cpu(&args, &cpu))
+		return;
+	if (!(stmts[0] = brace_group(&args)) || !(stmts[1] = brace_group(&args))) {
+		WARNX("%s", "usage: ;compare [-c<cpu>] {<statement A>} {<statement B>}");
+		return;
+	}
+	if (!run_bench(prog, stmts, 2, cpu, res))
+		return;
+	print_result("A: ", res);
+	print_result("B: ", res + 1);
+
+	/* paired ratios from adjacent samples */
+	cnt = (res[0].cnt < res[1].cnt) ? res[0].cnt : res[1].cnt;
+	for (size_t i = 0; i < cnt; i++)
+		ratio[i] = res[1].ns[i] / res[0].ns[i];
+	qsort(ratio, cnt, sizeof *ratio, cmp_double);
+	mid = median(ratio, cnt);
+	/* distribution-free 95% confidence interval of the median from order statistics */
+	k = (cnt - 1.96 * sqrt(cnt)) / 2;
+	fprintf(stdout, "[B/A: %.3fx (95%% CI %.3fx-%.3fx), ", mid, ratio[k], ratio[cnt - 1 - k]);
+	if (ratio[k] > 1)
+		fprintf(stdout, "A is %.2fx faster]\n", mid);
+	else if (ratio[cnt - 1 - k] < 1)
+		fprintf(stdout, "B is %.2fx faster]\n", 1 / mid);
+	else
+		fprintf(stdout, "%s]\n", "no significant difference");
+	print_noise(NULL, cpu);
+	store_result(prog, stmts[0], ";compare", res);
+	store_result(prog, stmts[1], ";compare", res + 1);
+}
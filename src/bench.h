@@ -0,0 +1,34 @@
+/*
+ * bench.h - micro-benchmark harness
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(BENCH_H)
+#define BENCH_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* number of timed samples */
+#define BENCH_SAMPLES	15
+/* minimum duration of one timed sample in nanoseconds */
+#define BENCH_TARGET_NS	10000000ull
+/* maximum number of interleaved statements */
+#define BENCH_MAX	2
+
+/* struct definition for benchmark results */
+struct bench_result {
+	size_t iters, cnt;
+	/* nanoseconds per iteration for each sample */
+	double ns[BENCH_SAMPLES];
+	double median, mad, min;
+};
+
+/* prototypes */
+bool run_bench(struct program *prog, char *const stmts[], size_t cnt, int cpu, struct bench_result res[]);
+void bench_cmd(struct program *prog, char *args);
+void compare_cmd(struct program *prog, char *args);
+
+#endif /* !defined(BENCH_H) */
@@ -0,0 +1,132 @@
+/*
+ * cache.c - persistent build cache
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "cache.h"
+
+/* `mkdir -p` */
+static bool make_dirs(char *path)
+{
+	for (char *sep = strchr(path + 1, '/'); ; sep = strchr(sep + 1, '/')) {
+		if (sep)
+			*sep = '\0';
+		if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+			if (sep)
+				*sep = '/';
+			return false;
+		}
+		if (!sep)
+			return true;
+		*sep = '/';
+	}
+}
+
+/* search `$PATH` for a program the way `execvp()` would */
+bool stat_path(char const *name, struct stat *st)
+{
+	char *path_env = getenv("PATH"), *paths, *path;
+	bool found = false;
+
+	if (strchr(name, '/'))
+		return !stat(name, st);
+	if (!path_env)
+		path_env = "/usr/local/bin:/usr/bin:/bin";
+	xmalloc(&paths, strlen(path_env) + 1, "stat_path()");
+	strmv(0, paths, path_env);
+	for (char *dir = strtok(paths, ":"); dir && !found; dir = strtok(NULL, ":")) {
+		if (asprintf(&path, "%s/%s", dir, name) == -1)
+			ERR("asprintf()");
+		found = !stat(path, st) && S_ISREG(st->st_mode);
+		free(path);
+	}
+	free(paths);
+	return found;
+}
+
+/* return `$<env>/cepl/<name>` or `$HOME/<fallback>/cepl/<name>`, caller frees */
+static char *xdg_path(char const *env, char const *fallback, char const *name)
+{
+	char *base = getenv(env), *home = getenv("HOME"), *path;
+
+	if (base && *base) {
+		if (asprintf(&path, "%s/cepl/%s", base, name) == -1)
+			ERR("asprintf()");
+	} else if (home && *home) {
+		if (asprintf(&path, "%s/%s/cepl/%s", home, fallback, name) == -1)
+			ERR("asprintf()");
+	} else {
+		return NULL;
+	}
+	return path;
+}
+
+/* return (and create) `$XDG_CACHE_HOME/cepl/<name>`, caller frees */
+char *cache_dir(char const *name)
+{
+	char *dir;
+
+	if (!(dir = xdg_path("XDG_CACHE_HOME", ".cache", name)))
+		return NULL;
+	if (!make_dirs(dir)) {
+		WARN("unable to create cache directory %s", dir);
+		free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+/* return `$XDG_CONFIG_HOME/cepl/<name>`, caller frees */
+char *config_file(char const *name)
+{
+	return xdg_path("XDG_CONFIG_HOME", ".config", name);
+}
+
+/* return `$XDG_DATA_HOME/cepl/<name>` and create its directory, caller frees */
+char *data_file(char const *name)
+{
+	char *path, *sep;
+
+	if (!(path = xdg_path("XDG_DATA_HOME", ".local/share", name)))
+		return NULL;
+	sep = strrchr(path, '/');
+	*sep = '\0';
+	if (!make_dirs(path)) {
+		WARN("unable to create data directory %s", path);
+		free(path);
+		return NULL;
+	}
+	*sep = '/';
+	return path;
+}
+
+/* hash the compiler binary identity and the flags that affect its output */
+uint64_t cc_hash(struct program *prog)
+{
+	uint64_t hash = FNV_OFFSET;
+	char buf[64];
+	struct stat st;
+
+	hash = hash_str(hash, prog->cc_list.list[0]);
+	/* a compiler upgrade changes the binary */
+	if (stat_path(prog->cc_list.list[0], &st)) {
+		snprintf(buf, sizeof buf, "%jd:%jd:%jd", (intmax_t)st.st_ino,
+				(intmax_t)st.st_size, (intmax_t)st.st_mtime);
+		hash = hash_str(hash, buf);
+	}
+	for (size_t i = 1; i < prog->cc_list.cnt && prog->cc_list.list[i]; i++) {
+		char const *arg = prog->cc_list.list[i];
+		/* skip input, output, and link-only arguments */
+		if (!strcmp(arg, "-") || !strncmp(arg, "-o", 2) || !strncmp(arg, "-l", 2)
+				|| !strncmp(arg, "-L", 2) || !strncmp(arg, "-W", 2))
+			continue;
+		hash = hash_str(hash, arg);
+	}
+	return hash;
+}
@@ -0,0 +1,44 @@
+/*
+ * cache.h - persistent build cache
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(CACHE_H)
+#define CACHE_H 1
+
+#include "defs.h"
+#include "errs.h"
+#include <sys/stat.h>
+
+/* FNV-1a parameters */
+#define FNV_OFFSET	0xcbf29ce484222325ull
+#define FNV_PRIME	0x100000001b3ull
+
+/* prototypes */
+char *cache_dir(char const *name);
+char *config_file(char const *name);
+char *data_file(char const *name);
+uint64_t cc_hash(struct program *prog);
+bool stat_path(char const *name, struct stat *st);
+
+/* fold a string into an FNV-1a hash */
+static inline uint64_t hash_str(uint64_t hash, char const *str)
+{
+	for (; str && *str; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= FNV_PRIME;
+	}
+	/* separate successive strings */
+	hash ^= 0xff;
+	return hash * FNV_PRIME;
+}
+
+/* check if a path exists */
+static inline bool path_exists(char const *path)
+{
+	return !access(path, F_OK);
+}
+
+#endif /* !defined(CACHE_H) */
@@ -0,0 +1,165 @@
+/*
+ * cachesim.c - simulated cache and branch statistics
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "cachesim.h"
+#include "compile.h"
+
+#define SIM_BIN		"/tmp/cepl_cachesim"
+#define SIM_OUT		"/tmp/cepl_cachegrind.out"
+
+/* cachegrind events summed into each report column */
+static struct {
+	char const *name;
+	enum sim_col col;
+} const event_list[] = {
+	{"Ir", SIM_IR},
+	{"D1mr", SIM_D1}, {"D1mw", SIM_D1},
+	{"ILmr", SIM_LL}, {"DLmr", SIM_LL}, {"DLmw", SIM_LL},
+	{"Bcm", SIM_BR}, {"Bim", SIM_BR},
+};
+
+/* map the `events:` header to report columns (-1 for unused events) */
+static size_t parse_events(char *line, int cols[static 32])
+{
+	size_t cnt = 0;
+	char *saved;
+	for (char *tok = strtok_r(line, " \t", &saved); tok && cnt < 32; tok = strtok_r(NULL, " \t", &saved)) {
+		cols[cnt] = -1;
+		for (size_t i = 0; i < arr_len(event_list); i++) {
+			if (!strcmp(tok, event_list[i].name))
+				cols[cnt] = event_list[i].col;
+		}
+		cnt++;
+	}
+	return cnt;
+}
+
+/* add a count line (`<line> <count>...`) to `row` */
+static void add_counts(char const *line, int const cols[static 32], size_t cnt, uint64_t row[static SIM_CNT])
+{
+	char *end;
+	for (size_t i = 0; i < cnt; i++) {
+		uint64_t val = strtoull(line, &end, 10);
+		/* trailing zero counts are omitted */
+		if (end == line)
+			break;
+		if (cols[i] != -1)
+			row[cols[i]] += val;
+		line = end;
+	}
+}
+
+/* whether a `fl=` name is the generated source */
+static bool is_stdin(char const *name)
+{
+	char const *base = strrchr(name, '/');
+	return !strcmp(base ? base + 1 : name, "<stdin>");
+}
+
+/* sum the cachegrind output per entry; `rows[max]` collects generated code and `rows[max + 1]` everything else */
+static bool parse_output(uint64_t (*rows)[SIM_CNT], size_t max, uint64_t total[static SIM_CNT])
+{
+	FILE *file;
+	char *line = NULL;
+	size_t len = 0, cnt = 0;
+	int cols[32];
+	bool in_stdin = false;
+
+	if (!(file = fopen(SIM_OUT, "rb"))) {
+		WARN("unable to open %s", SIM_OUT);
+		return false;
+	}
+	while (getline(&line, &len, file) != -1) {
+		char *end;
+		line[strcspn(line, "\n")] = '\0';
+		if (!strncmp(line, "events:", 7)) {
+			cnt = parse_events(line + 7, cols);
+		} else if (!strncmp(line, "fl=", 3) || !strncmp(line, "fi=", 3) || !strncmp(line, "fe=", 3)) {
+			in_stdin = is_stdin(line + 3);
+		} else if (!strncmp(line, "summary:", 8)) {
+			add_counts(line + 8, cols, cnt, total);
+		} else if (isdigit((unsigned char)line[0])) {
+			size_t entry = strtoull(line, &end, 10);
+			if (!in_stdin || !entry)
+				entry = max + 1;
+			else if (entry > max)
+				entry = max;
+			/* counts follow the line number */
+			add_counts(end, cols, cnt, rows[entry]);
+		}
+	}
+	free(line);
+	fclose(file);
+	if (!cnt)
+		WARNX("no events in %s", SIM_OUT);
+	return cnt;
+}
+
+static void print_row(char const *label, uint64_t const row[static SIM_CNT], char const *line)
+{
+	fprintf(stdout, "%6s %14ju %10ju %10ju %10ju  %.50s\n", label, (uintmax_t)row[SIM_IR],
+			(uintmax_t)row[SIM_D1], (uintmax_t)row[SIM_LL], (uintmax_t)row[SIM_BR], line);
+}
+
+/* `;cachesim`: run the program under cachegrind and attribute the counts to input lines */
+void cachesim_run(struct program *prog)
+{
+	char *const extra[] = {"-g", NULL};
+	char *const args[] = {
+		"valgrind", "-q", "--tool=cachegrind", "--cache-sim=yes", "--branch-sim=yes",
+		"--cachegrind-out-file=" SIM_OUT, SIM_BIN, NULL
+	};
+	size_t max = prog->src[1].lines.cnt;
+	uint64_t (*rows)[SIM_CNT], total[SIM_CNT] = {0};
+	struct stat st;
+	char *out = NULL;
+	int status;
+
+	if (!stat_path(args[0], &st)) {
+		fprintf(stdout, "[cachesim: valgrind not found in $PATH]\n");
+		return;
+	}
+	if (build_program(prog->src[1].total.buf, prog->cc_list.list, SIM_BIN, extra, true)) {
+		unlink(SIM_BIN);
+		return;
+	}
+	unlink(SIM_OUT);
+	/* the program's output comes back through the pipe */
+	status = run_cmd(args, &out, true);
+	if (out)
+		fputs(out, stdout);
+	free(out);
+	if (status)
+		fprintf(stdout, "[exit status: %d]\n", status);
+
+	xcalloc(&rows, max + 2, sizeof *rows, "cachesim_run()");
+	if (parse_output(rows, max, total)) {
+		fprintf(stdout, "[cachesim: simulated caches and branch predictor, deterministic across runs]\n");
+		fprintf(stdout, "%6s %14s %10s %10s %10s  %s\n", "entry", "instructions", "D1 misses", "LL misses", "mispredict", "line");
+		for (size_t i = 1; i < max; i++) {
+			char label[32];
+			if (!rows[i][SIM_IR])
+				continue;
+			snprintf(label, sizeof label, "%zu", i);
+			print_row(label, rows[i], prog->src[0].lines.list[i]);
+		}
+		if (rows[max][SIM_IR])
+			print_row("-", rows[max], "(generated main)");
+		if (rows[max + 1][SIM_IR])
+			print_row("-", rows[max + 1], "(libraries and startup)");
+		print_row("total", total, "");
+	}
+	free(rows);
+	if (unlink(SIM_BIN) == -1)
+		WARN("unable to remove %s", SIM_BIN);
+	unlink(SIM_OUT);
+}
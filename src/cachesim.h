@@ -0,0 +1,26 @@
+/*
+ * cachesim.h - simulated cache and branch statistics
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(CACHESIM_H)
+#define CACHESIM_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* columns of the simulation report */
+enum sim_col {
+	SIM_IR,
+	SIM_D1,
+	SIM_LL,
+	SIM_BR,
+	SIM_CNT,
+};
+
+/* prototypes */
+void cachesim_run(struct program *prog);
+
+#endif /* !defined(CACHESIM_H) */
@@ -9,21 +9,40 @@
 #undef _GNU_SOURCE
 #define _GNU_SOURCE
 
+#include "asmview.h"
+#include "bench.h"
+#include "cachesim.h"
 #include "compile.h"
+#include "ctime.h"
+#include "data.h"
 #include "errs.h"
+#include "fold.h"
 #include "hist.h"
+#include "jobs.h"
+#include "layout.h"
+#include "matrix.h"
+#include "mca.h"
 #include "parseopts.h"
+#include "perf.h"
+#include "pgo.h"
 #include "readline.h"
-#include <setjmp.h>
+#include "sample.h"
+#include "scale.h"
+#include "size.h"
+#include "syscalls.h"
+#include "trace.h"
+#include "vec.h"
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-/* SIGINT buffer for non-local goto */
-static sigjmp_buf jmp_env;
 /* TODO: change history filename to a non-hardcoded string */
 static char hist_name[] = "./.cepl_history";
 /* global pointer for signal handler */
 static struct program *prog_ptr;
+/* line passed to the readline callback */
+static char *line_buf;
+static bool line_done;
 
 /* string to compile */
 extern char const *prologue, *prog_start, *prog_start_user, *prog_end;
@@ -38,6 +57,51 @@ static inline char *get_colored_prompt(struct program *prog)
 	return prompt;
 }
 
+/* readline callback for a finished line (`NULL` on EOF) */
+static void line_handler(char *line)
+{
+	line_buf = line;
+	line_done = true;
+	rl_callback_handler_remove();
+}
+
+/* ^C at the prompt discards the pending input */
+static inline void cancel_input(void)
+{
+	rl_callback_sigcleanup();
+	rl_replace_line("", 0);
+	rl_crlf();
+	rl_on_new_line();
+	rl_redisplay();
+}
+
+/* read a line while handling signals and background jobs which exit in the meantime */
+static char *wait_line(char const *prompt)
+{
+	line_buf = NULL;
+	line_done = false;
+	rl_callback_handler_install(prompt ? prompt : "", &line_handler);
+	while (!line_done) {
+		struct pollfd fds[2 + JOBS_MAX] = {{.fd = STDIN_FILENO, .events = POLLIN}, {.fd = jobs_sigfd(), .events = POLLIN}};
+		int pidfds[JOBS_MAX];
+		size_t cnt = jobs_pidfds(pidfds);
+		for (size_t i = 0; i < cnt; i++)
+			fds[2 + i] = (struct pollfd){.fd = pidfds[i], .events = POLLIN};
+		if (poll(fds, 2 + cnt, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			WARN("poll()");
+			rl_callback_handler_remove();
+			break;
+		}
+		if (jobs_events())
+			cancel_input();
+		if (fds[0].revents)
+			rl_callback_read_char();
+	}
+	return line_buf;
+}
+
 static inline char *read_line(struct program *prog)
 {
 	/* false while waiting for input */
@@ -45,16 +109,21 @@ static inline char *read_line(struct program *prog)
 	/* return early if executed with `-e` argument */
 	if (prog->state_flags & EVAL_FLAG)
 		return prog->cur_line = prog->eval_arg;
+	trace_begin("readline", "repl", NULL);
 	/* use colored prompt for tty, empty prompt if stdin is a pipe */
-	if (isatty(STDIN_FILENO))
-		return prog->cur_line = readline(get_colored_prompt(prog));
+	if (isatty(STDIN_FILENO)) {
+		prog->cur_line = wait_line(get_colored_prompt(prog));
+		trace_end();
+		return prog->cur_line;
+	}
 	/* redirect stdout to /dev/null */
 	FILE *bitbucket;
 	xfopen(&bitbucket, "/dev/null", "r+b");
 	rl_outstream = bitbucket;
-	prog->cur_line = readline(NULL);
+	prog->cur_line = wait_line(NULL);
 	rl_outstream = NULL;
 	fclose(bitbucket);
+	trace_end();
 	return prog->cur_line;
 }
 
@@ -111,10 +180,11 @@ static inline void tty_fix(struct program *prog)
 	prog->tty_state.modes_changed = false;
 }
 
-/* general signal handling function */
+/* fatal signal handling function (^C and termination requests arrive through the signalfd) */
 static void sig_handler(int sig)
 {
 	static char const wtf[] = "wtf did you do to the signal mask to hit this return??\n";
+	sigset_t set;
 	int ret;
 	/* reset io stream buffering modes */
 	tty_break(prog_ptr);
@@ -122,33 +192,16 @@ static void sig_handler(int sig)
 	/* cleanup input line */
 	free(prog_ptr->cur_line);
 	prog_ptr->cur_line = NULL;
-	/*
-	 * the siglongjmp() here is needed in order to handle using
-	 * ^C to both both clear the current command-line and also
-	 * to abort running code early
-	 */
-	if (sig == SIGINT) {
-		/*
-		 * else abort current input line and
-		 * siglongjmp() back to loop beginning
-		 */
-		if (prog_ptr->state_flags & EXEC_FLAG) {
-			undo_last_line(prog_ptr);
-			prog_ptr->state_flags &= ~EXEC_FLAG;
-		}
-		/* reap any leftover children */
-		while (wait(&ret) >= 0 && errno != ECHILD);
-		/* remove /tmp/cepl_program if it exists */
-		unlink("/tmp/cepl_program");
-		siglongjmp(jmp_env, 1);
-	}
-	/* cleanup and die if not SIGINT */
 	free_buffers(prog_ptr);
+	/* children run in their own process groups, so take down the foreground one */
+	jobs_abort();
 	cleanup(prog_ptr);
-	/* fallback to kill children who have masked SIGINT */
-	kill(0, SIGKILL);
-	/* reap any leftover children */
-	while (wait(&ret) >= 0 && errno != ECHILD);
+	/* reap any leftover children without waiting on hung up jobs */
+	while (waitpid(-1, &ret, WNOHANG) > 0);
+	/* `sig` stays blocked until the handler returns */
+	sigemptyset(&set);
+	sigaddset(&set, sig);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
 	raise(sig);
 	/* wat */
 	if (write(STDERR_FILENO, wtf, sizeof wtf) < 0)
@@ -159,13 +212,11 @@ static void sig_handler(int sig)
 /* register signal handlers to make sure that history is written out */
 static void reg_handlers(void)
 {
-	/* signals to trap */
+	/* signals to trap (SIGHUP, SIGINT, SIGQUIT, and SIGTERM are read by jobs_events()) */
 	struct { int sig; char *sig_name; } sigs[] = {
-		{SIGHUP, "SIGHUP"}, {SIGINT, "SIGINT"},
-		{SIGQUIT, "SIGQUIT"}, {SIGILL, "SIGILL"},
-		{SIGABRT, "SIGABRT"}, {SIGFPE, "SIGFPE"},
-		{SIGSEGV, "SIGSEGV"}, {SIGPIPE, "SIGPIPE"},
-		{SIGALRM, "SIGALRM"}, {SIGTERM, "SIGTERM"},
+		{SIGILL, "SIGILL"}, {SIGABRT, "SIGABRT"},
+		{SIGFPE, "SIGFPE"}, {SIGSEGV, "SIGSEGV"},
+		{SIGPIPE, "SIGPIPE"}, {SIGALRM, "SIGALRM"},
 		{SIGBUS, "SIGBUS"}, {SIGSYS, "SIGSYS"},
 		{SIGVTALRM, "SIGVTALRM"}, {SIGXCPU, "SIGXCPU"},
 		{SIGXFSZ, "SIGXFSZ"},
@@ -175,9 +226,6 @@ static void reg_handlers(void)
 		sa[i].sa_handler = &sig_handler;
 		sigemptyset(&sa[i].sa_mask);
 		sa[i].sa_flags = SA_RESETHAND|SA_RESTART;
-		/* don't reset SIGINT handler */
-		if (sigs[i].sig == SIGINT)
-			sa[i].sa_flags &= ~SA_RESETHAND;
 		if (sigaction(sigs[i].sig, &sa[i], NULL) == -1)
 			ERR("%s %s", sigs[i].sig_name, "sigaction()");
 	}
@@ -185,26 +233,6 @@ static void reg_handlers(void)
 		WARN("at_quick_exit(&free_bufs)");
 }
 
-/* reset readline after signal */
-static inline void reset_readline(void)
-{
-	int rl_flags = 0;
-
-	/* setup readline */
-	rl_flags |= RL_STATE_ISEARCH;
-	rl_flags |= RL_STATE_NSEARCH;
-	rl_flags |= RL_STATE_VIMOTION;
-	rl_flags |= RL_STATE_NUMERICARG;
-	rl_flags |= RL_STATE_MULTIKEY;
-	rl_clear_visible_line();
-	rl_reset_line_state();
-	rl_free_line_state();
-	rl_cleanup_after_signal();
-	RL_UNSETSTATE(rl_flags);
-	rl_line_buffer[rl_point = rl_end = rl_mark = 0] = 0;
-	rl_initialize();
-}
-
 static inline void parse_function(struct program *prog)
 {
 	char *saved, *tmp_buf;
@@ -347,10 +375,24 @@ static inline void build_hist_name(struct program *prog)
 		read_history(prog->hist_file);
 }
 
+/* check if the command starting at `line` (including the ';') is `name` */
+static inline bool is_cmd(char const *line, char const *name)
+{
+	size_t len = strcspn(line + 1, " \t");
+	return len == strlen(name) && !strncmp(line + 1, name, len);
+}
+
+/* skip past a command name and the whitespace following it */
+static inline char *cmd_arg(char *line)
+{
+	line += strcspn(line, " \t");
+	return line + strspn(line, " \t");
+}
+
 static inline void show_man(const char *query)
 {
-	int ret;
 	char *split;
+	pid_t pid;
 	struct str_list man_args;
 	init_str_list(&man_args, "man");
 	/* skip ;m[an] */
@@ -362,15 +404,57 @@ static inline void show_man(const char *query)
 		append_str(&man_args, arg, 0);
 	free(split);
 	/* show man <query> */
-	switch (fork()) {
+	switch ((pid = fork())) {
 	case -1:
 		ERR("show_man() fork()");
 	case 0:
+		reset_handlers();
 		execvp("man", man_args.list);
 		ERR("show_man() execvp()");
 	default:
-		wait(&ret);
+		wait_status(pid, "man", false);
+	}
+}
+
+/* finalize, print, compile, and execute the current program */
+static inline void run_program(struct program *prog, char **argv)
+{
+	int ret;
+	/* set to true before compiling */
+	prog->state_flags |= EXEC_FLAG;
+	/* finalize source */
+	trace_begin("build_final", "repl", NULL);
+	build_final(prog, argv);
+	trace_end();
+	/* print generated source code unless stdin is a pipe */
+	if (isatty(STDIN_FILENO) && !(prog->state_flags & EVAL_FLAG)) {
+		fprintf(stdout, "%s:\n", argv[0]);
+		fprintf(stdout, "==========\n");
+		fprintf(stdout, "%s\n", prog->src[0].total.buf);
+		fprintf(stdout, "==========\n");
+	}
+	/* answer constant expressions without invoking the compiler */
+	trace_begin("fold", "repl", NULL);
+	/* folded programs have no assembly */
+	bool folded = !asm_capture() && fold_program(prog, &ret);
+	trace_end();
+	if (folded)
+		trace_instant("constant folded", "repl");
+	else
+		ret = compile(prog->src[1].total.buf, prog->cc_list.list, true);
+	/* ^C drops the line, ^Z drops it too and leaves the program running as a job */
+	if (jobs_cancelled() || jobs_stopped()) {
+		if (jobs_cancelled())
+			fputc('\n', stdout);
+		undo_last_line(prog);
+		return;
 	}
+	/* print output and exit code if non-zero */
+	if (ret || (isatty(STDIN_FILENO) && !(prog->state_flags & EVAL_FLAG)))
+		fprintf(stdout, "[exit status: %d]\n", ret);
+	/* resource usage of the compiler and program */
+	print_stats(folded);
+	asm_report(prog);
 }
 
 int main(int argc, char **argv)
@@ -380,10 +464,12 @@ int main(int argc, char **argv)
 	 * is truncated for interactive printing)
 	 */
 	static struct program program_state;
-	char const *const optstring = "hpvwa:c:e:o:l:s:I:L:";
+	char const *const optstring = "hMpTvwa:b:c:e:o:l:s:t:I:L:P:";
 
 	/* set global pointer for signal handler */
 	prog_ptr = &program_state;
+	/* read job control signals from a signalfd */
+	jobs_init();
 
 	/* set default state flags */
 	program_state.state_flags = PARSE_FLAG;
@@ -408,17 +494,8 @@ int main(int argc, char **argv)
 	if (isatty(STDIN_FILENO) && !(program_state.state_flags & EVAL_FLAG))
 		fprintf(stdout, "%s\n", VERSION_STRING);
 	reg_handlers();
-	rl_set_signals();
-
-	/*
-	 * the siglongjmp() here is needed in order to handle using
-	 * ^C to both clear the current command-line and to abort
-	 * running code early
-	 */
-	if (sigsetjmp(jmp_env, 1)) {
-		reset_readline();
-		fputc('\n', stdout);
-	}
+	/* ^C and ^Z are read from a signalfd instead of interrupting readline */
+	rl_catch_signals = 0;
 
 	/* loop readline() until EOF is read */
 	while (read_line(&program_state)) {
@@ -426,11 +503,13 @@ int main(int argc, char **argv)
 		char *stripped = program_state.cur_line;
 		if (!*program_state.cur_line)
 			continue;
+		trace_begin("line", "repl", program_state.cur_line);
 		/* set io streams to non-buffering */
 		tty_break(&program_state);
 		/* re-enable completion if disabled */
 		rl_bind_key('\t', &rl_complete);
 		dedup_history_add(&program_state.cur_line);
+		jobs_line(program_state.cur_line);
 		/* re-allocate enough memory for line + '\t' + ';' + '\n' + '\0' */
 		for (size_t i = 0; i < 2; i++) {
 			/* keep line length to a minimum */
@@ -439,16 +518,139 @@ int main(int argc, char **argv)
 		}
 		stripped = program_state.cur_line;
 		stripped += strspn(stripped, " \t");
+		/* commands which run the program themselves skip the normal run */
+		bool skip_run = false;
+		trace_begin("parse", "repl", NULL);
 
 		/* control sequence and preprocessor directive parsing */
 		switch (stripped[0]) {
 		case ';':
 			switch(stripped[1]) {
-			/* show documentation about argument */
+			/* annotated assembly of the next build */
+			case 'a':
+				if (is_cmd(stripped, "asm"))
+					skip_run = !set_asm(&program_state, cmd_arg(stripped));
+				break;
+
+			/* background jobs, benchmark a statement or list, select, or compare compile backends */
+			case 'b':
+				if (is_cmd(stripped, "bg")) {
+					build_final(&program_state, argv);
+					bg_cmd(&program_state, cmd_arg(stripped));
+					skip_run = true;
+					break;
+				}
+				if (is_cmd(stripped, "bench")) {
+					bench_cmd(&program_state, cmd_arg(stripped));
+					skip_run = true;
+					break;
+				}
+				if (!is_cmd(stripped, "backend"))
+					break;
+				if (!*cmd_arg(stripped)) {
+					list_backends();
+					skip_run = true;
+				} else if (!strcmp(cmd_arg(stripped), "compare")) {
+					build_final(&program_state, argv);
+					compare_backends(program_state.src[1].total.buf, program_state.cc_list.list);
+					skip_run = true;
+				} else {
+					set_backend(cmd_arg(stripped));
+				}
+				break;
+
+			/* hardware counters, profile-guided optimization, sampling, or build profiles */
+			case 'p':
+				if (is_cmd(stripped, "pgo")) {
+					build_final(&program_state, argv);
+					pgo_cmd(&program_state);
+					skip_run = true;
+					break;
+				}
+				if (is_cmd(stripped, "perf")) {
+					set_perf(cmd_arg(stripped));
+					skip_run = true;
+					break;
+				}
+				if (is_cmd(stripped, "profile-run")) {
+					build_final(&program_state, argv);
+					profile_run(&program_state);
+					skip_run = true;
+					break;
+				}
+				if (!is_cmd(stripped, "profile"))
+					break;
+				if (!*cmd_arg(stripped)) {
+					list_profiles();
+					skip_run = true;
+				} else {
+					set_profile(&program_state, cmd_arg(stripped));
+				}
+				break;
+
+			/* benchmark two statements against each other, simulate caches, or time the compiler */
+			case 'c':
+				if (is_cmd(stripped, "cachesim")) {
+					build_final(&program_state, argv);
+					cachesim_run(&program_state);
+					skip_run = true;
+					break;
+				}
+				if (is_cmd(stripped, "ctime")) {
+					build_final(&program_state, argv);
+					ctime_cmd(&program_state);
+					skip_run = true;
+					break;
+				}
+				if (!is_cmd(stripped, "compare"))
+					break;
+				compare_cmd(&program_state, cmd_arg(stripped));
+				skip_run = true;
+				break;
+
+			/* load, generate, list, or drop session datasets */
+			case 'd':
+				if (!is_cmd(stripped, "data"))
+					break;
+				data_cmd(&program_state, cmd_arg(stripped));
+				skip_run = true;
+				break;
+
+			/* struct layout */
+			case 'l':
+				if (!is_cmd(stripped, "layout"))
+					break;
+				build_final(&program_state, argv);
+				layout_cmd(&program_state, cmd_arg(stripped));
+				skip_run = true;
+				break;
+
+			/* compiler and flag matrix, throughput analysis, or show documentation about argument */
 			case 'm':
+				if (is_cmd(stripped, "mca")) {
+					build_final(&program_state, argv);
+					mca_cmd(&program_state, cmd_arg(stripped));
+					skip_run = true;
+					break;
+				}
+				if (is_cmd(stripped, "matrix")) {
+					build_final(&program_state, argv);
+					matrix_cmd(&program_state, cmd_arg(stripped));
+					skip_run = true;
+					break;
+				}
 				show_man(stripped);
 				break;
 
+			/* optimization remarks */
+			case 'v':
+				if (!is_cmd(stripped, "vec"))
+					break;
+				build_final(&program_state, argv);
+				vec_cmd(&program_state);
+				skip_run = true;
+				break;
+
 			/* pop last history statement */
 			case 'u':
 				undo_last_line(&program_state);
@@ -461,16 +663,62 @@ int main(int argc, char **argv)
 				init_buffers(&program_state);
 				break;
 
-			/* define an include/macro/function */
+			/* foreground a job or define an include/macro/function */
 			case 'f':
+				if (is_cmd(stripped, "fg")) {
+					fg_cmd(cmd_arg(stripped));
+					skip_run = true;
+					break;
+				}
 				parse_function(&program_state);
 				break;
 
+			/* list background jobs */
+			case 'j':
+				if (!is_cmd(stripped, "jobs"))
+					break;
+				jobs_cmd();
+				skip_run = true;
+				break;
+
+			/* terminate a background job */
+			case 'k':
+				if (!is_cmd(stripped, "kill"))
+					break;
+				kill_cmd(cmd_arg(stripped));
+				skip_run = true;
+				break;
+
 			/* show usage information */
 			case 'h':
 				fprintf(stdout, "%s %s %s\n", "Usage:", argv[0], USAGE_STRING);
 				break;
 
+			/* thread scaling, binary size, system call tracing, or resource usage status line */
+			case 's':
+				if (is_cmd(stripped, "scale")) {
+					build_final(&program_state, argv);
+					scale_cmd(&program_state, cmd_arg(stripped));
+					skip_run = true;
+					break;
+				}
+				if (is_cmd(stripped, "size")) {
+					build_final(&program_state, argv);
+					size_cmd(&program_state);
+					skip_run = true;
+					break;
+				}
+				if (is_cmd(stripped, "syscalls")) {
+					set_syscalls(cmd_arg(stripped));
+					skip_run = true;
+					break;
+				}
+				if (!is_cmd(stripped, "stats"))
+					break;
+				set_stats(*cmd_arg(stripped) ? cmd_arg(stripped) : "brief");
+				skip_run = true;
+				break;
+
 			/* clean up and exit program */
 			case 'q':
 				free_buffers(&program_state);
@@ -502,24 +750,14 @@ int main(int argc, char **argv)
 			parse_normal(&program_state);
 		}
 
-		/* set to true before compiling */
-		program_state.state_flags |= EXEC_FLAG;
-		/* finalize source */
-		build_final(&program_state, argv);
-		/* print generated source code unless stdin is a pipe */
-		if (isatty(STDIN_FILENO) && !(program_state.state_flags & EVAL_FLAG)) {
-			fprintf(stdout, "%s:\n", argv[0]);
-			fprintf(stdout, "==========\n");
-			fprintf(stdout, "%s\n", program_state.src[0].total.buf);
-			fprintf(stdout, "==========\n");
-		}
-		int ret = compile(program_state.src[1].total.buf, program_state.cc_list.list, true);
-		/* print output and exit code if non-zero */
-		if (ret || (isatty(STDIN_FILENO) && !(program_state.state_flags & EVAL_FLAG)))
-			fprintf(stdout, "[exit status: %d]\n", ret);
+		trace_end();
+		if (!skip_run)
+			run_program(&program_state, argv);
 
 		/* reset io stream buffering modes */
 		tty_fix(&program_state);
+		trace_end();
+		trace_memory();
 
 		/* exit if executed with `-e` argument */
 		if (program_state.state_flags & EVAL_FLAG) {
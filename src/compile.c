@@ -9,22 +9,217 @@
 #undef _GNU_SOURCE
 #define _GNU_SOURCE
 
+#include "asmview.h"
 #include "compile.h"
+#include "jit.h"
+#include "jobs.h"
 #include "parseopts.h"
+#include "perf.h"
+#include "syscalls.h"
+#include "trace.h"
+#include <time.h>
 
 extern char **environ;
 
-int compile(char const *src, char *const cc_args[], bool show_errors)
+static bool cc_usable(void);
+static bool cc_run(char const *src, char *const cc_args[], bool show_errors, int *status);
+
+/* available backends (the first entry is the exact default) */
+static struct backend backend_list[] = {
+	{"cc", "fork and exec the configured compiler", &cc_usable, &cc_run},
+	{"tcc", "in-process libtcc JIT (C only)", &jit_usable, &jit_run},
+};
+static struct backend *cur_backend = backend_list, *last_backend = backend_list;
+/* resource usage of the last compile and run */
+static struct phase_usage phase_list[PHASE_CNT];
+static enum stats_mode stats_mode = STATS_OFF;
+static char const *const stats_list[] = {"off", "brief", "full"};
+static char const *const phase_names[] = {"compiler", "program"};
+
+/* milliseconds since `start` on the monotonic clock */
+double elapsed_ms(struct timespec const *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* `qsort()` comparison for ascending doubles */
+int cmp_double(void const *a, void const *b)
+{
+	double x = *(double const *)a, y = *(double const *)b;
+	return (x > y) - (x < y);
+}
+
+/* store the resource usage of a phase */
+void record_phase(enum phase phase, struct timespec const *start, struct rusage const *ru)
+{
+	if (phase >= PHASE_CNT)
+		return;
+	phase_list[phase].valid = true;
+	phase_list[phase].wall_ms = elapsed_ms(start);
+	phase_list[phase].ru = *ru;
+}
+
+/* reap a child, recording its resource usage for `phase` (started at `start`) */
+int wait_phase(pid_t pid, char const *name, bool show_errors, enum phase phase, struct timespec const *start)
+{
+	int status, ret;
+	struct rusage ru;
+	/* program runs stopped with ^Z carry on as background jobs */
+	if ((ret = jobs_wait(pid, &status, &ru, phase == PHASE_RUN)))
+		return (ret == 1) ? 0 : -1;
+	if (start) {
+		record_phase(phase, start, &ru);
+		trace_child(name, pid, start);
+	}
+	/* convert 255 to -1 since WEXITSTATUS() only returns the low-order 8 bits */
+	if (WIFEXITED(status) && WEXITSTATUS(status)) {
+		if (show_errors)
+			WARNX("%s returned non-zero exit code", name);
+		return (WEXITSTATUS(status) != 0xff) ? WEXITSTATUS(status) : -1;
+	}
+	return 0;
+}
+
+/* reap a child and convert its exit status */
+int wait_status(pid_t pid, char const *name, bool show_errors)
+{
+	return wait_phase(pid, name, show_errors, PHASE_CNT, NULL);
+}
+
+/* set the status line mode */
+bool set_stats(char const *mode)
+{
+	for (size_t i = 0; i < arr_len(stats_list); i++) {
+		if (!strcmp(mode, stats_list[i])) {
+			stats_mode = i;
+			return true;
+		}
+	}
+	WARNX("unknown stats mode \"%s\"", mode);
+	return false;
+}
+
+static inline double tv_ms(struct timeval const *tv)
+{
+	return tv->tv_sec * 1e3 + tv->tv_usec / 1e3;
+}
+
+/* print resource usage of the last compile and run */
+void print_stats(bool folded)
+{
+	if (stats_mode == STATS_OFF)
+		return;
+	if (folded) {
+		fprintf(stdout, "%s\n", "[constant folded: compiler and program skipped]");
+		return;
+	}
+	if (stats_mode == STATS_BRIEF) {
+		fputc('[', stdout);
+		for (size_t i = 0; i < PHASE_CNT; i++) {
+			struct phase_usage const *cur = phase_list + i;
+			if (!cur->valid)
+				continue;
+			fprintf(stdout, "%s%s: %.1fms cpu %.1fms rss %.1fMB", i ? " | " : "", phase_names[i], cur->wall_ms,
+					tv_ms(&cur->ru.ru_utime) + tv_ms(&cur->ru.ru_stime), cur->ru.ru_maxrss / 1024.0);
+		}
+		fputs("]\n", stdout);
+		return;
+	}
+	for (size_t i = 0; i < PHASE_CNT; i++) {
+		struct phase_usage const *cur = phase_list + i;
+		if (!cur->valid)
+			continue;
+		fprintf(stdout, "[%s: wall %.2fms, user %.2fms, sys %.2fms, max rss %.1fMB, "
+				"faults %ld minor/%ld major, context switches %ld voluntary/%ld involuntary]\n",
+				phase_names[i], cur->wall_ms, tv_ms(&cur->ru.ru_utime), tv_ms(&cur->ru.ru_stime),
+				cur->ru.ru_maxrss / 1024.0, cur->ru.ru_minflt, cur->ru.ru_majflt,
+				cur->ru.ru_nvcsw, cur->ru.ru_nivcsw);
+	}
+}
+
+/* resource usage of the last run of `phase` */
+struct phase_usage const *get_phase(enum phase phase)
+{
+	return (phase < PHASE_CNT && phase_list[phase].valid) ? phase_list + phase : NULL;
+}
+
+/* read `fd` until end of file into `*output` */
+static void read_output(int fd, char **output)
+{
+	size_t len = 0, max = PAGE_SIZE;
+	ssize_t ret;
+	xcalloc(output, 1, max, "read_output()");
+	while ((ret = read(fd, *output + len, max - len - 1)) != 0) {
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if ((len += ret) + 1 >= max) {
+			xrealloc(output, max *= 2, "read_output()");
+		}
+	}
+	(*output)[len] = '\0';
+}
+
+/* run a command to completion, optionally capturing its standard output */
+int run_cmd(char *const args[], char **output, bool show_errors)
+{
+	int null_fd, pipe_out[2];
+	pid_t pid;
+	struct timespec start;
+
+	if ((null_fd = open("/dev/null", O_RDWR)) == -1)
+		ERR("open()");
+	if (pipe2(pipe_out, O_CLOEXEC) == -1)
+		ERR("error making pipe_out pipe");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch ((pid = fork())) {
+	/* error */
+	case -1:
+		ERR("error forking %s", args[0]);
+		break;
+
+	/* child */
+	case 0:
+		reset_handlers();
+		dup2(null_fd, STDIN_FILENO);
+		dup2(output ? pipe_out[1] : null_fd, STDOUT_FILENO);
+		if (!show_errors)
+			dup2(null_fd, STDERR_FILENO);
+		execvp(args[0], args);
+		/* execvp() should never return */
+		_exit(0xff);
+		break;
+
+	/* parent */
+	default:
+		close(null_fd);
+		close(pipe_out[1]);
+		if (output)
+			read_output(pipe_out[0], output);
+		close(pipe_out[0]);
+	}
+
+	return wait_phase(pid, args[0], show_errors, PHASE_CNT, &start);
+}
+
+static bool cc_usable(void)
+{
+	return true;
+}
+
+/* pipe `src` into the compiler and return its exit status, optionally capturing all of its output */
+static int run_compiler(char const *src, char *const cc_args[], bool show_errors, char **output)
 {
 	int null_fd, status;
-	int pipe_cc[2];
+	int pipe_cc[2], pipe_out[2] = {-1, -1};
+	pid_t pid;
 	size_t len = strlen(src);
-	char *exec_args[] = {"/tmp/cepl_program", NULL};
-
-	if (!src || !cc_args)
-		ERRX("NULL pointer passed to compile()");
-	if (!len)
-		return 0;
+	struct timespec start;
 
 	/* bit bucket */
 	if ((null_fd = open("/dev/null", O_WRONLY, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) == -1)
@@ -33,9 +228,12 @@ int compile(char const *src, char *const cc_args[], bool show_errors)
 	/* create pipe */
 	if (pipe2(pipe_cc, O_CLOEXEC) == -1)
 		ERR("error making pipe_cc pipe");
+	if (output && pipe2(pipe_out, O_CLOEXEC) == -1)
+		ERR("error making pipe_out pipe");
 
 	/* fork compiler */
-	switch (fork()) {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch ((pid = fork())) {
 	/* error */
 	case -1:
 		close(pipe_cc[0]);
@@ -45,8 +243,13 @@ int compile(char const *src, char *const cc_args[], bool show_errors)
 
 	/* child */
 	case 0:
+		reset_handlers();
 		if (!show_errors)
 			dup2(null_fd, STDERR_FILENO);
+		if (output) {
+			dup2(pipe_out[1], STDOUT_FILENO);
+			dup2(pipe_out[1], STDERR_FILENO);
+		}
 		dup2(pipe_cc[0], STDIN_FILENO);
 		execvp(cc_args[0], cc_args);
 		/* execvp() should never return */
@@ -55,21 +258,114 @@ int compile(char const *src, char *const cc_args[], bool show_errors)
 
 	/* parent */
 	default:
+		close(null_fd);
 		close(pipe_cc[0]);
 		if (write(pipe_cc[1], src, len) == -1)
 			ERR("error writing to pipe_cc[1]");
 		close(pipe_cc[1]);
-		wait(&status);
-		/* convert 255 to -1 since WEXITSTATUS() only returns the low-order 8 bits */
-		if (WIFEXITED(status) && WEXITSTATUS(status)) {
-			if (show_errors)
-				WARNX("compiler returned non-zero exit code");
-			return (WEXITSTATUS(status) != 0xff) ? WEXITSTATUS(status) : -1;
+		/* the compiler reads all of its input before writing reports */
+		if (output) {
+			close(pipe_out[1]);
+			read_output(pipe_out[0], output);
+			close(pipe_out[0]);
 		}
+		status = wait_phase(pid, "compiler", show_errors, PHASE_CC, &start);
+	}
+
+	return status;
+}
+
+/* compile `src` into `out` with additional flags, without running it */
+static int build_with(char const *src, char *const cc_args[], char const *out, char *const extra[], bool show_errors, char **output)
+{
+	struct str_list args;
+	int status;
+
+	init_str_list(&args, cc_args[0]);
+	for (size_t i = 1; cc_args[i]; i++) {
+		/* swap the output file */
+		if (!strncmp(cc_args[i], "-o", 2)) {
+			append_str(&args, out, 2);
+			memcpy(args.list[args.cnt - 1], "-o", 2);
+			continue;
+		}
+		append_str(&args, cc_args[i], 0);
+	}
+	for (size_t i = 0; extra && extra[i]; i++)
+		append_str(&args, extra[i], 0);
+	append_str(&args, NULL, 0);
+	status = run_compiler(src, args.list, show_errors, output);
+	free_str_list(&args);
+	return status;
+}
+
+/* compile `src` into the executable `out` with additional flags, without running it */
+int build_program(char const *src, char *const cc_args[], char const *out, char *const extra[], bool show_errors)
+{
+	return build_with(src, cc_args, out, extra, show_errors, NULL);
+}
+
+/* like build_program(), returning everything the compiler printed in `*output` */
+int build_capture(char const *src, char *const cc_args[], char const *out, char *const extra[], char **output)
+{
+	return build_with(src, cc_args, out, extra, true, output);
+}
+
+/* `cc_args` without the linker inputs, for builds which stop before linking (`-S`, `-c`) */
+void compile_only_args(char *const cc_args[], struct str_list *args)
+{
+	init_str_list(args, cc_args[0]);
+	for (size_t i = 1; cc_args[i]; i++) {
+		/* cached objects and libraries follow `-xnone` */
+		if (!strcmp(cc_args[i], "-xnone")) {
+			if (cc_args[i + 1])
+				i++;
+			continue;
+		}
+		if (!strncmp(cc_args[i], "-l", 2) || !strncmp(cc_args[i], "-L", 2) || !strncmp(cc_args[i], "-Wl,", 4))
+			continue;
+		append_str(args, cc_args[i], 0);
+	}
+	append_str(args, NULL, 0);
+}
+
+/* the last `-O` flag in `cc_args` */
+char const *opt_level(char *const cc_args[])
+{
+	char const *opt = "-O0";
+	for (size_t i = 1; cc_args[i]; i++) {
+		if (!strncmp(cc_args[i], "-O", 2))
+			opt = cc_args[i];
 	}
+	return opt;
+}
+
+static bool cc_run(char const *src, char *const cc_args[], bool show_errors, int *status)
+{
+	pid_t pid;
+	char *exec_args[] = {"/tmp/cepl_program", NULL};
+	struct timespec start;
+	struct perf_counters ctr;
+	struct syscall_counts sc;
+	int sync_fd[2];
+
+	if (asm_capture()) {
+		/* the assembly comes from the same compilation as the executable */
+		struct str_list args;
+		asm_args(cc_args, &args);
+		*status = run_compiler(src, args.list, show_errors, NULL);
+		free_str_list(&args);
+		asm_collect("/tmp/cepl_program", !*status);
+	} else {
+		*status = run_compiler(src, cc_args, show_errors, NULL);
+	}
+	if (*status)
+		return true;
 
 	/* fork executable */
-	switch (fork()) {
+	perf_sync_init(sync_fd);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch ((pid = fork())) {
 	/* error */
 	case -1:
 		ERR("error forking executable");
@@ -77,7 +373,10 @@ int compile(char const *src, char *const cc_args[], bool show_errors)
 
 	/* child */
 	case 0:
+		jobs_child(true);
 		reset_handlers();
+		perf_sync_child(sync_fd);
+		syscalls_child();
 		execve("/tmp/cepl_program", exec_args, environ);
 		/* execve() should never return */
 		ERR("error forking executable");
@@ -85,18 +384,99 @@ int compile(char const *src, char *const cc_args[], bool show_errors)
 
 	/* parent */
 	default:
-		close(null_fd);
-		wait(&status);
+		jobs_spawned(pid, true);
+		perf_sync_parent(&ctr, sync_fd, pid, true);
+		syscalls_trace(&sc, pid);
+		*status = wait_phase(pid, "executable", show_errors, PHASE_RUN, &start);
+		perf_report(&ctr);
+		syscalls_report(&sc);
 		if (unlink("/tmp/cepl_program") == -1)
 			WARN("unable to remove /tmp/cepl_program");
-		/* convert 255 to -1 since WEXITSTATUS() only returns the low-order 8 bits */
-		if (WIFEXITED(status) && WEXITSTATUS(status)) {
-			if (show_errors)
-				WARNX("executable returned non-zero exit code");
-			return (WEXITSTATUS(status) != 0xff) ? WEXITSTATUS(status) : -1;
+	}
+
+	return true;
+}
+
+/* select a backend by name (`NULL` selects the default) */
+bool set_backend(char const *name)
+{
+	if (!name) {
+		cur_backend = backend_list;
+		return true;
+	}
+	for (size_t i = 0; i < arr_len(backend_list); i++) {
+		if (strcmp(name, backend_list[i].name))
+			continue;
+		if (!backend_list[i].usable()) {
+			WARNX("backend \"%s\" is unavailable", name);
+			return false;
 		}
+		cur_backend = backend_list + i;
+		return true;
 	}
+	WARNX("unknown backend \"%s\"", name);
+	return false;
+}
 
-	/* program returned success */
-	return 0;
+/* print available backends and their observed latencies */
+void list_backends(void)
+{
+	for (size_t i = 0; i < arr_len(backend_list); i++) {
+		struct backend const *cur = backend_list + i;
+		fprintf(stdout, "%c %-6s %-40s", (cur == cur_backend) ? '*' : ' ', cur->name, cur->desc);
+		if (!cur->usable())
+			fprintf(stdout, " [unavailable]\n");
+		else if (!cur->runs)
+			fprintf(stdout, " [no runs]\n");
+		else
+			fprintf(stdout, " [runs: %zu, last: %.2fms, mean: %.2fms]\n",
+					cur->runs, cur->last_ms, cur->total_ms / cur->runs);
+	}
+}
+
+/* run the program once with every usable backend */
+void compare_backends(char const *src, char *const cc_args[])
+{
+	struct backend *saved = cur_backend;
+	for (size_t i = 0; i < arr_len(backend_list); i++) {
+		int status;
+		if (!backend_list[i].usable())
+			continue;
+		cur_backend = backend_list + i;
+		fprintf(stdout, "[backend: %s]\n", cur_backend->name);
+		fflush(stdout);
+		status = compile(src, cc_args, true);
+		fprintf(stdout, "[backend: %s, exit status: %d, latency: %.2fms]\n",
+				last_backend->name, status, last_backend->last_ms);
+	}
+	cur_backend = saved;
+}
+
+int compile(char const *src, char *const cc_args[], bool show_errors)
+{
+	int status = 0;
+	struct timespec start;
+
+	if (!src || !cc_args)
+		ERRX("NULL pointer passed to compile()");
+	if (!strlen(src))
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < PHASE_CNT; i++)
+		phase_list[i].valid = false;
+	/* only the compiler leaves assembly behind */
+	last_backend = asm_capture() ? backend_list : cur_backend;
+	trace_begin("compile", "build", cur_backend->name);
+	/* fall back to the exact backend if the selected one can't handle the program */
+	if (!last_backend->run(src, cc_args, show_errors, &status)) {
+		last_backend = backend_list;
+		last_backend->run(src, cc_args, show_errors, &status);
+	}
+	trace_end();
+	last_backend->last_ms = elapsed_ms(&start);
+	last_backend->total_ms += last_backend->last_ms;
+	last_backend->runs++;
+
+	return status;
 }
@@ -10,8 +10,56 @@
 
 #include "defs.h"
 #include "errs.h"
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+/* phases with recorded resource usage */
+enum phase {
+	PHASE_CC, PHASE_RUN, PHASE_CNT,
+};
+
+/* status line verbosity */
+enum stats_mode {
+	STATS_OFF, STATS_BRIEF, STATS_FULL,
+};
+
+/* struct definition for per-phase resource usage */
+struct phase_usage {
+	bool valid;
+	double wall_ms;
+	struct rusage ru;
+};
+
+/* struct definition for compile and run backends */
+struct backend {
+	char const *name, *desc;
+	/* false if the backend can't be loaded */
+	bool (*usable)(void);
+	/* false if the program must be handed to the exact backend instead */
+	bool (*run)(char const *src, char *const cc_args[], bool show_errors, int *status);
+	/* latency statistics */
+	size_t runs;
+	double last_ms, total_ms;
+};
 
 /* prototypes */
+double elapsed_ms(struct timespec const *start);
+int cmp_double(void const *a, void const *b);
+int wait_status(pid_t pid, char const *name, bool show_errors);
+int wait_phase(pid_t pid, char const *name, bool show_errors, enum phase phase, struct timespec const *start);
+void record_phase(enum phase phase, struct timespec const *start, struct rusage const *ru);
+bool set_stats(char const *mode);
+void print_stats(bool folded);
+struct phase_usage const *get_phase(enum phase phase);
+int run_cmd(char *const args[], char **output, bool show_errors);
+int build_program(char const *src, char *const cc_args[], char const *out, char *const extra[], bool show_errors);
+int build_capture(char const *src, char *const cc_args[], char const *out, char *const extra[], char **output);
+void compile_only_args(char *const cc_args[], struct str_list *args);
+char const *opt_level(char *const cc_args[]);
+bool set_backend(char const *name);
+void list_backends(void);
+void compare_backends(char const *src, char *const cc_args[]);
 int compile(char const *src, char *const cc_args[], bool show_errors);
 
 #endif /* !defined(COMPILE_H) */
@@ -0,0 +1,232 @@
+/*
+ * ctime.c - compile time breakdown
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "ctime.h"
+
+#define CTIME_OUT	"/tmp/cepl_ctime"
+
+extern char const *prologue;
+
+static void add_cost(struct ctime_list *costs, char const *name, size_t len, double ms, size_t files)
+{
+	if (costs->cnt == costs->max)
+		xrealloc(&costs->list, sizeof *costs->list * (costs->max = costs->max ? costs->max * 2 : 32), "add_cost()");
+	xcalloc(&costs->list[costs->cnt].name, 1, len + 1, "add_cost()");
+	memcpy(costs->list[costs->cnt].name, name, len);
+	costs->list[costs->cnt].ms = ms;
+	costs->list[costs->cnt].files = files;
+	costs->cnt++;
+}
+
+static void free_costs(struct ctime_list *costs)
+{
+	for (size_t i = 0; i < costs->cnt; i++)
+		free(costs->list[i].name);
+	free(costs->list);
+	costs->list = NULL;
+	costs->cnt = costs->max = 0;
+}
+
+static int cmp_cost(void const *a, void const *b)
+{
+	double x = ((struct ctime_cost const *)a)->ms, y = ((struct ctime_cost const *)b)->ms;
+	return (x < y) - (x > y);
+}
+
+/* trim surrounding whitespace, returning the length */
+static size_t trim(char const **str, size_t len)
+{
+	while (len && isspace((unsigned char)**str))
+		(*str)++, len--;
+	while (len && isspace((unsigned char)(*str)[len - 1]))
+		len--;
+	return len;
+}
+
+/*
+ * parse `-ftime-report` output; gcc prints `name : usr (%) sys (%) wall (%) mem (%)`
+ * and clang prints `usr (%) sys (%) usr+sys (%) wall (%) name`, so wall is the last time either way
+ */
+static void parse_report(char *report, struct ctime_list *passes, struct ctime_list *phases, double *total)
+{
+	char *saved;
+	for (char *line = strtok_r(report, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+		char const *name = line, *cur;
+		char *end;
+		size_t len;
+		double val, wall = -1;
+
+		if ((cur = strstr(line, " : "))) {
+			/* gcc */
+			double usr, sys;
+			/* the total has no percentages */
+			if (sscanf(cur + 3, "%lf (%*[^)]) %lf (%*[^)]) %lf", &usr, &sys, &wall) != 3
+					&& sscanf(cur + 3, "%lf %lf %lf", &usr, &sys, &wall) != 3)
+				continue;
+			len = trim(&name, cur - line);
+			wall *= 1e3;
+		} else {
+			/* clang */
+			double last = -1;
+			for (cur = line; (val = strtod(cur, &end)), end != cur;) {
+				last = val;
+				/* skip the percentage after each time */
+				cur = end + strspn(end, " ");
+				if (*cur != '(' || !(cur = strchr(cur, ')')))
+					break;
+				cur++;
+			}
+			if (last < 0 || !strstr(line, "%)"))
+				continue;
+			name = strrchr(line, ')') + 1;
+			len = trim(&name, strlen(name));
+			wall = last * 1e3;
+		}
+		if (!len)
+			continue;
+		if (!strncmp(name, "TOTAL", 5) || !strncmp(name, "Total", 5)) {
+			if (wall > *total)
+				*total = wall;
+			continue;
+		}
+		if (!strncmp(name, "phase ", 6))
+			add_cost(phases, name + 6, len - 6, wall, 0);
+		else if (wall > 0)
+			add_cost(passes, name, len, wall, 0);
+	}
+}
+
+/* compile `src` alone for syntax, returning its cpu time in milliseconds (negative on error) */
+static double header_time(struct program *prog, char const *src, size_t *files)
+{
+	char *const extra[] = {"-fsyntax-only", "-H", NULL};
+	char *out = NULL, *saved;
+	struct phase_usage const *usage;
+	int status = build_capture(src, prog->cc_list.list, CTIME_OUT, extra, &out);
+
+	*files = 0;
+	/* `-H` prints one line of dots per opened file */
+	for (char *line = out ? strtok_r(out, "\n", &saved) : NULL; line; line = strtok_r(NULL, "\n", &saved)) {
+		if (line[0] == '.' && strchr(line, ' '))
+			(*files)++;
+	}
+	free(out);
+	if (status || !(usage = get_phase(PHASE_CC)))
+		return -1;
+	return usage->ru.ru_utime.tv_sec * 1e3 + usage->ru.ru_utime.tv_usec / 1e3
+		+ usage->ru.ru_stime.tv_sec * 1e3 + usage->ru.ru_stime.tv_usec / 1e3;
+}
+
+/* time each prologue and user header on its own after the prologue's macros */
+static double time_headers(struct program *prog, struct ctime_list *headers)
+{
+	FILE *out;
+	char *macros, *src;
+	size_t len, files;
+	double base;
+
+	if (!(out = open_memstream(&macros, &len)))
+		ERR("open_memstream()");
+	for (char const *cur = prologue; *cur; cur += strcspn(cur, "\n") + (cur[strcspn(cur, "\n")] == '\n')) {
+		size_t line_len = strcspn(cur, "\n");
+		if (!strncmp(cur, "#define", 7) || !strncmp(cur, "#undef", 6))
+			fprintf(out, "%.*s\n", (int)line_len, cur);
+		else if (!strncmp(cur, "#include", 8))
+			add_cost(headers, cur + 8, line_len - 8, 0, 0);
+	}
+	fclose(out);
+	/* `#include` entries typed by the user */
+	for (size_t i = 1; i < prog->src[1].lines.cnt; i++) {
+		char const *line = prog->src[1].lines.list[i];
+		line += strspn(line, " \t");
+		if (*line++ != '#')
+			continue;
+		line += strspn(line, " \t");
+		if (!strncmp(line, "include", 7))
+			add_cost(headers, line + 7, strlen(line + 7), 0, 0);
+	}
+
+	base = header_time(prog, macros, &files);
+	for (size_t i = 0; i < headers->cnt; i++) {
+		char const *name = headers->list[i].name;
+		size_t name_len = trim(&name, strlen(name));
+		memmove(headers->list[i].name, name, name_len);
+		headers->list[i].name[name_len] = '\0';
+		if (asprintf(&src, "%s#include %s\n", macros, headers->list[i].name) == -1)
+			ERR("asprintf()");
+		headers->list[i].ms = header_time(prog, src, &headers->list[i].files);
+		if (headers->list[i].ms >= 0 && base >= 0)
+			headers->list[i].ms = (headers->list[i].ms > base) ? headers->list[i].ms - base : 0;
+		free(src);
+	}
+	free(macros);
+	return base;
+}
+
+/* `;ctime`: where compile time goes, by compiler pass and by header */
+void ctime_cmd(struct program *prog)
+{
+	char *const extra[] = {"-ftime-report", NULL};
+	struct ctime_list passes = {0}, phases = {0}, headers = {0};
+	struct phase_usage const *usage;
+	char *report = NULL;
+	double total = 0, base;
+
+	if (build_capture(prog->src[1].total.buf, prog->cc_list.list, CTIME_OUT, extra, &report)) {
+		if (report)
+			fputs(report, stderr);
+		free(report);
+		unlink(CTIME_OUT);
+		return;
+	}
+	unlink(CTIME_OUT);
+	if ((usage = get_phase(PHASE_CC)))
+		fprintf(stdout, "[ctime: compiler %.2fms wall]\n", usage->wall_ms);
+	parse_report(report, &passes, &phases, &total);
+	free(report);
+
+	if (phases.cnt) {
+		fputs("phases:", stdout);
+		for (size_t i = 0; i < phases.cnt; i++)
+			fprintf(stdout, "%s %s %.0fms", i ? "," : "", phases.list[i].name, phases.list[i].ms);
+		fputc('\n', stdout);
+	}
+	if (!passes.cnt) {
+		fprintf(stdout, "[ctime: no -ftime-report output from %s]\n", prog->cc_list.list[0]);
+	} else {
+		qsort(passes.list, passes.cnt, sizeof *passes.list, cmp_cost);
+		fputs("passes (-ftime-report wall time):\n", stdout);
+		for (size_t i = 0; i < passes.cnt && i < CTIME_TOP; i++) {
+			fprintf(stdout, "%10.2fms", passes.list[i].ms);
+			if (total > 0)
+				fprintf(stdout, " %5.1f%%", 100 * passes.list[i].ms / total);
+			fprintf(stdout, "  %s\n", passes.list[i].name);
+		}
+	}
+
+	base = time_headers(prog, &headers);
+	qsort(headers.list, headers.cnt, sizeof *headers.list, cmp_cost);
+	fprintf(stdout, "headers (cpu time compiling each alone, %.2fms startup subtracted):\n", base);
+	for (size_t i = 0; i < headers.cnt && i < CTIME_TOP; i++) {
+		if (headers.list[i].ms < 0) {
+			fprintf(stdout, "%12s %6s  %s\n", "error", "", headers.list[i].name);
+			continue;
+		}
+		fprintf(stdout, "%10.2fms %6zu files  %s\n", headers.list[i].ms, headers.list[i].files, headers.list[i].name);
+	}
+	if (headers.cnt > CTIME_TOP)
+		fprintf(stdout, "[%zu more headers]\n", headers.cnt - CTIME_TOP);
+
+	free_costs(&passes);
+	free_costs(&phases);
+	free_costs(&headers);
+}
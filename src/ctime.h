@@ -0,0 +1,34 @@
+/*
+ * ctime.h - compile time breakdown
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(CTIME_H)
+#define CTIME_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* rows shown per table */
+#define CTIME_TOP	12
+
+/* struct definition for one time consumer */
+struct ctime_cost {
+	char *name;
+	double ms;
+	/* files pulled in by a header */
+	size_t files;
+};
+
+/* struct definition for a list of time consumers */
+struct ctime_list {
+	struct ctime_cost *list;
+	size_t cnt, max;
+};
+
+/* prototypes */
+void ctime_cmd(struct program *prog);
+
+#endif /* !defined(CTIME_H) */
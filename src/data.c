@@ -0,0 +1,226 @@
+/*
+ * data.c - session datasets shared with every run
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "data.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define DATA_OUT	"/tmp/cepl_data"
+
+extern char **environ;
+extern char const *prog_start, *prog_end;
+
+/* datasets owned by the session, inherited by every child */
+static struct data_set sets[DATA_MAX];
+static size_t set_cnt;
+
+/* names become part of an environment variable, so keep them to identifiers */
+static bool valid_name(char const *name)
+{
+	if (!*name || strlen(name) >= DATA_NAME || isdigit((unsigned char)*name))
+		return false;
+	for (char const *cur = name; *cur; cur++) {
+		if (!isalnum((unsigned char)*cur) && *cur != '_')
+			return false;
+	}
+	return true;
+}
+
+static struct data_set *find_set(char const *name)
+{
+	for (size_t i = 0; i < set_cnt; i++) {
+		if (!strcmp(sets[i].name, name))
+			return sets + i;
+	}
+	return NULL;
+}
+
+/* `CEPL_DATA_<name>=<fd>:<size>` is read by `cepl_data()` in the prologue */
+static void export_set(struct data_set const *set, bool add)
+{
+	char var[sizeof "CEPL_DATA_" + DATA_NAME], val[64];
+	snprintf(var, sizeof var, "CEPL_DATA_%s", set->name);
+	snprintf(val, sizeof val, "%d:%zu", set->fd, set->size);
+	if (add ? setenv(var, val, 1) : unsetenv(var))
+		WARN("unable to export %s", var);
+}
+
+/* copy a file into the memfd without passing it through userspace */
+static bool load_file(char const *path, int fd)
+{
+	struct stat st;
+	off_t off = 0;
+	int in_fd;
+
+	if ((in_fd = open(path, O_RDONLY|O_CLOEXEC)) == -1) {
+		WARN("unable to open %s", path);
+		return false;
+	}
+	if (fstat(in_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		WARNX("%s is not a regular file", path);
+		close(in_fd);
+		return false;
+	}
+	while (off < st.st_size) {
+		ssize_t ret = sendfile(fd, in_fd, &off, st.st_size - off);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			WARN("unable to read %s", path);
+			close(in_fd);
+			return false;
+		}
+	}
+	close(in_fd);
+	return true;
+}
+
+/* build the `;f` definitions with `stmt` as `main()` and store what it writes to stdout */
+static bool generate(struct program *prog, char const *stmt, int fd)
+{
+	char *const args[] = {DATA_OUT, NULL};
+	char *src;
+	int status;
+	pid_t pid;
+
+	if (asprintf(&src, "%s%s\t%s;\n%s", prog->src[1].funcs.buf, prog_start, stmt, prog_end) == -1)
+		ERR("asprintf()");
+	status = build_program(src, prog->cc_list.list, DATA_OUT, NULL, true);
+	free(src);
+	if (status) {
+		unlink(DATA_OUT);
+		return false;
+	}
+	fflush(stdout);
+
+	switch ((pid = fork())) {
+	/* error */
+	case -1:
+		ERR("error forking generator");
+		break;
+
+	/* child */
+	case 0:
+		reset_handlers();
+		if (dup2(fd, STDOUT_FILENO) == -1)
+			ERR("dup2()");
+		execve(args[0], args, environ);
+		/* execve() should never return */
+		ERR("error forking generator");
+		break;
+
+	/* parent */
+	default:
+		status = wait_status(pid, "generator", false);
+	}
+
+	unlink(DATA_OUT);
+	if (status)
+		WARNX("generator exited with status %d", status);
+	return !status;
+}
+
+static void drop_set(char const *name)
+{
+	struct data_set *set;
+	if (!(set = find_set(name))) {
+		WARNX("no dataset named \"%s\"", name);
+		return;
+	}
+	export_set(set, false);
+	close(set->fd);
+	free(set->source);
+	memmove(set, set + 1, (sets + --set_cnt - set) * sizeof *set);
+}
+
+static void list_sets(void)
+{
+	if (!set_cnt) {
+		fprintf(stdout, "%s\n", "[data: no datasets, e.g. ;data keys /path/to/file or ;data keys = fwrite(buf, 1, n, stdout)]");
+		return;
+	}
+	fprintf(stdout, "%-16s %14s  %s\n", "name", "bytes", "source");
+	for (size_t i = 0; i < set_cnt; i++)
+		fprintf(stdout, "%-16s %14zu  %.100s\n", sets[i].name, sets[i].size, sets[i].source);
+}
+
+/* `;data [-d <name> | <name> <file> | <name> = <statements>]` */
+void data_cmd(struct program *prog, char *args)
+{
+	struct data_set new = {.fd = -1}, *old;
+	struct timespec start;
+	char *name, *src;
+	bool ok;
+
+	if (!*args) {
+		list_sets();
+		return;
+	}
+	name = args;
+	args += strcspn(args, " \t");
+	if (*args)
+		*args++ = '\0';
+	args += strspn(args, " \t");
+	if (!strcmp(name, "-d")) {
+		drop_set(args);
+		return;
+	}
+	if (!valid_name(name) || !*args) {
+		WARNX("%s", "usage: ;data [-d <name> | <name> <file> | <name> = <statements>]");
+		return;
+	}
+	if (!(old = find_set(name)) && set_cnt >= DATA_MAX) {
+		WARNX("only %d datasets can be loaded at once", DATA_MAX);
+		return;
+	}
+
+	/* no close-on-exec, so runs inherit the descriptor */
+	if ((new.fd = memfd_create(name, MFD_ALLOW_SEALING)) == -1) {
+		WARN("memfd_create()");
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (*args == '=') {
+		src = args + 1 + strspn(args + 1, " \t");
+		ok = generate(prog, src, new.fd);
+	} else {
+		src = args;
+		ok = load_file(src, new.fd);
+	}
+	/* runs can map it but never change it */
+	if (ok && fcntl(new.fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) == -1) {
+		WARN("unable to seal dataset %s", name);
+		ok = false;
+	}
+	if (!ok) {
+		close(new.fd);
+		return;
+	}
+	new.size = lseek(new.fd, 0, SEEK_END);
+	snprintf(new.name, sizeof new.name, "%s", name);
+	if (!(new.source = strdup(src)))
+		ERR("strdup()");
+
+	if (old) {
+		close(old->fd);
+		free(old->source);
+	} else {
+		old = sets + set_cnt++;
+	}
+	*old = new;
+	export_set(old, true);
+	fprintf(stdout, "[data: %s holds %zu bytes, loaded in %.2fms; map it with cepl_data(\"%s\", &size)]\n",
+			name, new.size, elapsed_ms(&start), name);
+}
@@ -0,0 +1,31 @@
+/*
+ * data.h - session datasets shared with every run
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(DATA_H)
+#define DATA_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* maximum number of datasets */
+#define DATA_MAX	32
+/* maximum length of a dataset name */
+#define DATA_NAME	64
+
+/* struct definition for a dataset held in a sealed memfd */
+struct data_set {
+	char name[DATA_NAME];
+	/* file name or generator statement it was created from */
+	char *source;
+	int fd;
+	size_t size;
+};
+
+/* prototypes */
+void data_cmd(struct program *prog, char *args);
+
+#endif /* !defined(DATA_H) */
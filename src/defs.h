@@ -66,28 +66,56 @@
 /* global version and usage strings */
 #define VERSION_STRING	"cepl-29.0.0"
 #define USAGE_STRING															\
-	"[-hpvw] [-c<compiler>] [-e<code to evaluate>] [-l<library>] "									\
-	"[-I<include directory>] [-L<library directory>] [-s<standard>] "								\
+	"[-hMpTvw] [-b<backend>] [-c<compiler>] [-e<code to evaluate>] [-l<library>] [-P<profile>] "							\
+	"[-I<include directory>] [-L<library directory>] [-s<standard>] [-t<trace.json>] "							\
 	"[-o<out.c>]\n\t"														\
 	"-a, --asm\t\tName of file to output assembly to\n\t"										\
+	"-b, --backend\t\tSelect the compile backend (\"cc\" or \"tcc\")\n\t"								\
 	"-c, --compiler\t\tSpecify alternate compiler\n\t"										\
 	"-e, --eval\t\tEvaluate the following argument as C/C++ code\n\t"								\
 	"-h, --help\t\tShow help/usage information\n\t"											\
+	"-M, --modules\t\tUse a cached \"import std;\" module instead of textual C++ includes\n\t"					\
 	"-o, --output\t\tName of the file to output C/C++ source code to\n\t"								\
 	"-p, --parse\t\tDisable addition of dynamic library symbols to readline completion\n\t"						\
+	"-P, --profile\t\tSelect the build profile (\"debug\", \"fast\", or \"perf\")\n\t"						\
 	"-s, --std\t\tSpecify which C/C++ standard to use\n\t"										\
+	"-t, --trace\t\tWrite a trace event JSON file of each phase for chrome://tracing or Perfetto\n\t"				\
+	"-T, --templates\t\tLink prebuilt instantiations of common C++ standard templates\n\t"					\
 	"-v, --version\t\tShow version information\n\t"											\
 	"-w, --warnings\t\tCompile with \"-Wall -Wextra -pedantic\" flags\n\t"								\
 	"-l\t\t\tLink against specified library (flag can be repeated)\n\t"								\
 	"-I\t\t\tSearch directory for header files (flag can be repeated)\n\t"								\
 	"-L\t\t\tSearch directory for libraries (flag can be repeated)\n"								\
 	"Lines prefixed with a \";\" are interpreted as commands ([] text is optional)\n\t"						\
+	";asm\t\t\tShow the annotated assembly of the next build, or diff each build against the previous one (e.g. ;asm [on|off|diff])\n\t"	\
+	";bench\t\t\tTime a statement in a calibrated loop after the current program (e.g. ;bench [-c<cpu>] strlen(s))\n\t"			\
+	";bg\t\t\tContinue a stopped job or start the current program in the background (e.g. ;bg [%1])\n\t"				\
+	";backend\t\tList backends and latencies, select one, or \"compare\" them on the current program\n\t"			\
+	";cachesim\t\tShow simulated cache misses and branch mispredictions per input line (requires valgrind)\n\t"		\
+	";ctime\t\t\tShow compile time by compiler pass and by included header\n\t"							\
+	";compare\t\tBenchmark two statements with interleaved samples (e.g. ;compare [-c<cpu>] {strlen(s)} {memchr(s, 0, n)})\n\t"	\
+	";data\t\t\tLoad a file or generator output into a shared dataset the program maps with cepl_data() (e.g. ;data keys /tmp/keys.bin)\n\t"	\
+	";fg\t\t\tWait for a background job in the foreground (e.g. ;fg [%1])\n\t"							\
 	";f[unction]\t\tLine is defined outside of main() (e.g. ;f #define SWAP2(X) ((((X) >> 8) & 0xff) | (((X) & 0xff) << 8)))\n\t"	\
 	";h[elp]\t\t\tShow help\n\t"													\
+	";jobs\t\t\tList background jobs with their state and run time\n\t"								\
+	";kill\t\t\tTerminate a background job (e.g. ;kill [%1])\n\t"									\
+	";layout\t\t\tShow the member offsets, holes and cache lines of a struct, union or class (e.g. ;layout struct node)\n\t"		\
 	";m[an]\t\t\tShow manpage for argument (e.g. ;m strpbrk\n\t"									\
+	";mca\t\t\tRun llvm-mca on the code between CEPL_MCA_BEGIN and CEPL_MCA_END (e.g. ;mca [-mcpu=skylake])\n\t"			\
+	";matrix\t\t\tBuild the program under several compilers, standards and -O levels in parallel and compare them (e.g. ;matrix -cgcc,clang -sc11,c17 -O0,2,3)\n\t"	\
+	";pgo\t\t\tTrain the program with -fprofile-generate, rebuild it with -fprofile-use, and compare the timings and functions of both builds\n\t"	\
+	";perf\t\t\tToggle hardware performance counters for program runs (e.g. ;perf [on|off])\n\t"					\
+	";profile\t\tList build profiles or switch to one (e.g. ;profile perf)\n\t"						\
+	";profile-run\t\tSample the program and show the cost of each input line\n\t"						\
+	";scale\t\t\tRerun the program with CEPL_THREADS set to each thread count and show the speedup (e.g. ;scale [-a[compact|spread]] 1..8)\n\t"	\
+	";size\t\t\tShow the section sizes, largest functions and instruction set extensions of the program\n\t"			\
+	";stats\t\t\tShow compiler and program resource usage after each run (e.g. ;stats [off|brief|full])\n\t"			\
+	";syscalls\t\tToggle system call counts, times and bytes for program runs (e.g. ;syscalls [on|off])\n\t"			\
 	";q[uit]\t\t\tExit CEPL\n\t"													\
 	";r[eset]\t\tReset CEPL to its initial program state\n\t"									\
-	";u[ndo]\t\t\tIncremental pop_history (can be repeated)"
+	";u[ndo]\t\t\tIncremental pop_history (can be repeated)\n\t"									\
+	";vec\t\t\tShow vectorization, unrolling and inlining remarks for each input line"
 
 /* state flags */
 #define ASM_FLAG	0x01u
@@ -100,6 +128,8 @@
 #define PARSE_FLAG	0x80u
 #define STD_FLAG	0x100u
 #define WARN_FLAG	0x200u
+#define MODULE_FLAG	0x400u
+#define TEMPLATE_FLAG	0x800u
 
 /* page size for buffer count */
 #define PAGE_SIZE	0x1000u
@@ -156,6 +186,7 @@ struct program {
 	char *input_src[3], eval_arg[EVAL_LIMIT];
 	char *cur_line, *hist_file;
 	char *out_filename, *asm_filename;
+	char *tmpl_decls;
 	struct str_list cc_list;
 	struct str_list lib_list, sym_list;
 	struct str_list id_list;
@@ -178,6 +209,11 @@ static inline void reset_handlers(void)
 		{SIGXFSZ, "SIGXFSZ"},
 	};
 	struct sigaction sa[arr_len(sigs)];
+	sigset_t empty;
+	/* the parent reads its signals from a signalfd with them blocked */
+	sigemptyset(&empty);
+	if (sigprocmask(SIG_SETMASK, &empty, NULL) == -1)
+		ERR("sigprocmask()");
 	for (size_t i = 0; i < arr_len(sigs); i++) {
 		sa[i].sa_handler = SIG_DFL;
 		sigemptyset(&sa[i].sa_mask);
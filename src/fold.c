@@ -0,0 +1,1312 @@
+/*
+ * fold.c - constant expression evaluation
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "fold.h"
+#include <float.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <sys/types.h>
+
+/* maximum number of `printf()` arguments */
+#define FOLD_MAX_ARGS	0x20u
+/* maximum output of a folded program */
+#define FOLD_OUT_LIMIT	(PAGE_SIZE * 0x100u)
+/* size of the decoded string literal arena */
+#define FOLD_STR_LIMIT	(PAGE_SIZE * 0x10u)
+
+/* arithmetic types (signed types immediately precede their unsigned counterparts) */
+enum fold_type {
+	FT_BOOL, FT_CHAR, FT_SCHAR, FT_UCHAR, FT_SHORT, FT_USHORT,
+	FT_INT, FT_UINT, FT_LONG, FT_ULONG, FT_LLONG, FT_ULLONG,
+	FT_FLOAT, FT_DOUBLE, FT_LDOUBLE, FT_STR, FT_PTR, FT_VOID,
+};
+
+enum fold_tok {
+	TOK_END, TOK_NUM, TOK_STR, TOK_IDENT, TOK_PUNCT,
+};
+
+/* map an integer expression to its `enum fold_type` */
+#define FOLD_TYPEOF(x)								\
+	_Generic((x),								\
+		_Bool: FT_BOOL, char: FT_CHAR,					\
+		signed char: FT_SCHAR, unsigned char: FT_UCHAR,			\
+		short: FT_SHORT, unsigned short: FT_USHORT,			\
+		int: FT_INT, unsigned int: FT_UINT,				\
+		long: FT_LONG, unsigned long: FT_ULONG,				\
+		long long: FT_LLONG, unsigned long long: FT_ULLONG)
+
+struct fold_val {
+	enum fold_type type;
+	/* integer value sign-extended to 64 bits */
+	unsigned long long bits;
+	long double fp;
+	/* decoded string literal */
+	char const *str;
+	size_t str_len;
+};
+
+struct fold {
+	jmp_buf env;
+	bool cxx;
+	char const *pos;
+	/* set if the last token was followed by a `//` comment */
+	bool line_comment;
+	struct {
+		enum fold_tok kind;
+		char const *start;
+		size_t len;
+		struct fold_val val;
+	} tok;
+	char *out;
+	size_t out_len, out_max;
+	size_t str_len;
+	char strs[FOLD_STR_LIMIT];
+};
+
+/* sizes and conversion ranks of the target ABI (always the host ABI) */
+static struct { unsigned char size, rank; bool is_signed; } const type_info[] = {
+	[FT_BOOL] = {sizeof(_Bool), 1, false},
+	[FT_CHAR] = {sizeof(char), 2, CHAR_MIN < 0},
+	[FT_SCHAR] = {sizeof(signed char), 2, true},
+	[FT_UCHAR] = {sizeof(unsigned char), 2, false},
+	[FT_SHORT] = {sizeof(short), 3, true},
+	[FT_USHORT] = {sizeof(unsigned short), 3, false},
+	[FT_INT] = {sizeof(int), 4, true},
+	[FT_UINT] = {sizeof(unsigned int), 4, false},
+	[FT_LONG] = {sizeof(long), 5, true},
+	[FT_ULONG] = {sizeof(unsigned long), 5, false},
+	[FT_LLONG] = {sizeof(long long), 6, true},
+	[FT_ULLONG] = {sizeof(unsigned long long), 6, false},
+	[FT_FLOAT] = {sizeof(float), 7, true},
+	[FT_DOUBLE] = {sizeof(double), 8, true},
+	[FT_LDOUBLE] = {sizeof(long double), 9, true},
+	[FT_STR] = {0, 0, false},
+	[FT_PTR] = {sizeof(void *), 0, false},
+	[FT_VOID] = {0, 0, false},
+};
+
+/* typedef names pulled in by the prologue */
+static struct { char const *name; enum fold_type type; } const typedef_list[] = {
+	{"size_t", FOLD_TYPEOF((size_t)0)}, {"ssize_t", FOLD_TYPEOF((ssize_t)0)},
+	{"ptrdiff_t", FOLD_TYPEOF((ptrdiff_t)0)}, {"intptr_t", FOLD_TYPEOF((intptr_t)0)},
+	{"uintptr_t", FOLD_TYPEOF((uintptr_t)0)}, {"intmax_t", FOLD_TYPEOF((intmax_t)0)},
+	{"uintmax_t", FOLD_TYPEOF((uintmax_t)0)}, {"int8_t", FOLD_TYPEOF((int8_t)0)},
+	{"uint8_t", FOLD_TYPEOF((uint8_t)0)}, {"int16_t", FOLD_TYPEOF((int16_t)0)},
+	{"uint16_t", FOLD_TYPEOF((uint16_t)0)}, {"int32_t", FOLD_TYPEOF((int32_t)0)},
+	{"uint32_t", FOLD_TYPEOF((uint32_t)0)}, {"int64_t", FOLD_TYPEOF((int64_t)0)},
+	{"uint64_t", FOLD_TYPEOF((uint64_t)0)},
+};
+
+/* type specifier keywords */
+static char const *const type_keywords[] = {
+	"void", "char", "short", "int", "long", "float", "double",
+	"signed", "unsigned", "_Bool", "bool", "const", "volatile",
+	NULL
+};
+
+/* multi-character punctuators (longest first) */
+static char const *const punct_list[] = {
+	"<<=", ">>=", "...", "<<", ">>", "<=", ">=", "==", "!=",
+	"&&", "||", "++", "--", "->", "+=", "-=", "*=", "/=",
+	"%=", "&=", "|=", "^=", "::", "##",
+	NULL
+};
+
+/* compiler arguments which cannot change the semantics of a folded program */
+static char const *const safe_arg_list[] = {
+	"-g", "-O", "-pipe", "-x", "-o", "-std=", "-l", "-L",
+	"-march=", "-mtune=", "-fno-omit-frame-pointer",
+	NULL
+};
+
+/* standards missing `//` comments, hex floats, or `long long` */
+static char const *const old_std_list[] = {
+	"-std=c89", "-std=c90", "-std=gnu89", "-std=gnu90", "-std=ansi",
+	"-std=iso9899:1990", "-std=iso9899:199409", "-std=c++98",
+	"-std=c++03", "-std=gnu++98", "-std=gnu++03",
+	NULL
+};
+
+/* give up and fall back to the compiler */
+static _Noreturn void bail(struct fold *f)
+{
+	longjmp(f->env, 1);
+}
+
+static inline bool is_int(enum fold_type type)
+{
+	return type <= FT_ULLONG;
+}
+
+static inline bool is_float(enum fold_type type)
+{
+	return type >= FT_FLOAT && type <= FT_LDOUBLE;
+}
+
+static inline unsigned type_bits(enum fold_type type)
+{
+	return type_info[type].size * CHAR_BIT;
+}
+
+/* truncate to the width of `type` and sign-extend signed types */
+static inline unsigned long long normalize(unsigned long long bits, enum fold_type type)
+{
+	unsigned width = type_bits(type);
+	if (type == FT_BOOL)
+		return !!bits;
+	if (width >= 64)
+		return bits;
+	bits &= (1ULL << width) - 1;
+	if (type_info[type].is_signed && (bits >> (width - 1)))
+		bits |= ~0ULL << width;
+	return bits;
+}
+
+static inline long double narrow(struct fold *f, long double fp, enum fold_type type)
+{
+	long double ret;
+	switch (type) {
+	case FT_FLOAT:
+		ret = (float)fp;
+		break;
+	case FT_DOUBLE:
+		ret = (double)fp;
+		break;
+	default:
+		ret = fp;
+	}
+	/* out of range floating conversions are undefined */
+	if (isinf(ret) && !isinf(fp))
+		bail(f);
+	return ret;
+}
+
+static inline bool is_nonzero(struct fold *f, struct fold_val val)
+{
+	if (is_float(val.type))
+		return fpclassify(val.fp) != FP_ZERO;
+	if (!is_int(val.type))
+		bail(f);
+	return val.bits != 0;
+}
+
+static struct fold_val convert(struct fold *f, struct fold_val val, enum fold_type type)
+{
+	struct fold_val ret = {.type = type};
+	if (!is_int(val.type) && !is_float(val.type))
+		bail(f);
+	if (!is_int(type) && !is_float(type))
+		bail(f);
+
+	if (type == FT_BOOL) {
+		ret.bits = is_nonzero(f, val);
+	} else if (is_float(type)) {
+		if (is_float(val.type))
+			ret.fp = narrow(f, val.fp, type);
+		else if (type_info[val.type].is_signed)
+			ret.fp = narrow(f, (long double)(long long)val.bits, type);
+		else
+			ret.fp = narrow(f, (long double)val.bits, type);
+	} else if (is_float(val.type)) {
+		/* out of range floating to integer conversions are undefined */
+		unsigned width = type_bits(type);
+		long double trunc_val = truncl(val.fp);
+		if (isnan(val.fp))
+			bail(f);
+		if (type_info[type].is_signed) {
+			long double lim = ldexpl(1, width - 1);
+			if (trunc_val < -lim || trunc_val >= lim)
+				bail(f);
+			ret.bits = normalize((unsigned long long)(long long)trunc_val, type);
+		} else {
+			if (trunc_val < 0 || trunc_val >= ldexpl(1, width))
+				bail(f);
+			ret.bits = normalize((unsigned long long)trunc_val, type);
+		}
+	} else {
+		ret.bits = normalize(val.bits, type);
+	}
+	return ret;
+}
+
+static inline struct fold_val promote(struct fold *f, struct fold_val val)
+{
+	if (!is_int(val.type) && !is_float(val.type))
+		bail(f);
+	if (val.type < FT_INT)
+		return convert(f, val, FT_INT);
+	return val;
+}
+
+/* usual arithmetic conversions */
+static enum fold_type common_type(enum fold_type a, enum fold_type b)
+{
+	enum fold_type sgn, uns;
+	if (is_float(a) || is_float(b))
+		return (a > b) ? a : b;
+	if (a == b)
+		return a;
+	if (type_info[a].is_signed == type_info[b].is_signed)
+		return (type_info[a].rank > type_info[b].rank) ? a : b;
+	sgn = type_info[a].is_signed ? a : b;
+	uns = type_info[a].is_signed ? b : a;
+	if (type_info[uns].rank >= type_info[sgn].rank)
+		return uns;
+	if (type_info[sgn].size > type_info[uns].size)
+		return sgn;
+	return sgn + 1;
+}
+
+/* result type of relational, equality, and logical operators */
+static inline struct fold_val truth(struct fold *f, bool cond)
+{
+	return (struct fold_val){.type = f->cxx ? FT_BOOL : FT_INT, .bits = cond};
+}
+
+static inline struct fold_val int_val(enum fold_type type, unsigned long long bits)
+{
+	return (struct fold_val){.type = type, .bits = normalize(bits, type)};
+}
+
+static void out_append(struct fold *f, char const *buf, size_t len)
+{
+	if (f->out_len + len > FOLD_OUT_LIMIT)
+		bail(f);
+	if (f->out_len + len >= f->out_max) {
+		while (f->out_max <= f->out_len + len)
+			f->out_max = f->out_max ? f->out_max * 2 : PAGE_SIZE;
+		xrealloc(&f->out, f->out_max, "out_append()");
+	}
+	memcpy(f->out + f->out_len, buf, len);
+	f->out_len += len;
+}
+
+static void out_printf(struct fold *f, char const *fmt, ...)
+{
+	int len;
+	char *buf;
+	va_list args;
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	if (len < 0 || (size_t)len > FOLD_OUT_LIMIT)
+		bail(f);
+	xmalloc(&buf, len + 1, "out_printf()");
+	va_start(args, fmt);
+	vsnprintf(buf, len + 1, fmt, args);
+	va_end(args);
+	out_append(f, buf, len);
+	free(buf);
+}
+
+static void skip_space(struct fold *f)
+{
+	for (;;) {
+		f->pos += strspn(f->pos, " \t\n\v\f\r");
+		if (!strncmp(f->pos, "//", 2)) {
+			f->line_comment = true;
+			f->pos += strcspn(f->pos, "\n");
+			continue;
+		}
+		if (!strncmp(f->pos, "/*", 2)) {
+			char const *end = strstr(f->pos + 2, "*/");
+			if (!end)
+				bail(f);
+			f->pos = end + 2;
+			continue;
+		}
+		break;
+	}
+}
+
+/* decode one (possibly escaped) character of a literal */
+static unsigned char decode_char(struct fold *f)
+{
+	/* pairs of simple escape sequences and their values */
+	static char const esc_list[] = "n\nt\tr\rv\vf\fa\ab\b\\\\''\"\"??";
+	unsigned val = 0;
+	if (!*f->pos || *f->pos == '\n')
+		bail(f);
+	if (*f->pos != '\\')
+		return *f->pos++;
+	f->pos++;
+	for (size_t i = 0; i < sizeof esc_list - 1; i += 2) {
+		if (*f->pos == esc_list[i]) {
+			f->pos++;
+			return esc_list[i + 1];
+		}
+	}
+	if (*f->pos >= '0' && *f->pos <= '7') {
+		for (size_t i = 0; i < 3 && *f->pos >= '0' && *f->pos <= '7'; i++)
+			val = val * 8 + *f->pos++ - '0';
+	} else if (*f->pos == 'x') {
+		f->pos++;
+		if (!isxdigit(*f->pos))
+			bail(f);
+		while (isxdigit(*f->pos)) {
+			val = val * 16 + (isdigit(*f->pos) ? *f->pos - '0' : tolower(*f->pos) - 'a' + 10);
+			f->pos++;
+			if (val > UCHAR_MAX)
+				bail(f);
+		}
+	} else {
+		/* unknown, universal, and GNU `\e` escapes */
+		bail(f);
+	}
+	if (val > UCHAR_MAX)
+		bail(f);
+	return val;
+}
+
+static void lex_string(struct fold *f)
+{
+	size_t start = f->str_len;
+	/* concatenate adjacent string literals */
+	while (*f->pos == '"') {
+		f->pos++;
+		while (*f->pos != '"') {
+			if (f->str_len + 1 >= sizeof f->strs)
+				bail(f);
+			f->strs[f->str_len++] = decode_char(f);
+		}
+		f->pos++;
+		skip_space(f);
+	}
+	f->strs[f->str_len++] = '\0';
+	f->tok.kind = TOK_STR;
+	f->tok.val = (struct fold_val){
+		.type = FT_STR,
+		.str = f->strs + start,
+		.str_len = f->str_len - start - 1,
+	};
+}
+
+static void lex_char(struct fold *f)
+{
+	unsigned char c;
+	f->pos++;
+	c = decode_char(f);
+	/* multi-character constants are implementation-defined */
+	if (*f->pos++ != '\'')
+		bail(f);
+	f->tok.kind = TOK_NUM;
+	/* character constants are `int` in C and `char` in C++ */
+	if (f->cxx)
+		f->tok.val = int_val(FT_CHAR, c);
+	else
+		f->tok.val = int_val(FT_INT, normalize(c, FT_CHAR));
+}
+
+static void lex_float(struct fold *f, char const *start, char const *end)
+{
+	char *suffix;
+	long double fp;
+	errno = 0;
+	fp = strtold(start, &suffix);
+	/* hexadecimal floating constants require an exponent */
+	if (!strncasecmp(start, "0x", 2) && !memchr(start, 'p', end - start) && !memchr(start, 'P', end - start))
+		bail(f);
+	f->tok.kind = TOK_NUM;
+	if (suffix == end) {
+		f->tok.val = (struct fold_val){.type = FT_DOUBLE, .fp = strtod(start, NULL)};
+	} else if (suffix + 1 == end && (*suffix == 'f' || *suffix == 'F')) {
+		f->tok.val = (struct fold_val){.type = FT_FLOAT, .fp = strtof(start, NULL)};
+	} else if (suffix + 1 == end && (*suffix == 'l' || *suffix == 'L')) {
+		f->tok.val = (struct fold_val){.type = FT_LDOUBLE, .fp = fp};
+	} else {
+		bail(f);
+	}
+	/* constants out of range of their type trigger compiler diagnostics */
+	errno = 0;
+	switch (f->tok.val.type) {
+	case FT_FLOAT:
+		strtof(start, NULL);
+		break;
+	case FT_DOUBLE:
+		strtod(start, NULL);
+		break;
+	default:
+		strtold(start, NULL);
+	}
+	if (errno == ERANGE)
+		bail(f);
+}
+
+static void lex_int(struct fold *f, char const *start, char const *end)
+{
+	unsigned base = 10;
+	unsigned long long val = 0;
+	char const *cur = start;
+	bool has_u = false;
+	size_t n_long = 0;
+	enum fold_type first = FT_INT;
+
+	if (!strncasecmp(cur, "0x", 2)) {
+		base = 16;
+		cur += 2;
+	} else if (!strncasecmp(cur, "0b", 2)) {
+		base = 2;
+		cur += 2;
+	} else if (*cur == '0') {
+		base = 8;
+	}
+	if (base != 8 && !isxdigit(*cur))
+		bail(f);
+	for (; cur < end && isxdigit(*cur); cur++) {
+		unsigned digit = isdigit(*cur) ? *cur - '0' : tolower(*cur) - 'a' + 10;
+		/* `0b12`, `019`, or `12f` */
+		if (digit >= base)
+			bail(f);
+		if (__builtin_mul_overflow(val, base, &val) || __builtin_add_overflow(val, digit, &val))
+			bail(f);
+	}
+
+	/* parse `u`, `l`, and `ll` suffixes */
+	for (; cur < end; cur++) {
+		if ((*cur == 'u' || *cur == 'U') && !has_u) {
+			has_u = true;
+		} else if ((*cur == 'l' || *cur == 'L') && !n_long) {
+			n_long = 1;
+			if (cur + 1 < end && cur[1] == cur[0]) {
+				n_long = 2;
+				cur++;
+			}
+		} else {
+			bail(f);
+		}
+	}
+	if (n_long)
+		first = (n_long == 1) ? FT_LONG : FT_LLONG;
+
+	/* first type in the list which can represent the value */
+	for (enum fold_type type = first; type <= FT_ULLONG; type++) {
+		unsigned width = type_bits(type);
+		unsigned long long max;
+		if (type_info[type].is_signed) {
+			if (has_u)
+				continue;
+			max = (1ULL << (width - 1)) - 1;
+		} else {
+			/* unsuffixed decimal constants are never unsigned */
+			if (!has_u && base == 10)
+				continue;
+			max = (width >= 64) ? ~0ULL : (1ULL << width) - 1;
+		}
+		if (val <= max) {
+			f->tok.kind = TOK_NUM;
+			f->tok.val = int_val(type, val);
+			return;
+		}
+	}
+	bail(f);
+}
+
+static void lex_number(struct fold *f)
+{
+	char const *start = f->pos, *end = f->pos;
+	bool is_hex = !strncasecmp(start, "0x", 2), fp = false;
+	/* scan pp-number */
+	for (;;) {
+		if ((*end == 'e' || *end == 'E' || *end == 'p' || *end == 'P') && (end[1] == '+' || end[1] == '-')) {
+			if ((*end == 'e' || *end == 'E') == !is_hex)
+				fp = true;
+			end += 2;
+			continue;
+		}
+		if (*end == '.') {
+			fp = true;
+		} else if (*end == '\'') {
+			/* digit separators */
+			bail(f);
+		} else if (!isalnum(*end) && *end != '_') {
+			break;
+		}
+		if (!is_hex && (*end == 'e' || *end == 'E'))
+			fp = true;
+		if (is_hex && (*end == 'p' || *end == 'P'))
+			fp = true;
+		end++;
+	}
+	f->pos = end;
+	if (fp)
+		lex_float(f, start, end);
+	else
+		lex_int(f, start, end);
+}
+
+static void next_tok(struct fold *f)
+{
+	f->line_comment = false;
+	skip_space(f);
+	f->tok.start = f->pos;
+	f->tok.len = 0;
+	if (!*f->pos) {
+		f->tok.kind = TOK_END;
+		return;
+	}
+	if (isdigit(*f->pos) || (f->pos[0] == '.' && isdigit(f->pos[1]))) {
+		lex_number(f);
+	} else if (*f->pos == '"') {
+		lex_string(f);
+	} else if (*f->pos == '\'') {
+		lex_char(f);
+	} else if (isalpha(*f->pos) || *f->pos == '_') {
+		f->tok.kind = TOK_IDENT;
+		while (isalnum(*f->pos) || *f->pos == '_')
+			f->pos++;
+		/* prefixed character and string literals */
+		if (*f->pos == '"' || *f->pos == '\'')
+			bail(f);
+	} else {
+		f->tok.kind = TOK_PUNCT;
+		f->pos++;
+		for (size_t i = 0; punct_list[i]; i++) {
+			size_t len = strlen(punct_list[i]);
+			if (!strncmp(f->tok.start, punct_list[i], len)) {
+				f->pos = f->tok.start + len;
+				break;
+			}
+		}
+	}
+	f->tok.len = f->pos - f->tok.start;
+}
+
+static inline bool tok_is(struct fold *f, char const *str)
+{
+	return (f->tok.kind == TOK_PUNCT || f->tok.kind == TOK_IDENT)
+		&& f->tok.len == strlen(str)
+		&& !strncmp(f->tok.start, str, f->tok.len);
+}
+
+static inline void expect(struct fold *f, char const *str)
+{
+	if (!tok_is(f, str))
+		bail(f);
+	next_tok(f);
+}
+
+static bool ident_is_type(char const *start, size_t len)
+{
+	for (size_t i = 0; type_keywords[i]; i++) {
+		if (strlen(type_keywords[i]) == len && !strncmp(start, type_keywords[i], len))
+			return true;
+	}
+	for (size_t i = 0; i < arr_len(typedef_list); i++) {
+		if (strlen(typedef_list[i].name) == len && !strncmp(start, typedef_list[i].name, len))
+			return true;
+	}
+	return false;
+}
+
+/* check if the token following the current `(` starts a type name */
+static bool peek_type(struct fold *f)
+{
+	char const *saved = f->pos, *start;
+	bool ret;
+	skip_space(f);
+	start = f->pos;
+	while (isalnum(*f->pos) || *f->pos == '_')
+		f->pos++;
+	ret = ident_is_type(start, f->pos - start);
+	f->pos = saved;
+	return ret;
+}
+
+static enum fold_type parse_type(struct fold *f)
+{
+	enum {
+		N_VOID, N_CHAR, N_SHORT, N_INT, N_LONG, N_FLOAT, N_DOUBLE,
+		N_SIGNED, N_UNSIGNED, N_BOOL, N_TYPEDEF, N_MAX,
+	};
+	size_t cnt[N_MAX] = {0}, n_spec = 0;
+	enum fold_type type = FT_INT;
+	bool is_unsigned;
+
+	while (f->tok.kind == TOK_IDENT && ident_is_type(f->tok.start, f->tok.len)) {
+		size_t i;
+		if (tok_is(f, "const") || tok_is(f, "volatile")) {
+			next_tok(f);
+			continue;
+		}
+		/* `_Bool` is not a C++ keyword */
+		if (tok_is(f, "_Bool") && f->cxx)
+			bail(f);
+		for (i = 0; i < N_BOOL && !tok_is(f, type_keywords[i]); i++);
+		if (i == N_BOOL && !tok_is(f, "_Bool") && !tok_is(f, "bool")) {
+			i = N_TYPEDEF;
+			for (size_t j = 0; j < arr_len(typedef_list); j++) {
+				if (tok_is(f, typedef_list[j].name))
+					type = typedef_list[j].type;
+			}
+		}
+		cnt[i]++;
+		n_spec++;
+		next_tok(f);
+	}
+	is_unsigned = cnt[N_UNSIGNED];
+	if (cnt[N_SIGNED] + cnt[N_UNSIGNED] > 1)
+		bail(f);
+
+	if (cnt[N_TYPEDEF]) {
+		if (n_spec != 1)
+			bail(f);
+	} else if (cnt[N_VOID] || cnt[N_BOOL] || cnt[N_FLOAT]) {
+		if (n_spec != 1)
+			bail(f);
+		type = cnt[N_VOID] ? FT_VOID : cnt[N_BOOL] ? FT_BOOL : FT_FLOAT;
+	} else if (cnt[N_DOUBLE]) {
+		if (n_spec != 1 + cnt[N_LONG] || cnt[N_LONG] > 1)
+			bail(f);
+		type = cnt[N_LONG] ? FT_LDOUBLE : FT_DOUBLE;
+	} else if (cnt[N_CHAR]) {
+		if (n_spec != 1 + cnt[N_SIGNED] + cnt[N_UNSIGNED])
+			bail(f);
+		type = cnt[N_SIGNED] ? FT_SCHAR : is_unsigned ? FT_UCHAR : FT_CHAR;
+	} else if (cnt[N_SHORT]) {
+		if (cnt[N_SHORT] > 1 || cnt[N_LONG] || cnt[N_INT] > 1)
+			bail(f);
+		type = is_unsigned ? FT_USHORT : FT_SHORT;
+	} else if (cnt[N_LONG]) {
+		if (cnt[N_LONG] > 2 || cnt[N_INT] > 1)
+			bail(f);
+		type = (cnt[N_LONG] == 1) ? FT_LONG : FT_LLONG;
+		type += is_unsigned;
+	} else if (n_spec) {
+		if (cnt[N_INT] > 1)
+			bail(f);
+		type = is_unsigned ? FT_UINT : FT_INT;
+	} else {
+		bail(f);
+	}
+
+	/* pointer declarators are only useful as `sizeof` operands */
+	while (tok_is(f, "*")) {
+		type = FT_PTR;
+		next_tok(f);
+		while (tok_is(f, "const") || tok_is(f, "volatile") || tok_is(f, "restrict"))
+			next_tok(f);
+	}
+	return type;
+}
+
+/* prototypes for recursive descent */
+static struct fold_val parse_expr(struct fold *f);
+static struct fold_val parse_cond(struct fold *f);
+static struct fold_val parse_unary(struct fold *f);
+
+static struct fold_val int_arith(struct fold *f, char op, struct fold_val a, struct fold_val b)
+{
+	enum fold_type type = a.type;
+	unsigned width = type_bits(type);
+	long long sa = a.bits, sb = b.bits, sr = 0;
+	unsigned long long ur = 0;
+
+	if (!type_info[type].is_signed) {
+		switch (op) {
+		case '+': ur = a.bits + b.bits; break;
+		case '-': ur = a.bits - b.bits; break;
+		case '*': ur = a.bits * b.bits; break;
+		case '&': ur = a.bits & b.bits; break;
+		case '|': ur = a.bits | b.bits; break;
+		case '^': ur = a.bits ^ b.bits; break;
+		case '/': /* fallthrough */
+		case '%':
+			if (!b.bits)
+				bail(f);
+			ur = (op == '/') ? a.bits / b.bits : a.bits % b.bits;
+			break;
+		default:
+			bail(f);
+		}
+		return int_val(type, ur);
+	}
+
+	/* signed overflow is undefined */
+	switch (op) {
+	case '+':
+		if (__builtin_add_overflow(sa, sb, &sr))
+			bail(f);
+		break;
+	case '-':
+		if (__builtin_sub_overflow(sa, sb, &sr))
+			bail(f);
+		break;
+	case '*':
+		if (__builtin_mul_overflow(sa, sb, &sr))
+			bail(f);
+		break;
+	case '&': sr = sa & sb; break;
+	case '|': sr = sa | sb; break;
+	case '^': sr = sa ^ sb; break;
+	case '/': /* fallthrough */
+	case '%':
+		if (!sb || (sb == -1 && (unsigned long long)sa == normalize(1ULL << (width - 1), type)))
+			bail(f);
+		sr = (op == '/') ? sa / sb : sa % sb;
+		break;
+	default:
+		bail(f);
+	}
+	if (normalize(sr, type) != (unsigned long long)sr)
+		bail(f);
+	return int_val(type, sr);
+}
+
+static struct fold_val float_arith(struct fold *f, char op, struct fold_val a, struct fold_val b)
+{
+	struct fold_val ret = {.type = a.type};
+	if (op == '/' && fpclassify(b.fp) == FP_ZERO)
+		bail(f);
+	/* evaluate in the precision of the operand type */
+#define FOLD_FP_OP(T)								\
+	do {									\
+		T x = a.fp, y = b.fp;						\
+		switch (op) {							\
+		case '+': ret.fp = (T)(x + y); break;				\
+		case '-': ret.fp = (T)(x - y); break;				\
+		case '*': ret.fp = (T)(x * y); break;				\
+		case '/': ret.fp = (T)(x / y); break;				\
+		default: bail(f);						\
+		}								\
+	} while (0)
+	switch (a.type) {
+	case FT_FLOAT:
+		FOLD_FP_OP(float);
+		break;
+	case FT_DOUBLE:
+		FOLD_FP_OP(double);
+		break;
+	default:
+		FOLD_FP_OP(long double);
+	}
+#undef FOLD_FP_OP
+	if (isinf(ret.fp) && !isinf(a.fp) && !isinf(b.fp))
+		bail(f);
+	return ret;
+}
+
+static struct fold_val arith(struct fold *f, char op, struct fold_val a, struct fold_val b)
+{
+	enum fold_type type;
+	a = promote(f, a);
+	b = promote(f, b);
+	type = common_type(a.type, b.type);
+	a = convert(f, a, type);
+	b = convert(f, b, type);
+	if (is_float(type))
+		return float_arith(f, op, a, b);
+	return int_arith(f, op, a, b);
+}
+
+static struct fold_val compare(struct fold *f, char const *op, struct fold_val a, struct fold_val b)
+{
+	enum fold_type type;
+	int cmp;
+	a = promote(f, a);
+	b = promote(f, b);
+	type = common_type(a.type, b.type);
+	a = convert(f, a, type);
+	b = convert(f, b, type);
+	if (is_float(type)) {
+		/* unordered comparisons */
+		if (isnan(a.fp) || isnan(b.fp))
+			bail(f);
+		cmp = (a.fp > b.fp) - (a.fp < b.fp);
+	} else if (type_info[type].is_signed) {
+		cmp = ((long long)a.bits > (long long)b.bits) - ((long long)a.bits < (long long)b.bits);
+	} else {
+		cmp = (a.bits > b.bits) - (a.bits < b.bits);
+	}
+	if (!strcmp(op, "<"))
+		return truth(f, cmp < 0);
+	if (!strcmp(op, ">"))
+		return truth(f, cmp > 0);
+	if (!strcmp(op, "<="))
+		return truth(f, cmp <= 0);
+	if (!strcmp(op, ">="))
+		return truth(f, cmp >= 0);
+	if (!strcmp(op, "=="))
+		return truth(f, cmp == 0);
+	return truth(f, cmp != 0);
+}
+
+static struct fold_val shift(struct fold *f, char op, struct fold_val a, struct fold_val b)
+{
+	unsigned width;
+	unsigned long long cnt;
+	a = promote(f, a);
+	b = promote(f, b);
+	if (!is_int(a.type) || !is_int(b.type))
+		bail(f);
+	width = type_bits(a.type);
+	cnt = b.bits;
+	/* negative or oversized shift counts are undefined */
+	if ((type_info[b.type].is_signed && (long long)cnt < 0) || cnt >= width)
+		bail(f);
+	if (op == '>') {
+		if (type_info[a.type].is_signed)
+			return int_val(a.type, (long long)a.bits >> cnt);
+		return int_val(a.type, a.bits >> cnt);
+	}
+	if (!type_info[a.type].is_signed)
+		return int_val(a.type, a.bits << cnt);
+	/* shifting into or past the sign bit is undefined */
+	if ((long long)a.bits < 0 || (a.bits << cnt) >> cnt != a.bits || ((a.bits << cnt) >> (width - 1)))
+		bail(f);
+	return int_val(a.type, a.bits << cnt);
+}
+
+static struct fold_val parse_primary(struct fold *f)
+{
+	struct fold_val ret;
+	switch (f->tok.kind) {
+	case TOK_NUM: /* fallthrough */
+	case TOK_STR:
+		ret = f->tok.val;
+		next_tok(f);
+		return ret;
+	case TOK_PUNCT:
+		if (tok_is(f, "(")) {
+			next_tok(f);
+			ret = parse_expr(f);
+			expect(f, ")");
+			/* postfix operators */
+			if (tok_is(f, "[") || tok_is(f, "(") || tok_is(f, "++") || tok_is(f, "--"))
+				bail(f);
+			return ret;
+		}
+		/* fallthrough */
+	default:
+		/* identifiers, assignments, compound literals, etc. */
+		bail(f);
+	}
+}
+
+static struct fold_val parse_sizeof(struct fold *f)
+{
+	struct fold_val val;
+	enum fold_type size_type = FOLD_TYPEOF((size_t)0);
+	next_tok(f);
+	if (tok_is(f, "(") && peek_type(f)) {
+		enum fold_type type;
+		next_tok(f);
+		type = parse_type(f);
+		expect(f, ")");
+		/* `sizeof (void)` and compound literals */
+		if (type == FT_VOID || tok_is(f, "{"))
+			bail(f);
+		return int_val(size_type, type_info[type].size);
+	}
+	val = parse_unary(f);
+	if (val.type == FT_STR)
+		return int_val(size_type, val.str_len + 1);
+	if (!is_int(val.type) && !is_float(val.type))
+		bail(f);
+	return int_val(size_type, type_info[val.type].size);
+}
+
+static struct fold_val parse_unary(struct fold *f)
+{
+	struct fold_val val;
+	if (tok_is(f, "sizeof"))
+		return parse_sizeof(f);
+	/* casts */
+	if (tok_is(f, "(") && peek_type(f)) {
+		enum fold_type type;
+		next_tok(f);
+		type = parse_type(f);
+		expect(f, ")");
+		if (tok_is(f, "{"))
+			bail(f);
+		val = parse_unary(f);
+		/* discarded value */
+		if (type == FT_VOID)
+			return (struct fold_val){.type = FT_VOID};
+		return convert(f, val, type);
+	}
+	if (f->tok.kind != TOK_PUNCT || f->tok.len != 1 || !strchr("+-~!", *f->tok.start))
+		return parse_primary(f);
+
+	switch (*f->tok.start) {
+	case '+':
+		next_tok(f);
+		return promote(f, parse_unary(f));
+	case '-':
+		next_tok(f);
+		val = promote(f, parse_unary(f));
+		if (is_float(val.type)) {
+			val.fp = -val.fp;
+			return val;
+		}
+		if (!type_info[val.type].is_signed)
+			return int_val(val.type, -val.bits);
+		return int_arith(f, '-', int_val(val.type, 0), val);
+	case '~':
+		next_tok(f);
+		val = promote(f, parse_unary(f));
+		if (!is_int(val.type))
+			bail(f);
+		return int_val(val.type, ~val.bits);
+	default:
+		next_tok(f);
+		return truth(f, !is_nonzero(f, parse_unary(f)));
+	}
+}
+
+/* binary operators by precedence level (lowest first) */
+static char const *const binop_list[][5] = {
+	{"|"}, {"^"}, {"&"},
+	{"==", "!="},
+	{"<", ">", "<=", ">="},
+	{"<<", ">>"},
+	{"+", "-"},
+	{"*", "/", "%"},
+};
+
+static struct fold_val parse_binary(struct fold *f, size_t level)
+{
+	struct fold_val lhs;
+	if (level >= arr_len(binop_list))
+		return parse_unary(f);
+	lhs = parse_binary(f, level + 1);
+	for (;;) {
+		char const *op = NULL;
+		struct fold_val rhs;
+		for (size_t i = 0; binop_list[level][i]; i++) {
+			if (tok_is(f, binop_list[level][i]))
+				op = binop_list[level][i];
+		}
+		if (!op)
+			return lhs;
+		next_tok(f);
+		rhs = parse_binary(f, level + 1);
+		if (!strcmp(op, "<<") || !strcmp(op, ">>"))
+			lhs = shift(f, op[0], lhs, rhs);
+		else if (strchr("<>=!", op[0]))
+			lhs = compare(f, op, lhs, rhs);
+		else
+			lhs = arith(f, op[0], lhs, rhs);
+	}
+}
+
+static struct fold_val parse_logical(struct fold *f, bool is_or)
+{
+	struct fold_val lhs = is_or ? parse_logical(f, false) : parse_binary(f, 0);
+	while (tok_is(f, is_or ? "||" : "&&")) {
+		struct fold_val rhs;
+		next_tok(f);
+		/* both operands are always evaluated to catch undefined behavior */
+		rhs = is_or ? parse_logical(f, false) : parse_binary(f, 0);
+		if (is_or)
+			lhs = truth(f, is_nonzero(f, lhs) || is_nonzero(f, rhs));
+		else
+			lhs = truth(f, is_nonzero(f, lhs) && is_nonzero(f, rhs));
+	}
+	return lhs;
+}
+
+static struct fold_val parse_cond(struct fold *f)
+{
+	struct fold_val cond = parse_logical(f, true), lhs, rhs;
+	enum fold_type type;
+	if (!tok_is(f, "?"))
+		return cond;
+	next_tok(f);
+	lhs = parse_expr(f);
+	expect(f, ":");
+	rhs = parse_cond(f);
+	/* C++ skips promotions for operands of the same type */
+	if (f->cxx && lhs.type == rhs.type && (is_int(lhs.type) || is_float(lhs.type)))
+		return is_nonzero(f, cond) ? lhs : rhs;
+	/* string operands decay to pointers */
+	lhs = promote(f, lhs);
+	rhs = promote(f, rhs);
+	type = common_type(lhs.type, rhs.type);
+	return convert(f, is_nonzero(f, cond) ? lhs : rhs, type);
+}
+
+static struct fold_val parse_expr(struct fold *f)
+{
+	struct fold_val val = parse_cond(f);
+	while (tok_is(f, ",")) {
+		next_tok(f);
+		val = parse_cond(f);
+		/* array to pointer decay differs between C and C++ */
+		if (val.type == FT_STR)
+			bail(f);
+	}
+	return val;
+}
+
+/* emit a single `printf()` conversion */
+static void fold_conv(struct fold *f, char const *spec, char const *len_mod, char conv, struct fold_val val)
+{
+	enum fold_type type;
+	if (conv == 's') {
+		if (val.type != FT_STR || *len_mod)
+			bail(f);
+		out_printf(f, spec, val.str);
+		return;
+	}
+	val = promote(f, val);
+	type = val.type;
+
+	if (strchr("fFeEgGaA", conv)) {
+		if (!strcmp(len_mod, "L") && type == FT_LDOUBLE)
+			out_printf(f, spec, val.fp);
+		/* `float` arguments are promoted to `double` */
+		else if ((!*len_mod || !strcmp(len_mod, "l")) && (type == FT_DOUBLE || type == FT_FLOAT))
+			out_printf(f, spec, (double)val.fp);
+		else
+			bail(f);
+		return;
+	}
+
+	if (!is_int(type) || !strchr("diouxXc", conv))
+		bail(f);
+	/* allow either signedness of the expected integer type */
+	type = type_info[type].is_signed ? type : type - 1;
+	if (conv == 'c' && *len_mod)
+		bail(f);
+	if (!*len_mod || !strcmp(len_mod, "h") || !strcmp(len_mod, "hh")) {
+		if (type != FT_INT)
+			bail(f);
+		out_printf(f, spec, (int)val.bits);
+	} else if (!strcmp(len_mod, "l")) {
+		if (type != FT_LONG)
+			bail(f);
+		out_printf(f, spec, (long)val.bits);
+	} else if (!strcmp(len_mod, "ll") || !strcmp(len_mod, "q")) {
+		if (type != FT_LLONG)
+			bail(f);
+		out_printf(f, spec, (long long)val.bits);
+	} else if (!strcmp(len_mod, "z")) {
+		if (type != FOLD_TYPEOF((ssize_t)0))
+			bail(f);
+		out_printf(f, spec, (size_t)val.bits);
+	} else if (!strcmp(len_mod, "j")) {
+		if (type != FOLD_TYPEOF((intmax_t)0))
+			bail(f);
+		out_printf(f, spec, (intmax_t)val.bits);
+	} else if (!strcmp(len_mod, "t")) {
+		if (type != FOLD_TYPEOF((ptrdiff_t)0))
+			bail(f);
+		out_printf(f, spec, (ptrdiff_t)val.bits);
+	} else {
+		bail(f);
+	}
+}
+
+static void fold_printf(struct fold *f, struct fold_val *args, size_t argc)
+{
+	size_t cur = 1;
+	char const *fmt;
+	if (!argc || args[0].type != FT_STR)
+		bail(f);
+	fmt = args[0].str;
+
+	while (*fmt) {
+		char spec[64], len_mod[3] = {0}, *end;
+		size_t spec_len = 1, lit = strcspn(fmt, "%");
+		long width = -1, prec = -1;
+		bool left = false;
+		out_append(f, fmt, lit);
+		if (!*(fmt += lit))
+			break;
+		fmt++;
+		if (*fmt == '%') {
+			out_append(f, "%", 1);
+			fmt++;
+			continue;
+		}
+
+		spec[0] = '%';
+		/* flags (`'` and `I` depend on the locale) */
+		while (*fmt && strchr("-+ #0", *fmt)) {
+			if (spec_len + 1 >= 16)
+				bail(f);
+			spec[spec_len++] = *fmt++;
+		}
+		/* width and precision (positional arguments are unsupported) */
+		if (*fmt == '*') {
+			struct fold_val star;
+			fmt++;
+			if (cur >= argc || (star = promote(f, args[cur++])).type != FT_INT)
+				bail(f);
+			width = (int)star.bits;
+			if (width < 0) {
+				left = true;
+				width = -width;
+			}
+		} else if (isdigit(*fmt)) {
+			width = strtol(fmt, &end, 10);
+			fmt = end;
+			if (*fmt == '$')
+				bail(f);
+		}
+		if (*fmt == '.') {
+			fmt++;
+			if (*fmt == '*') {
+				struct fold_val star;
+				fmt++;
+				if (cur >= argc || (star = promote(f, args[cur++])).type != FT_INT)
+					bail(f);
+				/* negative precision is taken as if omitted */
+				prec = ((int)star.bits < 0) ? -1 : (int)star.bits;
+			} else {
+				prec = strtol(fmt, &end, 10);
+				fmt = end;
+			}
+		}
+		if (width > INT_MAX / 2 || prec > INT_MAX / 2)
+			bail(f);
+		if (left)
+			spec[spec_len++] = '-';
+		spec[spec_len] = '\0';
+		if (width >= 0)
+			spec_len += snprintf(spec + spec_len, sizeof spec - spec_len, "%ld", width);
+		if (prec >= 0)
+			spec_len += snprintf(spec + spec_len, sizeof spec - spec_len, ".%ld", prec);
+		/* length modifiers */
+		for (size_t i = 0; i < 2 && *fmt && strchr("hlLqjzt", *fmt); i++) {
+			if (i && *fmt != len_mod[0])
+				bail(f);
+			len_mod[i] = *fmt++;
+		}
+		if (!*fmt || cur >= argc)
+			bail(f);
+		snprintf(spec + spec_len, sizeof spec - spec_len, "%s%c", len_mod, *fmt);
+		fold_conv(f, spec, len_mod, *fmt++, args[cur++]);
+	}
+	/* excess arguments */
+	if (cur != argc)
+		bail(f);
+}
+
+static void fold_call(struct fold *f)
+{
+	struct fold_val args[FOLD_MAX_ARGS];
+	size_t argc = 0;
+	char name[8] = {0};
+	memcpy(name, f->tok.start, f->tok.len);
+	next_tok(f);
+	expect(f, "(");
+	while (!tok_is(f, ")")) {
+		if (argc && !tok_is(f, ","))
+			bail(f);
+		if (argc)
+			next_tok(f);
+		if (argc >= arr_len(args))
+			bail(f);
+		args[argc++] = parse_cond(f);
+	}
+	next_tok(f);
+
+	if (!strcmp(name, "printf")) {
+		fold_printf(f, args, argc);
+	} else if (!strcmp(name, "puts")) {
+		if (argc != 1 || args[0].type != FT_STR)
+			bail(f);
+		out_append(f, args[0].str, strlen(args[0].str));
+		out_append(f, "\n", 1);
+	} else {
+		unsigned char c;
+		if (argc != 1 || (args[0] = promote(f, args[0])).type != FT_INT)
+			bail(f);
+		c = args[0].bits;
+		out_append(f, (char *)&c, 1);
+	}
+}
+
+static void fold_line(struct fold *f, char const *line)
+{
+	f->pos = line;
+	next_tok(f);
+	while (f->tok.kind != TOK_END) {
+		/* empty statement */
+		if (tok_is(f, ";")) {
+			next_tok(f);
+			continue;
+		}
+		if (tok_is(f, "printf") || tok_is(f, "puts") || tok_is(f, "putchar")) {
+			fold_call(f);
+		} else {
+			/* discarded expression statement */
+			parse_expr(f);
+		}
+		/* a trailing `;` is appended to the final statement of a line */
+		if (f->tok.kind != TOK_END)
+			expect(f, ";");
+		/* unless it ends up inside of a `//` comment */
+		else if (f->line_comment)
+			bail(f);
+	}
+}
+
+static bool safe_args(struct program *prog)
+{
+	if (!prog->cc_list.list || !prog->cc_list.list[0])
+		return false;
+	for (size_t i = 1; prog->cc_list.list[i]; i++) {
+		char const *arg = prog->cc_list.list[i];
+		bool safe = !strcmp(arg, "-");
+		for (size_t j = 0; safe_arg_list[j]; j++) {
+			if (!strncmp(arg, safe_arg_list[j], strlen(safe_arg_list[j])))
+				safe = true;
+		}
+		for (size_t j = 0; old_std_list[j]; j++) {
+			if (!strcmp(arg, old_std_list[j]))
+				safe = false;
+		}
+		/* `-Ofast` enables `-ffast-math` */
+		if (!safe || !strcmp(arg, "-Ofast"))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * evaluate the program in-process if every line in main() is
+ * a constant expression statement or a call to `printf()`,
+ * `puts()`, or `putchar()` with constant arguments; returns
+ * false without side effects if the compiler is required
+ */
+bool fold_program(struct program *prog, int *status)
+{
+	struct fold *f;
+	bool ret = false;
+
+	/* only the x86-64/aarch64 style evaluation method is modeled */
+	if (FLT_EVAL_METHOD != 0 || !safe_args(prog))
+		return false;
+	if (!prog->src[1].flags.list || !prog->src[1].lines.list)
+		return false;
+	xcalloc(&f, 1, sizeof *f, "fold_program()");
+	f->cxx = prog->state_flags & CXX_FLAG;
+
+	if (!setjmp(f->env)) {
+		for (size_t i = 1; i < prog->src[1].flags.cnt; i++) {
+			/* anything outside of main() could redefine the world */
+			if (prog->src[1].flags.list[i] != IN_MAIN || !prog->src[1].lines.list[i])
+				bail(f);
+			fold_line(f, prog->src[1].lines.list[i]);
+		}
+		fflush(stdout);
+		if (f->out_len && write(STDOUT_FILENO, f->out, f->out_len) == -1)
+			WARN("error writing folded output");
+		*status = 0;
+		ret = true;
+	}
+	free(f->out);
+	free(f);
+	return ret;
+}
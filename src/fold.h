@@ -0,0 +1,17 @@
+/*
+ * fold.h - constant expression evaluation
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(FOLD_H)
+#define FOLD_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* prototypes */
+bool fold_program(struct program *prog, int *status);
+
+#endif /* !defined(FOLD_H) */
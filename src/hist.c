@@ -5,13 +5,41 @@
  * See LICENSE file for copyright and license details.
  */
 
+#include "compile.h"
 #include "hist.h"
+#include "jobs.h"
+
+/* length limit of a `#line` entry marker */
+#define MARK_MAX 48
+/* trails entry markers so they can be told apart from `#line` directives in the input */
+#define MARK_TAG "/* cepl entry */"
+
+/* maps a `;data` dataset read-only, injected after the prologue macros */
+#define DATA_FUNC \
+	"static inline void const *cepl_data(char const *name, size_t *size)\n" \
+	"{\n" \
+	"\tchar var[128], *val;\n" \
+	"\tunsigned long long len;\n" \
+	"\tvoid *map;\n" \
+	"\tint fd;\n" \
+	"\tsnprintf(var, sizeof var, \"CEPL_DATA_%s\", name);\n" \
+	"\tif (!(val = getenv(var)) || sscanf(val, \"%d:%llu\", &fd, &len) != 2)\n" \
+	"\t\treturn NULL;\n" \
+	"\tif (size)\n" \
+	"\t\t*size = len;\n" \
+	"\tif (!len)\n" \
+	"\t\treturn \"\";\n" \
+	"\tmap = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);\n" \
+	"\treturn (map == MAP_FAILED) ? NULL : map;\n" \
+	"}\n\n"
 
 /* externs */
 extern struct str_list comp_list;
 
 /* source file includes templates */
 char const *prologue = NULL;
+/* prologue with injected declarations */
+static char *prologue_buf = NULL;
 char const *c_prologue =
 	"#undef _BSD_SOURCE\n"
 	"#define _BSD_SOURCE\n"
@@ -67,6 +95,10 @@ char const *c_prologue =
 	"#include <wctype.h>\n"
 	"#include <unistd.h>\n\n"
 	"extern char **environ;\n\n"
+	"#define CEPL_MCA_BEGIN __asm__ __volatile__(\"# LLVM-MCA-BEGIN\")\n"
+	"#define CEPL_MCA_END __asm__ __volatile__(\"# LLVM-MCA-END\")\n"
+	"#define CEPL_THREADS (getenv(\"CEPL_THREADS\") ? atoi(getenv(\"CEPL_THREADS\")) : 1)\n\n"
+	DATA_FUNC
 	"#line 1\n";
 char const *cxx_prologue =
 	"#undef _BSD_SOURCE\n"
@@ -125,12 +157,54 @@ char const *cxx_prologue =
 	"#include <source_location>\n"
 	"#include <stack>\n"
 	"#include <string>\n"
+	"#include <sys/mman.h>\n"
 	"#include <thread>\n"
 	"#include <typeinfo>\n"
 	"#include <type_traits>\n"
 	"#include <utility>\n"
 	"#include <vector>\n\n"
 	"extern char **environ;\n\n"
+	"#define CEPL_MCA_BEGIN __asm__ __volatile__(\"# LLVM-MCA-BEGIN\")\n"
+	"#define CEPL_MCA_END __asm__ __volatile__(\"# LLVM-MCA-END\")\n"
+	"#define CEPL_THREADS (getenv(\"CEPL_THREADS\") ? atoi(getenv(\"CEPL_THREADS\")) : 1)\n\n"
+	DATA_FUNC
+	"using namespace std;\n\n"
+	"#line 1\n";
+
+/* `import std;` exports no macros, so keep the headers that define them */
+char const *cxx_module_prologue =
+	"#undef _BSD_SOURCE\n"
+	"#define _BSD_SOURCE\n"
+	"#undef _DEFAULT_SOURCE\n"
+	"#define _DEFAULT_SOURCE\n"
+	"#undef _GNU_SOURCE\n"
+	"#define _GNU_SOURCE\n"
+	"#undef _POSIX_C_SOURCE\n"
+	"#define _POSIX_C_SOURCE 200809L\n"
+	"#undef _SVID_SOURCE\n"
+	"#define _SVID_SOURCE\n"
+	"#undef _XOPEN_SOURCE\n"
+	"#define _XOPEN_SOURCE 700\n\n"
+	"#include <cassert>\n"
+	"#include <cerrno>\n"
+	"#include <cfloat>\n"
+	"#include <cinttypes>\n"
+	"#include <climits>\n"
+	"#include <csetjmp>\n"
+	"#include <csignal>\n"
+	"#include <cstdarg>\n"
+	"#include <cstddef>\n"
+	"#include <cstdint>\n"
+	"#include <cstdio>\n"
+	"#include <cstdlib>\n"
+	"#include <ctime>\n"
+	"#include <sys/mman.h>\n\n"
+	"import std;\n\n"
+	"extern char **environ;\n\n"
+	"#define CEPL_MCA_BEGIN __asm__ __volatile__(\"# LLVM-MCA-BEGIN\")\n"
+	"#define CEPL_MCA_END __asm__ __volatile__(\"# LLVM-MCA-END\")\n"
+	"#define CEPL_THREADS (getenv(\"CEPL_THREADS\") ? atoi(getenv(\"CEPL_THREADS\")) : 1)\n\n"
+	DATA_FUNC
 	"using namespace std;\n\n"
 	"#line 1\n";
 
@@ -148,14 +222,10 @@ char const *prog_end =
 		"\n\treturn 0;\n"
 	"}\n";
 
-static const char *asm_arg_list[] = {
-	"-g0", "-O0",
-	"-pipe", "-S",
-	NULL
-};
-
 void cleanup(struct program *prog)
 {
+	/* hang up background jobs */
+	jobs_cleanup();
 	/* avoid segfault when stdin is not a tty */
 	if (isatty(STDIN_FILENO)) {
 		/* readline teardown */
@@ -168,6 +238,8 @@ void cleanup(struct program *prog)
 	prog->hist_file = NULL;
 	free(prog->out_filename);
 	prog->out_filename = NULL;
+	free(prog->tmpl_decls);
+	prog->tmpl_decls = NULL;
 	for (size_t i = 0; i < arr_len(prog->input_src); i++) {
 		free(prog->input_src[i]);
 		prog->input_src[i] = NULL;
@@ -176,57 +248,46 @@ void cleanup(struct program *prog)
 		printf("\n%s\n\n", "Terminating program.");
 }
 
+/* write the assembly of the final program, built with the same flags as every run */
 static inline void write_asm(struct program *prog)
 {
-	int status;
-	int pipe_cc[2];
-	struct str_list asm_args;
-
-	/* build compiler arg list */
-	init_str_list(&asm_args, prog->cc_list.list[0]);
-	for (const char **p = asm_arg_list; *p; p++)
-		append_str(&asm_args, *p, 0);
-	if (!(prog->state_flags & CXX_FLAG))
-		append_str(&asm_args, "-xc", 0);
-	else
-		append_str(&asm_args, "-xc++", 0);
-	append_str(&asm_args, "-", 0);
-	append_str(&asm_args, prog->asm_filename, 2);
-	asm_args.list[asm_args.cnt - 1][0] = '-';
-	asm_args.list[asm_args.cnt - 1][1] = 'o';
-
-	/* create pipe */
-	if (pipe2(pipe_cc, O_CLOEXEC) == -1)
-		ERR("error making pipe_cc pipe");
+	char *const extra[] = {"-S", NULL};
+	struct str_list args;
+	if (!prog->src[1].total.buf)
+		return;
+	compile_only_args(prog->cc_list.list, &args);
+	build_program(prog->src[1].total.buf, args.list, prog->asm_filename, extra, true);
+	free_str_list(&args);
+}
 
-	/* fork compiler */
-	switch (fork()) {
-	/* error */
-	case -1:
-		close(pipe_cc[0]);
-		close(pipe_cc[1]);
-		ERR("fork()");
-	/* child */
-	case 0:
-		close(pipe_cc[1]);
-		dup2(pipe_cc[0], STDIN_FILENO);
-		execvp(asm_args.list[0], asm_args.list);
-		ERR("execvp()");
-	/* parent */
-	default:
-		close(pipe_cc[0]);
-		if (write(pipe_cc[1], prog->src[1].total.buf, strlen(prog->src[1].total.buf)) == -1)
-			ERR("error writing to pipe_cc[1]");
-		close(pipe_cc[1]);
-		wait(&status);
+/* copy of `src` without the entry markers, which would misnumber diagnostics in a standalone file */
+static char *strip_marks(char const *src)
+{
+	char *out, *dst;
+	xmalloc(&out, strlen(src) + 1, "strip_marks()");
+	dst = out;
+	for (char const *cur = src; *cur;) {
+		size_t len = strcspn(cur, "\n"), digits;
+		if (*cur == '#' && !strncmp(cur, "#line ", 6) && (digits = strspn(cur + 6, "0123456789"))
+				&& !strncmp(cur + 6 + digits, " " MARK_TAG "\n", strlen(" " MARK_TAG "\n"))) {
+			cur += len + 1;
+			continue;
+		}
+		if (cur[len])
+			len++;
+		memcpy(dst, cur, len);
+		dst += len;
+		cur += len;
 	}
-	free_str_list(&asm_args);
+	*dst = '\0';
+	return out;
 }
 
 void write_files(struct program *prog)
 {
 	int out_fd;
 	size_t buf_len, buf_pos;
+	char *out;
 
 	/* write out history */
 	if (prog->state_flags & HIST_FLAG)
@@ -241,15 +302,14 @@ void write_files(struct program *prog)
 		return;
 	if ((out_fd = fileno(prog->ofile)) < 0)
 		return;
-	/* find buffer length */
-	for (buf_pos = 0; prog->src[1].total.buf[buf_pos]; buf_pos++);
-	buf_len = buf_pos;
+	out = strip_marks(prog->src[1].total.buf);
+	buf_len = strlen(out);
 	buf_pos = 0;
 
 	/* write out program to file */
 	for (;;) {
 		ssize_t ret;
-		if ((ret = write(out_fd, prog->src[1].total.buf + buf_pos, buf_len - buf_pos)) < 0) {
+		if ((ret = write(out_fd, out + buf_pos, buf_len - buf_pos)) < 0) {
 			if (errno == EINTR || errno == EAGAIN)
 				continue;
 			WARN("error writing to output fd");
@@ -260,6 +320,7 @@ void write_files(struct program *prog)
 			break;
 		buf_pos += ret;
 	}
+	free(out);
 	fsync(out_fd);
 	xfclose(&prog->ofile);
 	prog->ofile = NULL;
@@ -293,9 +354,20 @@ void init_buffers(struct program *prog)
 {
 	/* use appropriate prologue for compiler type (c or c++) */
 	if (prog->cc_list.list[0][strlen(prog->cc_list.list[0]) - 1] == '+')
-		prologue = cxx_prologue;
+		prologue = (prog->state_flags & MODULE_FLAG) ? cxx_module_prologue : cxx_prologue;
 	else
 		prologue = c_prologue;
+	/* insert `extern template` declarations before the trailing `#line 1` */
+	free(prologue_buf);
+	prologue_buf = NULL;
+	if (prologue != c_prologue && prog->tmpl_decls) {
+		size_t base_len = strlen(prologue) - strlen("#line 1\n");
+		xcalloc(&prologue_buf, 1, strlen(prologue) + strlen(prog->tmpl_decls) + 2, "init()");
+		memcpy(prologue_buf, prologue, base_len);
+		strmv(CONCAT, prologue_buf, prog->tmpl_decls);
+		strmv(CONCAT, prologue_buf, "\n#line 1\n");
+		prologue = prologue_buf;
+	}
 
 	/* user is truncated source for display */
 	xcalloc(&prog->src[0].funcs.buf, 1, 1, "init()");
@@ -314,12 +386,12 @@ void init_buffers(struct program *prog)
 	xcalloc(&prog->src[1].body.buf, 1, strlen(prog_start) + 1, "init()");
 	xcalloc(&prog->src[1].total.buf, 1, strlen(prologue)
 			+ strlen(prog_start)
-			+ strlen(prog_end) + 3, "init()");
+			+ strlen(prog_end) + 3 + 2 * MARK_MAX, "init()");
 	prog->src[1].funcs.size = prog->src[1].funcs.max = strlen(prologue) + 1;
 	prog->src[1].body.size = prog->src[1].body.max = strlen(prog_start) + 1;
 	prog->src[1].total.size = prog->src[1].total.max = strlen(prologue)
 			+ strlen(prog_start)
-			+ strlen(prog_end) + 3;
+			+ strlen(prog_end) + 3 + 2 * MARK_MAX;
 	/* sanity check */
 	for (size_t i = 0; i < 2; i++) {
 		if (!prog->src[i].funcs.buf || !prog->src[i].body.buf || !prog->src[i].total.buf) {
@@ -390,6 +462,93 @@ void pop_history(struct program *prog)
 	}
 }
 
+/* whether `buf` ends inside a block comment or a raw string literal */
+static bool open_text(char const *buf)
+{
+	char delim[20];
+	size_t delim_len = 0;
+	enum { CODE, LINE_COMMENT, BLOCK_COMMENT, STRING, CHAR, RAW_STRING } state = CODE;
+
+	for (char const *cur = buf; *cur; cur++) {
+		switch (state) {
+		case CODE:
+			if (cur[0] == '/' && cur[1] == '/') {
+				state = LINE_COMMENT;
+				cur++;
+			} else if (cur[0] == '/' && cur[1] == '*') {
+				state = BLOCK_COMMENT;
+				cur++;
+			} else if (cur[0] == 'R' && cur[1] == '"' && (cur == buf || !(isalnum((unsigned char)cur[-1]) || cur[-1] == '_')
+						|| strchr("uUL8", cur[-1]))) {
+				/* R"delim( ... )delim" */
+				delim_len = strcspn(cur + 2, "(\n");
+				if (cur[2 + delim_len] != '(' || delim_len > 16)
+					break;
+				delim[0] = ')';
+				memcpy(delim + 1, cur + 2, delim_len);
+				delim[++delim_len] = '"';
+				delim_len++;
+				state = RAW_STRING;
+				cur += delim_len;
+			} else if (*cur == '"') {
+				state = STRING;
+			} else if (*cur == '\'') {
+				state = CHAR;
+			}
+			break;
+
+		case LINE_COMMENT:
+			if (*cur == '\n')
+				state = CODE;
+			break;
+
+		case BLOCK_COMMENT:
+			if (cur[0] == '*' && cur[1] == '/') {
+				state = CODE;
+				cur++;
+			}
+			break;
+
+		case STRING: /* fallthrough */
+		case CHAR:
+			if (*cur == '\\' && cur[1])
+				cur++;
+			else if (*cur == (state == STRING ? '"' : '\'') || *cur == '\n')
+				state = CODE;
+			break;
+
+		case RAW_STRING:
+			if (!strncmp(cur, delim, delim_len)) {
+				state = CODE;
+				cur += delim_len - 1;
+			}
+			break;
+		}
+	}
+	return state == BLOCK_COMMENT || state == RAW_STRING;
+}
+
+/* `#line` marker numbering the following code as input entry `idx` */
+static char const *entry_mark(char const *buf, size_t idx)
+{
+	static char mark[MARK_MAX];
+	size_t len = strlen(buf);
+	/* a marker would split a backslash continuation, or land inside the text of an earlier entry */
+	if ((len > 1 && buf[len - 2] == '\\' && buf[len - 1] == '\n') || open_text(buf))
+		return "";
+	snprintf(mark, sizeof mark, "#line %zu " MARK_TAG "\n", idx);
+	return mark;
+}
+
+/* mark the start of the newest entry in the compiler source */
+static void mark_sect(struct program *prog, struct source_section *sect)
+{
+	char const *mark = entry_mark(sect->buf, prog->src[1].lines.cnt - 1);
+	resize_sect(prog, sect, strlen(mark));
+	resize_sect(prog, &prog->src[1].total, strlen(mark));
+	strmv(CONCAT, sect->buf, mark);
+}
+
 void build_body(struct program *prog)
 {
 	/* sanity check */
@@ -401,6 +560,8 @@ void build_body(struct program *prog)
 		append_str(&prog->src[i].lines, prog->cur_line, 0);
 		append_str(&prog->src[i].hist, prog->src[i].body.buf, 0);
 		append_flag(&prog->src[i].flags, IN_MAIN);
+		if (i)
+			mark_sect(prog, &prog->src[i].body);
 		strmv(CONCAT, prog->src[i].body.buf, "\t");
 		strmv(CONCAT, prog->src[i].body.buf, prog->cur_line);
 	}
@@ -417,6 +578,8 @@ void build_funcs(struct program *prog)
 		append_str(&prog->src[i].lines, prog->cur_line, 0);
 		append_str(&prog->src[i].hist, prog->src[i].funcs.buf, 0);
 		append_flag(&prog->src[i].flags, NOT_IN_MAIN);
+		if (i)
+			mark_sect(prog, &prog->src[i].funcs);
 		/* generate function buffers */
 		strmv(CONCAT, prog->src[i].funcs.buf, prog->cur_line);
 	}
@@ -432,7 +595,12 @@ void build_final(struct program *prog, char **argv)
 	/* finish building current iteration of source code */
 	for (size_t i = 0; i < 2; i++) {
 		strmv(0, prog->src[i].total.buf, prog->src[i].funcs.buf);
+		/* number generated code past the last entry */
+		if (i)
+			strmv(CONCAT, prog->src[i].total.buf, entry_mark(prog->src[i].funcs.buf, prog->src[i].lines.cnt));
 		strmv(CONCAT, prog->src[i].total.buf, prog->src[i].body.buf);
+		if (i)
+			strmv(CONCAT, prog->src[i].total.buf, entry_mark(prog->src[i].body.buf, prog->src[i].lines.cnt));
 		strmv(CONCAT, prog->src[i].total.buf, prog_end);
 	}
 }
@@ -0,0 +1,185 @@
+/*
+ * jit.c - in-process libtcc backend
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "jit.h"
+#include "jobs.h"
+#include "perf.h"
+#include "syscalls.h"
+#include "trace.h"
+#include <dlfcn.h>
+
+/* constants from `libtcc.h` */
+#define TCC_OUTPUT_MEMORY	1
+#define TCC_RELOCATE_AUTO	((void *)1)
+
+typedef struct TCCState TCCState;
+
+/* libtcc is loaded at runtime so it remains an optional dependency */
+static struct {
+	bool loaded, failed;
+	void *handle;
+	TCCState *(*new_state)(void);
+	void (*delete_state)(TCCState *);
+	void (*set_error_func)(TCCState *, void *, void (*)(void *, char const *));
+	void (*set_options)(TCCState *, char const *);
+	int (*add_include_path)(TCCState *, char const *);
+	int (*add_library_path)(TCCState *, char const *);
+	int (*add_library)(TCCState *, char const *);
+	int (*set_output_type)(TCCState *, int);
+	int (*compile_string)(TCCState *, char const *);
+	/* the second argument was dropped in tcc 0.9.28 and is ignored there */
+	int (*relocate)(TCCState *, void *);
+	void *(*get_symbol)(TCCState *, char const *);
+} tcc;
+
+static char const *const libtcc_names[] = {
+	"libtcc.so", "libtcc.so.1", "libtcc.so.0",
+	"/usr/lib/tcc/libtcc.so", "/usr/local/lib/tcc/libtcc.so",
+	NULL
+};
+
+static bool load_tcc(void)
+{
+	if (tcc.loaded || tcc.failed)
+		return tcc.loaded;
+	for (size_t i = 0; libtcc_names[i] && !tcc.handle; i++)
+		tcc.handle = dlopen(libtcc_names[i], RTLD_NOW|RTLD_LOCAL);
+	if (!tcc.handle) {
+		tcc.failed = true;
+		return false;
+	}
+	/* resolve entry points */
+	struct { void *sym; char const *name; } syms[] = {
+		{&tcc.new_state, "tcc_new"}, {&tcc.delete_state, "tcc_delete"},
+		{&tcc.set_error_func, "tcc_set_error_func"}, {&tcc.set_options, "tcc_set_options"},
+		{&tcc.add_include_path, "tcc_add_include_path"}, {&tcc.add_library_path, "tcc_add_library_path"},
+		{&tcc.add_library, "tcc_add_library"}, {&tcc.set_output_type, "tcc_set_output_type"},
+		{&tcc.compile_string, "tcc_compile_string"}, {&tcc.relocate, "tcc_relocate"},
+		{&tcc.get_symbol, "tcc_get_symbol"},
+	};
+	for (size_t i = 0; i < arr_len(syms); i++) {
+		void *fn = dlsym(tcc.handle, syms[i].name);
+		if (!fn) {
+			WARNX("%s missing from libtcc", syms[i].name);
+			dlclose(tcc.handle);
+			tcc.handle = NULL;
+			tcc.failed = true;
+			return false;
+		}
+		memcpy(syms[i].sym, &fn, sizeof fn);
+	}
+	return tcc.loaded = true;
+}
+
+/* tcc errors are discarded since the exact backend reports them on fallback */
+static void jit_error(void *opaque, char const *msg)
+{
+	(void)opaque, (void)msg;
+}
+
+bool jit_usable(void)
+{
+	return load_tcc();
+}
+
+bool jit_run(char const *src, char *const cc_args[], bool show_errors, int *status)
+{
+	TCCState *state;
+	int (*prog_main)(int, char **);
+	void *sym;
+	pid_t pid;
+	char *exec_args[] = {"/tmp/cepl_program", NULL};
+	struct timespec start;
+	struct rusage before, after;
+	struct perf_counters ctr;
+	struct syscall_counts sc;
+	int sync_fd[2];
+
+	if (!load_tcc())
+		return false;
+	/* tcc is a C compiler without profile instrumentation */
+	for (size_t i = 0; cc_args[i]; i++) {
+		if (!strcmp(cc_args[i], "-xc++") || !strncmp(cc_args[i], "-fprofile-", 10))
+			return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	getrusage(RUSAGE_SELF, &before);
+	if (!(state = tcc.new_state()))
+		return false;
+	trace_begin("tcc compile", "build", NULL);
+	tcc.set_error_func(state, NULL, &jit_error);
+	tcc.set_output_type(state, TCC_OUTPUT_MEMORY);
+	/* translate relevant compiler arguments */
+	for (size_t i = 1; cc_args[i]; i++) {
+		char const *arg = cc_args[i];
+		if (!strncmp(arg, "-I", 2))
+			tcc.add_include_path(state, arg + 2);
+		else if (!strncmp(arg, "-L", 2))
+			tcc.add_library_path(state, arg + 2);
+		else if (!strncmp(arg, "-l", 2))
+			tcc.add_library(state, arg + 2);
+		else if (!strncmp(arg, "-D", 2) || !strncmp(arg, "-U", 2))
+			tcc.set_options(state, arg);
+	}
+	if (tcc.compile_string(state, src) == -1
+			|| tcc.relocate(state, TCC_RELOCATE_AUTO) < 0
+			|| !(sym = tcc.get_symbol(state, "main"))) {
+		tcc.delete_state(state);
+		trace_end();
+		return false;
+	}
+	trace_end();
+	memcpy(&prog_main, &sym, sizeof sym);
+	/* in-process compilation shows up as our own usage */
+	getrusage(RUSAGE_SELF, &after);
+	timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+	timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+	after.ru_minflt -= before.ru_minflt;
+	after.ru_majflt -= before.ru_majflt;
+	after.ru_nvcsw -= before.ru_nvcsw;
+	after.ru_nivcsw -= before.ru_nivcsw;
+	record_phase(PHASE_CC, &start, &after);
+
+	/* don't duplicate pending output in the child */
+	fflush(NULL);
+	perf_sync_init(sync_fd);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch ((pid = fork())) {
+	/* error */
+	case -1:
+		ERR("error forking executable");
+		break;
+
+	/* child */
+	case 0:
+		jobs_child(true);
+		reset_handlers();
+		/* there is no `execve()`, so counting starts as soon as the parent attaches */
+		perf_sync_child(sync_fd);
+		syscalls_child();
+		exit(prog_main(1, exec_args));
+		break;
+
+	/* parent */
+	default:
+		jobs_spawned(pid, true);
+		perf_sync_parent(&ctr, sync_fd, pid, false);
+		syscalls_trace(&sc, pid);
+		*status = wait_phase(pid, "executable", show_errors, PHASE_RUN, &start);
+		perf_report(&ctr);
+		syscalls_report(&sc);
+	}
+	tcc.delete_state(state);
+
+	return true;
+}
@@ -0,0 +1,18 @@
+/*
+ * jit.h - in-process libtcc backend
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(JIT_H)
+#define JIT_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* prototypes */
+bool jit_usable(void);
+bool jit_run(char const *src, char *const cc_args[], bool show_errors, int *status);
+
+#endif /* !defined(JIT_H) */
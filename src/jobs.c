@@ -0,0 +1,522 @@
+/*
+ * jobs.c - signalfd and pidfd child management with background jobs
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "jobs.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <readline/readline.h>
+#include <stdarg.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+/* signals read from the signalfd instead of interrupting whatever cepl is doing */
+static int const sig_list[] = {SIGCHLD, SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGTSTP, SIGTTIN, SIGTTOU};
+static int sig_fd = -1;
+static struct job job_list[JOBS_MAX];
+static size_t job_cnt, job_seq;
+/* the input line being handled, and the last one which ran the program */
+static char *cur_line, *last_run;
+/* ^C was pressed or the last foreground program stopped during the current line */
+static bool cancelled, last_stopped;
+/* the child being waited for in the foreground, and whether it leads its own process group */
+static pid_t fg_pid;
+static bool fg_group;
+
+static char *dup_str(char const *str)
+{
+	char *dup;
+	if (!(dup = strdup(str)))
+		ERR("strdup()");
+	return dup;
+}
+
+/* cepl's process group is in the foreground of the terminal */
+static bool tty_owner(void)
+{
+	return isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+}
+
+/* take the terminal back from a foreground child */
+static void tty_reclaim(pid_t pid)
+{
+	if (isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == pid && tcsetpgrp(STDIN_FILENO, getpgrp()) == -1)
+		WARN("tcsetpgrp()");
+}
+
+/* the terminal delivered `info` to process group `pgrp` by itself */
+static bool tty_sent(struct signalfd_siginfo const *info, pid_t pgrp)
+{
+	return info->ssi_code == SI_KERNEL && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == pgrp;
+}
+
+/* print a notice, redrawing the prompt and pending input around it */
+static void notify(bool prompt, char const *fmt, ...)
+{
+	va_list args;
+	if (prompt)
+		rl_clear_visible_line();
+	va_start(args, fmt);
+	vfprintf(stdout, fmt, args);
+	va_end(args);
+	fflush(stdout);
+	if (prompt) {
+		rl_on_new_line();
+		rl_redisplay();
+	}
+}
+
+/* block the signals and read them from a signalfd */
+void jobs_init(void)
+{
+	sigset_t set;
+	sigemptyset(&set);
+	for (size_t i = 0; i < arr_len(sig_list); i++)
+		sigaddset(&set, sig_list[i]);
+	if (sigprocmask(SIG_BLOCK, &set, NULL) == -1)
+		ERR("sigprocmask()");
+	if ((sig_fd = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC)) == -1)
+		ERR("signalfd()");
+}
+
+int jobs_sigfd(void)
+{
+	return sig_fd;
+}
+
+/* pidfds of the background jobs, readable once they exit */
+size_t jobs_pidfds(int fds[static JOBS_MAX])
+{
+	size_t cnt = 0;
+	for (size_t i = 0; i < job_cnt; i++) {
+		if (job_list[i].pidfd != -1)
+			fds[cnt++] = job_list[i].pidfd;
+	}
+	return cnt;
+}
+
+/* track a child as job `%id`, taking ownership of `line` and `bin` */
+static struct job *add_job(struct job const *tmpl, bool stopped)
+{
+	struct job *job;
+	size_t id = 1;
+
+	if (job_cnt >= JOBS_MAX) {
+		WARNX("only %d jobs can be tracked, killing pid %d", JOBS_MAX, tmpl->pid);
+		kill(-tmpl->pid, SIGKILL);
+		kill(-tmpl->pid, SIGCONT);
+		waitpid(tmpl->pid, NULL, 0);
+		if (tmpl->bin)
+			unlink(tmpl->bin);
+		free(tmpl->bin);
+		free(tmpl->line);
+		return NULL;
+	}
+	/* lowest free id, keeping the list sorted */
+	for (job = job_list; job < job_list + job_cnt && job->id == id; job++, id++);
+	memmove(job + 1, job, (job_list + job_cnt++ - job) * sizeof *job);
+	*job = *tmpl;
+	job->id = id;
+	job->stopped = stopped;
+	if ((job->pidfd = pidfd_open(job->pid, 0)) == -1)
+		WARN("pidfd_open()");
+	return job;
+}
+
+/* describe how a job ended and forget it */
+static void finish_job(struct job *job, int status, bool prompt)
+{
+	char how[64];
+	if (WIFSIGNALED(status))
+		snprintf(how, sizeof how, "killed by SIG%s", sigabbrev_np(WTERMSIG(status)));
+	else
+		snprintf(how, sizeof how, "done, exit status %d", WEXITSTATUS(status));
+	notify(prompt, "[%zu] %s after %.2fs: %s\n", job->id, how, elapsed_ms(&job->start) / 1e3, job->line);
+	if (job->pidfd != -1)
+		close(job->pidfd);
+	if (job->bin)
+		unlink(job->bin);
+	free(job->bin);
+	free(job->line);
+	/* removal is a no-op for a job being waited on in the foreground */
+	if (job >= job_list && job < job_list + job_cnt)
+		memmove(job, job + 1, (job_list + --job_cnt - job) * sizeof *job);
+}
+
+static void set_stopped(struct job *job, bool stopped, bool prompt)
+{
+	if (stopped && !job->stopped)
+		notify(prompt, "[%zu] stopped: %s\n", job->id, job->line);
+	job->stopped = stopped;
+}
+
+/* collect the state changes of background jobs */
+static void reap_jobs(bool prompt)
+{
+	for (size_t i = job_cnt; i-- > 0;) {
+		int status;
+		if (waitpid(job_list[i].pid, &status, WNOHANG|WUNTRACED|WCONTINUED) <= 0)
+			continue;
+		if (WIFSTOPPED(status) || WIFCONTINUED(status))
+			set_stopped(job_list + i, WIFSTOPPED(status), prompt);
+		else
+			finish_job(job_list + i, status, prompt);
+	}
+}
+
+/* a wait elsewhere collected the status of `pid`, return whether it was a job */
+bool jobs_collect(pid_t pid, int status)
+{
+	for (size_t i = 0; i < job_cnt; i++) {
+		if (job_list[i].pid != pid)
+			continue;
+		if (WIFSTOPPED(status) || WIFCONTINUED(status))
+			set_stopped(job_list + i, WIFSTOPPED(status), false);
+		else
+			finish_job(job_list + i, status, false);
+		return true;
+	}
+	return false;
+}
+
+/* handle pending signals, forwarding them to the foreground child `pid` if there is one */
+static bool read_signals(pid_t pid, bool job, bool prompt)
+{
+	struct signalfd_siginfo info;
+	bool interrupt = false;
+	pid_t target = job ? -pid : pid;
+
+	while (read(sig_fd, &info, sizeof info) == sizeof info) {
+		switch (info.ssi_signo) {
+		case SIGINT:
+			interrupt = true;
+			if (!pid)
+				break;
+			/* a second ^C kills children which ignore the first */
+			if (cancelled)
+				kill(target, SIGKILL);
+			else if (!tty_sent(&info, job ? pid : getpgrp()))
+				kill(target, SIGINT);
+			cancelled = true;
+			break;
+
+		case SIGTSTP:
+			if (pid && job && !tty_sent(&info, pid))
+				kill(target, SIGTSTP);
+			break;
+
+		case SIGHUP: /* fallthrough */
+		case SIGQUIT: /* fallthrough */
+		case SIGTERM:
+			if (pid)
+				kill(target, SIGKILL);
+			/* at_quick_exit() handlers clean up, including the jobs */
+			quick_exit(128 + info.ssi_signo);
+			break;
+
+		case SIGCHLD:
+			reap_jobs(prompt);
+			break;
+
+		/* SIGTTIN and SIGTTOU are only blocked so the terminal can change hands */
+		default:;
+		}
+	}
+	return interrupt;
+}
+
+/* handle signals and exited jobs at the prompt, returning whether ^C was pressed */
+bool jobs_events(void)
+{
+	bool interrupt = read_signals(0, false, true);
+	reap_jobs(true);
+	return interrupt;
+}
+
+/* start handling a new input line */
+void jobs_line(char const *line)
+{
+	free(cur_line);
+	cur_line = dup_str(line);
+	cancelled = last_stopped = false;
+}
+
+bool jobs_cancelled(void)
+{
+	return cancelled;
+}
+
+bool jobs_stopped(void)
+{
+	return last_stopped;
+}
+
+/* move a program child into its own process group, in the foreground of the terminal if `fg` */
+void jobs_child(bool fg)
+{
+	bool tty = fg && tty_owner();
+	setpgid(0, 0);
+	/* SIGTTOU is still blocked here */
+	if (tty)
+		tcsetpgrp(STDIN_FILENO, getpid());
+}
+
+/* the parent's half of jobs_child(), whichever runs first wins */
+void jobs_spawned(pid_t pid, bool fg)
+{
+	bool tty = fg && tty_owner();
+	setpgid(pid, pid);
+	if (tty)
+		tcsetpgrp(STDIN_FILENO, pid);
+}
+
+/* wait for `fg->pid` in the foreground; 0 once it exits, 1 if it stopped into a job, -1 on error */
+static int wait_child(struct job *fg, int *status, struct rusage *ru, bool job)
+{
+	int pidfd = pidfd_open(fg->pid, 0), ret = -1;
+
+	last_stopped = false;
+	fg_pid = fg->pid;
+	fg_group = job;
+	/* later children of an interrupted line are cancelled as well */
+	if (cancelled)
+		kill(job ? -fg->pid : fg->pid, SIGKILL);
+	for (;;) {
+		/* poll() skips a negative pidfd, and SIGCHLD wakes it anyway */
+		struct pollfd fds[] = {{.fd = sig_fd, .events = POLLIN}, {.fd = pidfd, .events = POLLIN}};
+		pid_t pid;
+
+		if ((pid = wait4(fg->pid, status, WNOHANG|WUNTRACED, ru)) == -1) {
+			if (errno == EINTR)
+				continue;
+			WARN("wait4()");
+			break;
+		}
+		if (pid && WIFSTOPPED(*status)) {
+			/* only program runs can become jobs */
+			if (!job) {
+				kill(fg->pid, SIGCONT);
+				continue;
+			}
+			tty_reclaim(fg->pid);
+			if (!fg->line)
+				fg->line = dup_str(cur_line ? cur_line : "(program)");
+			if ((fg = add_job(fg, true)))
+				notify(false, "\n[%zu] stopped: %s\n", fg->id, fg->line);
+			last_stopped = true;
+			ret = 1;
+			break;
+		}
+		if (pid) {
+			ret = 0;
+			break;
+		}
+		if (poll(fds, arr_len(fds), -1) == -1 && errno != EINTR)
+			WARN("poll()");
+		read_signals(fg->pid, job, false);
+	}
+	if (pidfd != -1)
+		close(pidfd);
+	fg_pid = 0;
+	if (ret == 1)
+		return ret;
+	tty_reclaim(fg->pid);
+	/* ^C went straight to a program which owned the terminal */
+	if (!ret && WIFSIGNALED(*status) && WTERMSIG(*status) == SIGINT)
+		cancelled = true;
+	return ret;
+}
+
+/* wait for a child, forwarding signals to it; program runs (`job`) can be stopped into background jobs */
+int jobs_wait(pid_t pid, int *status, struct rusage *ru, bool job)
+{
+	struct job fg = {.pid = pid, .pidfd = -1};
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &fg.start);
+	if (job) {
+		free(last_run);
+		last_run = cur_line ? dup_str(cur_line) : NULL;
+	}
+	ret = wait_child(&fg, status, ru, job);
+	if (ret != 1)
+		free(fg.line);
+	return ret;
+}
+
+/* kill and reap the foreground child when a fatal signal takes cepl down */
+void jobs_abort(void)
+{
+	int status;
+	if (!fg_pid)
+		return;
+	kill(fg_group ? -fg_pid : fg_pid, SIGKILL);
+	while (waitpid(fg_pid, &status, 0) == -1 && errno == EINTR);
+	fg_pid = 0;
+}
+
+/* hang up every job when cepl exits */
+void jobs_cleanup(void)
+{
+	for (size_t i = 0; i < job_cnt; i++) {
+		kill(-job_list[i].pid, SIGHUP);
+		kill(-job_list[i].pid, SIGCONT);
+		if (job_list[i].bin)
+			unlink(job_list[i].bin);
+	}
+}
+
+/* `%n` or `n`, or the newest job (the newest stopped one for `stopped`) */
+static struct job *find_job(char const *arg, bool stopped)
+{
+	struct job *newest = NULL;
+	char *end;
+	size_t id;
+
+	if (!*arg) {
+		for (size_t i = 0; i < job_cnt; i++) {
+			if ((!stopped || job_list[i].stopped) && (!newest || job_list[i].start.tv_sec > newest->start.tv_sec
+						|| (job_list[i].start.tv_sec == newest->start.tv_sec && job_list[i].start.tv_nsec > newest->start.tv_nsec)))
+				newest = job_list + i;
+		}
+		return newest;
+	}
+	id = strtoull(arg + (*arg == '%'), &end, 10);
+	if (*end)
+		return NULL;
+	for (size_t i = 0; i < job_cnt; i++) {
+		if (job_list[i].id == id && (!stopped || job_list[i].stopped))
+			return job_list + i;
+	}
+	return NULL;
+}
+
+/* `;jobs` */
+void jobs_cmd(void)
+{
+	if (!job_cnt) {
+		fprintf(stdout, "%s\n", "[jobs: none]");
+		return;
+	}
+	for (size_t i = 0; i < job_cnt; i++) {
+		struct job const *job = job_list + i;
+		fprintf(stdout, "[%zu] %-8d %-8s %9.2fs  %s\n", job->id, job->pid, job->stopped ? "stopped" : "running",
+				elapsed_ms(&job->start) / 1e3, job->line);
+	}
+}
+
+/* build the current program into a private executable and start it as a job */
+static void start_job(struct program *prog)
+{
+	struct job tmpl = {.pidfd = -1};
+	char *args[2];
+	int null_fd;
+
+	if (asprintf(&tmpl.bin, "/tmp/cepl_job%zu", job_seq++) == -1)
+		ERR("asprintf()");
+	if (build_program(prog->src[1].total.buf, prog->cc_list.list, tmpl.bin, NULL, true)) {
+		unlink(tmpl.bin);
+		free(tmpl.bin);
+		return;
+	}
+	args[0] = tmpl.bin, args[1] = NULL;
+	tmpl.line = dup_str(last_run ? last_run : "(program)");
+	fflush(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &tmpl.start);
+	switch ((tmpl.pid = fork())) {
+	/* error */
+	case -1:
+		ERR("error forking job");
+		break;
+
+	/* child */
+	case 0:
+		jobs_child(false);
+		reset_handlers();
+		/* the terminal stays with cepl */
+		if ((null_fd = open("/dev/null", O_RDONLY)) != -1)
+			dup2(null_fd, STDIN_FILENO);
+		execve(args[0], args, environ);
+		/* execve() should never return */
+		ERR("error forking job");
+		break;
+
+	/* parent */
+	default:
+		jobs_spawned(tmpl.pid, false);
+		{
+			struct job *job = add_job(&tmpl, false);
+			if (job)
+				fprintf(stdout, "[%zu] %d: %s\n", job->id, job->pid, job->line);
+			fflush(stdout);
+		}
+	}
+}
+
+/* `;bg [%n]`: continue a stopped job, or start the current program as one */
+void bg_cmd(struct program *prog, char *args)
+{
+	struct job *job = find_job(args, true);
+	if (job) {
+		kill(-job->pid, SIGCONT);
+		job->stopped = false;
+		fprintf(stdout, "[%zu] %d: %s &\n", job->id, job->pid, job->line);
+		fflush(stdout);
+		return;
+	}
+	if (*args) {
+		WARNX("no stopped job %s", args);
+		return;
+	}
+	start_job(prog);
+}
+
+/* `;fg [%n]`: wait for a job in the foreground */
+void fg_cmd(char *args)
+{
+	struct job *job = find_job(args, false), fg;
+	struct rusage ru;
+	int status;
+
+	if (!job) {
+		WARNX("%s", *args ? "no such job" : "no jobs");
+		return;
+	}
+	/* the job leaves the list while it runs in the foreground */
+	fg = *job;
+	if (fg.pidfd != -1)
+		close(fg.pidfd);
+	fg.pidfd = -1;
+	memmove(job, job + 1, (job_list + --job_cnt - job) * sizeof *job);
+	fprintf(stdout, "[%zu] %s\n", fg.id, fg.line);
+	fflush(stdout);
+	if (tty_owner())
+		tcsetpgrp(STDIN_FILENO, fg.pid);
+	kill(-fg.pid, SIGCONT);
+	if (!wait_child(&fg, &status, &ru, true))
+		finish_job(&fg, status, false);
+}
+
+/* `;kill [%n]`: terminate a job */
+void kill_cmd(char *args)
+{
+	struct job *job = find_job(args, false);
+	if (!job) {
+		WARNX("%s", *args ? "no such job" : "no jobs");
+		return;
+	}
+	kill(-job->pid, SIGTERM);
+	/* stopped jobs only see it once continued */
+	kill(-job->pid, SIGCONT);
+}
@@ -0,0 +1,50 @@
+/*
+ * jobs.h - signalfd and pidfd child management with background jobs
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(JOBS_H)
+#define JOBS_H 1
+
+#include "defs.h"
+#include "errs.h"
+#include <sys/resource.h>
+
+/* maximum number of background jobs */
+#define JOBS_MAX	16
+
+/* struct definition for a background job */
+struct job {
+	size_t id;
+	pid_t pid;
+	int pidfd;
+	bool stopped;
+	/* input line it was started from */
+	char *line;
+	/* private executable removed when it exits, if any */
+	char *bin;
+	struct timespec start;
+};
+
+/* prototypes */
+void jobs_init(void);
+int jobs_sigfd(void);
+size_t jobs_pidfds(int fds[static JOBS_MAX]);
+bool jobs_events(void);
+void jobs_line(char const *line);
+bool jobs_cancelled(void);
+bool jobs_stopped(void);
+void jobs_child(bool fg);
+void jobs_spawned(pid_t pid, bool fg);
+int jobs_wait(pid_t pid, int *status, struct rusage *ru, bool job);
+bool jobs_collect(pid_t pid, int status);
+void jobs_abort(void);
+void jobs_cleanup(void);
+void jobs_cmd(void);
+void bg_cmd(struct program *prog, char *args);
+void fg_cmd(char *args);
+void kill_cmd(char *args);
+
+#endif /* !defined(JOBS_H) */
@@ -0,0 +1,586 @@
+/*
+ * layout.c - struct layout and cache line inspection from DWARF
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "layout.h"
+
+#define LAYOUT_OUT	"/tmp/cepl_layout"
+
+/* keep types which are declared but never used by a variable */
+static char *const gcc_flags[] = {"-g3", "-fno-eliminate-unused-debug-types", NULL};
+/* g++ only describes dynamic classes where their vtable is emitted */
+static char *const gxx_flags[] = {"-g3", "-fno-eliminate-unused-debug-types", "-femit-class-debug-always", NULL};
+static char *const clang_flags[] = {"-g3", "-fno-eliminate-unused-debug-types", "-fstandalone-debug", NULL};
+static struct {
+	char const *name;
+	enum layout_tag tag;
+} const tag_list[] = {
+	{"DW_TAG_structure_type", TAG_STRUCT}, {"DW_TAG_union_type", TAG_UNION},
+	{"DW_TAG_class_type", TAG_CLASS}, {"DW_TAG_member", TAG_MEMBER},
+	{"DW_TAG_inheritance", TAG_INHERITANCE}, {"DW_TAG_base_type", TAG_BASE},
+	{"DW_TAG_enumeration_type", TAG_ENUM}, {"DW_TAG_pointer_type", TAG_POINTER},
+	{"DW_TAG_reference_type", TAG_REFERENCE}, {"DW_TAG_rvalue_reference_type", TAG_REFERENCE},
+	{"DW_TAG_typedef", TAG_TYPEDEF}, {"DW_TAG_const_type", TAG_QUALIFIER},
+	{"DW_TAG_volatile_type", TAG_QUALIFIER}, {"DW_TAG_restrict_type", TAG_QUALIFIER},
+	{"DW_TAG_atomic_type", TAG_QUALIFIER}, {"DW_TAG_array_type", TAG_ARRAY},
+	{"DW_TAG_subrange_type", TAG_SUBRANGE}, {"DW_TAG_subroutine_type", TAG_SUBROUTINE},
+};
+
+/* struct definition for one member as laid out */
+struct layout_member {
+	struct layout_die const *die;
+	/* offset and size in bits */
+	size_t start, bits, align;
+};
+
+static void free_dies(struct layout_list *dies)
+{
+	for (size_t i = 0; i < dies->cnt; i++)
+		free(dies->list[i].name);
+	free(dies->list);
+}
+
+/* `<0x5a>` references and plain numbers */
+static size_t parse_num(char const *val)
+{
+	char const *op;
+	if (val[0] == '<' && val[1] == '0' && val[2] == 'x')
+		return strtoull(val + 3, NULL, 16);
+	/* DWARF 2 member locations are expressions */
+	if ((op = strstr(val, "DW_OP_plus_uconst: ")))
+		return strtoull(op + 19, NULL, 10);
+	if (!isdigit((unsigned char)val[0]))
+		return SIZE_MAX;
+	return strtoull(val, NULL, 0);
+}
+
+/* read one `<off>   DW_AT_name : value` line into the current entry */
+static void parse_attr(struct layout_list *dies, struct layout_die *die, struct layout_die *parent, char *line)
+{
+	char *attr = strstr(line, "DW_AT_"), *val, *str;
+	size_t len;
+
+	if (!attr || !(val = strchr(attr, ':')))
+		return;
+	attr += 6;
+	len = strcspn(attr, " :");
+	val += 1 + strspn(val + 1, " ");
+	/* `(indirect string, offset: 0x1e): char` */
+	if (val[0] == '(' && (str = strstr(val, "): ")))
+		val = str + 3;
+
+	if (len == 4 && !strncmp(attr, "name", 4)) {
+		free(die->name);
+		if (!(die->name = strdup(val)))
+			ERR("strdup()");
+	} else if (len == 4 && !strncmp(attr, "type", 4)) {
+		die->type = parse_num(val);
+	} else if (len == 9 && !strncmp(attr, "byte_size", 9)) {
+		die->byte_size = parse_num(val);
+	} else if (len == 9 && !strncmp(attr, "alignment", 9)) {
+		die->align = parse_num(val);
+	} else if (len == 20 && !strncmp(attr, "data_member_location", 20)) {
+		die->member_loc = parse_num(val);
+	} else if (len == 8 && !strncmp(attr, "bit_size", 8)) {
+		die->bit_size = parse_num(val);
+	} else if (len == 15 && !strncmp(attr, "data_bit_offset", 15)) {
+		die->bit_off = parse_num(val);
+	} else if (len == 11 && !strncmp(attr, "declaration", 11)) {
+		die->declaration = true;
+	} else if (len == 10 && !strncmp(attr, "artificial", 10)) {
+		die->artificial = true;
+	} else if (len == 8 && !strncmp(attr, "encoding", 8)) {
+		die->complex = strstr(val, "complex");
+	} else if (len == 8 && !strncmp(attr, "language", 8)) {
+		dies->cxx |= !!strstr(val, "C++");
+	} else if (die->tag == TAG_SUBRANGE && parent && parent->tag == TAG_ARRAY && parent->dim_cnt < LAYOUT_DIMS) {
+		/* array bounds belong to the enclosing array type */
+		size_t num = parse_num(val);
+		if (len == 11 && !strncmp(attr, "upper_bound", 11))
+			parent->dims[parent->dim_cnt++] = (num == SIZE_MAX) ? 0 : num + 1;
+		else if (len == 5 && !strncmp(attr, "count", 5))
+			parent->dims[parent->dim_cnt++] = (num == SIZE_MAX) ? 0 : num;
+	}
+}
+
+/* read the entries of `readelf --debug-dump=info` */
+static void parse_dies(char *dump, struct layout_list *dies)
+{
+	size_t stack[LAYOUT_DEPTH], cur = SIZE_MAX;
+	char *saved;
+
+	for (char *line = strtok_r(dump, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+		struct layout_die *die;
+		unsigned depth;
+		size_t off;
+		char *tag;
+
+		/* ` <1><2e>: Abbrev Number: 5 (DW_TAG_structure_type)` */
+		if (sscanf(line, " <%u><%zx>:", &depth, &off) == 2) {
+			cur = SIZE_MAX;
+			/* null entries end a list of children */
+			if (!(tag = strstr(line, "(DW_TAG_")) || depth >= LAYOUT_DEPTH)
+				continue;
+			tag++;
+			tag[strcspn(tag, ")")] = '\0';
+			if (dies->cnt == dies->max)
+				xrealloc(&dies->list, sizeof *dies->list * (dies->max = dies->max ? dies->max * 2 : 1024), "parse_dies()");
+			die = dies->list + dies->cnt;
+			*die = (struct layout_die){
+				.tag = TAG_OTHER, .depth = depth, .off = off, .type = SIZE_MAX,
+				.byte_size = SIZE_MAX, .align = SIZE_MAX, .member_loc = SIZE_MAX,
+				.bit_size = SIZE_MAX, .bit_off = SIZE_MAX,
+			};
+			for (size_t i = 0; i < arr_len(tag_list); i++) {
+				if (!strcmp(tag, tag_list[i].name)) {
+					die->tag = tag_list[i].tag;
+					/* qualifiers are named after themselves */
+					if (die->tag == TAG_QUALIFIER && !(die->name = strndup(tag + 7, strcspn(tag + 7, "_"))))
+						ERR("strndup()");
+					break;
+				}
+			}
+			stack[depth] = cur = dies->cnt++;
+			continue;
+		}
+		if (cur != SIZE_MAX) {
+			die = dies->list + cur;
+			parse_attr(dies, die, die->depth ? dies->list + stack[die->depth - 1] : NULL, line);
+		}
+	}
+}
+
+static struct layout_die const *find_die(struct layout_list const *dies, size_t off)
+{
+	size_t lo = 0, hi = dies->cnt;
+	/* readelf prints entries in section order */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (dies->list[mid].off == off)
+			return dies->list + mid;
+		if (dies->list[mid].off < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/* size of a type in bytes */
+static size_t type_size(struct layout_list const *dies, size_t off, unsigned depth)
+{
+	struct layout_die const *die = find_die(dies, off);
+	size_t size;
+
+	if (!die || depth > LAYOUT_DEPTH)
+		return 0;
+	switch (die->tag) {
+	case TAG_TYPEDEF: /* fallthrough */
+	case TAG_QUALIFIER:
+		return type_size(dies, die->type, depth + 1);
+	case TAG_POINTER: /* fallthrough */
+	case TAG_REFERENCE:
+		return (die->byte_size != SIZE_MAX) ? die->byte_size : sizeof(void *);
+	case TAG_ARRAY:
+		size = type_size(dies, die->type, depth + 1);
+		for (size_t i = 0; i < die->dim_cnt; i++)
+			size *= die->dims[i];
+		return size;
+	default:
+		return (die->byte_size != SIZE_MAX) ? die->byte_size : 0;
+	}
+}
+
+/* alignment of a type in bytes, from the largest scalar it contains */
+static size_t type_align(struct layout_list const *dies, size_t off, unsigned depth)
+{
+	struct layout_die const *die = find_die(dies, off);
+	size_t align = 1;
+
+	if (!die || depth > LAYOUT_DEPTH)
+		return 1;
+	if (die->align != SIZE_MAX)
+		return die->align;
+	switch (die->tag) {
+	case TAG_TYPEDEF: /* fallthrough */
+	case TAG_QUALIFIER: /* fallthrough */
+	case TAG_ARRAY:
+		return type_align(dies, die->type, depth + 1);
+	case TAG_STRUCT: /* fallthrough */
+	case TAG_UNION: /* fallthrough */
+	case TAG_CLASS:
+		for (struct layout_die const *cur = die + 1; cur < dies->list + dies->cnt && cur->depth > die->depth; cur++) {
+			size_t member;
+			if (cur->depth != die->depth + 1 || (cur->tag != TAG_MEMBER && cur->tag != TAG_INHERITANCE) || cur->declaration)
+				continue;
+			if ((member = type_align(dies, cur->type, depth + 1)) > align)
+				align = member;
+		}
+		return align;
+	default:
+		align = type_size(dies, off, depth + 1);
+		/* complex types align like their parts */
+		if (die->tag == TAG_BASE && die->complex)
+			align /= 2;
+		return (align && align <= 16) ? align : 1;
+	}
+}
+
+/* C-style name of a type */
+static void type_name(struct layout_list const *dies, size_t off, char *buf, size_t size, unsigned depth)
+{
+	struct layout_die const *die = find_die(dies, off);
+	size_t len;
+
+	if (!size)
+		return;
+	if (!die || depth > LAYOUT_DEPTH) {
+		snprintf(buf, size, "%s", "void");
+		return;
+	}
+	switch (die->tag) {
+	case TAG_STRUCT: /* fallthrough */
+	case TAG_UNION: /* fallthrough */
+	case TAG_CLASS: /* fallthrough */
+	case TAG_ENUM:
+		/* C needs the tag, C++ names the type */
+		snprintf(buf, size, "%s%s", dies->cxx ? ""
+				: (die->tag == TAG_UNION) ? "union " : (die->tag == TAG_ENUM) ? "enum " : "struct ",
+				die->name ? die->name : "{...}");
+		break;
+	case TAG_POINTER: /* fallthrough */
+	case TAG_REFERENCE:
+		if (find_die(dies, die->type) && find_die(dies, die->type)->tag == TAG_SUBROUTINE) {
+			snprintf(buf, size, "%s", "void (*)()");
+			break;
+		}
+		type_name(dies, die->type, buf, size, depth + 1);
+		len = strlen(buf);
+		snprintf(buf + len, size - len, " %s", (die->tag == TAG_POINTER) ? "*" : "&");
+		break;
+	case TAG_QUALIFIER:
+		len = snprintf(buf, size, "%s ", die->name);
+		if (len < size)
+			type_name(dies, die->type, buf + len, size - len, depth + 1);
+		break;
+	case TAG_ARRAY:
+		type_name(dies, die->type, buf, size, depth + 1);
+		for (size_t i = 0; i < die->dim_cnt; i++) {
+			len = strlen(buf);
+			snprintf(buf + len, size - len, "[%zu]", die->dims[i]);
+		}
+		break;
+	default:
+		snprintf(buf, size, "%s", die->name ? die->name : "void");
+	}
+}
+
+/* the function type a chain of pointers ends in, if any */
+static struct layout_die const *function_type(struct layout_list const *dies, struct layout_die const *type, size_t *stars)
+{
+	for (*stars = 0; type && type->tag == TAG_POINTER && *stars < 8; ++*stars)
+		type = find_die(dies, type->type);
+	return (type && type->tag == TAG_SUBROUTINE) ? type : NULL;
+}
+
+/* a member as it would be declared: `int d[4][2];`, `void (*fn)();`, `struct s *next;` */
+static void member_decl(struct layout_list const *dies, struct layout_die const *member, char *buf, size_t size)
+{
+	struct layout_die const *type = find_die(dies, member->type), *target;
+	char const *name = member->name ? member->name : "";
+	size_t len, stars;
+
+	if (member->tag == TAG_INHERITANCE) {
+		type_name(dies, member->type, buf, size, 0);
+		len = strlen(buf);
+		snprintf(buf + len, size - len, "%s", " (base)");
+		return;
+	}
+	if (type && type->tag == TAG_ARRAY) {
+		type_name(dies, type->type, buf, size, 0);
+		len = strlen(buf);
+		snprintf(buf + len, size - len, " %s", name);
+		for (size_t i = 0; i < type->dim_cnt; i++) {
+			len = strlen(buf);
+			snprintf(buf + len, size - len, "[%zu]", type->dims[i]);
+		}
+	} else if (type && type->tag == TAG_POINTER && (target = function_type(dies, type, &stars))) {
+		/* the return type of the function */
+		type_name(dies, target->type, buf, size, 0);
+		len = strlen(buf);
+		snprintf(buf + len, size - len, " (%.*s%s)()", (int)stars, "********", name);
+	} else {
+		type_name(dies, member->type, buf, size, 0);
+		len = strlen(buf);
+		snprintf(buf + len, size - len, "%s%s", (len && (buf[len - 1] == '*' || buf[len - 1] == '&')) ? "" : " ", name);
+	}
+	len = strlen(buf);
+	if (member->bit_size != SIZE_MAX)
+		snprintf(buf + len, size - len, ":%zu;", member->bit_size);
+	else
+		snprintf(buf + len, size - len, "%s", ";");
+}
+
+/* the definition of a struct, union, or class named `type`, looking through typedefs */
+static struct layout_die const *find_type(struct layout_list const *dies, char const *type)
+{
+	static char const *const keywords[] = {"struct ", "union ", "class "};
+	struct layout_die const *die = NULL;
+
+	for (size_t i = 0; i < arr_len(keywords); i++) {
+		if (!strncmp(type, keywords[i], strlen(keywords[i])))
+			type += strlen(keywords[i]);
+	}
+	/* entries are named without their enclosing namespaces and classes */
+	for (char const *cur = type; *cur && *cur != '<'; cur++) {
+		if (cur[0] == ':' && cur[1] == ':')
+			type = cur + 2;
+	}
+	for (size_t i = 0; i < dies->cnt && !die; i++) {
+		struct layout_die const *cur = dies->list + i;
+		if (!cur->name || strcmp(cur->name, type))
+			continue;
+		if ((cur->tag == TAG_STRUCT || cur->tag == TAG_UNION || cur->tag == TAG_CLASS) && !cur->declaration && cur->byte_size != SIZE_MAX)
+			return cur;
+		if (cur->tag == TAG_TYPEDEF)
+			die = cur;
+	}
+	for (unsigned depth = 0; die && depth < LAYOUT_DEPTH; depth++) {
+		if (die->tag != TAG_TYPEDEF && die->tag != TAG_QUALIFIER)
+			return (die->tag == TAG_STRUCT || die->tag == TAG_UNION || die->tag == TAG_CLASS) ? die : NULL;
+		die = find_die(dies, die->type);
+	}
+	return NULL;
+}
+
+static size_t data_size(struct layout_list const *dies, size_t off, unsigned depth);
+
+/* data members of a type in declaration order */
+static size_t collect_members(struct layout_list const *dies, struct layout_die const *type, struct layout_member **members, unsigned depth)
+{
+	size_t cnt = 0;
+
+	xcalloc(members, 1, sizeof **members, "collect_members()");
+	for (struct layout_die const *cur = type + 1; cur < dies->list + dies->cnt && cur->depth > type->depth; cur++) {
+		struct layout_member *member;
+		if (cur->depth != type->depth + 1 || (cur->tag != TAG_MEMBER && cur->tag != TAG_INHERITANCE))
+			continue;
+		/* static members have no location */
+		if (cur->declaration || (type->tag != TAG_UNION && cur->member_loc == SIZE_MAX && cur->bit_off == SIZE_MAX))
+			continue;
+		xrealloc(members, sizeof **members * (cnt + 1), "collect_members()");
+		member = *members + cnt++;
+		member->die = cur;
+		/* `_Alignas` and `alignas` members carry their own alignment */
+		member->align = (cur->align != SIZE_MAX) ? cur->align : type_align(dies, cur->type, 0);
+		if (cur->bit_size != SIZE_MAX) {
+			member->bits = cur->bit_size;
+			member->start = (cur->bit_off != SIZE_MAX) ? cur->bit_off : cur->member_loc * 8;
+		} else if (cur->tag == TAG_INHERITANCE) {
+			/* members of derived classes may reuse the tail padding of a base */
+			member->bits = data_size(dies, cur->type, depth + 1) * 8;
+			member->start = (cur->member_loc != SIZE_MAX) ? cur->member_loc * 8 : 0;
+		} else {
+			member->bits = type_size(dies, cur->type, 0) * 8;
+			member->start = (cur->member_loc != SIZE_MAX) ? cur->member_loc * 8 : 0;
+		}
+	}
+	return cnt;
+}
+
+/* bytes up to the end of the last member, which is all a base class occupies */
+static size_t data_size(struct layout_list const *dies, size_t off, unsigned depth)
+{
+	struct layout_die const *die = find_die(dies, off);
+	struct layout_member *members;
+	size_t cnt, end = 0;
+
+	for (; die && depth < LAYOUT_DEPTH && (die->tag == TAG_TYPEDEF || die->tag == TAG_QUALIFIER); depth++)
+		die = find_die(dies, die->type);
+	if (!die || depth >= LAYOUT_DEPTH || (die->tag != TAG_STRUCT && die->tag != TAG_CLASS))
+		return type_size(dies, off, 0);
+	cnt = collect_members(dies, die, &members, depth);
+	for (size_t i = 0; i < cnt; i++) {
+		if (members[i].start + members[i].bits > end)
+			end = members[i].start + members[i].bits;
+	}
+	free(members);
+	return (end + 7) / 8;
+}
+
+static void print_hole(size_t bits, size_t *holes, size_t *hole_bytes)
+{
+	(*holes)++;
+	*hole_bytes += bits / 8;
+	if (bits % 8)
+		fprintf(stdout, "\t/* XXX %zu bit%s hole */\n", bits, (bits == 1) ? "" : "s");
+	else
+		fprintf(stdout, "\t/* XXX %zu byte%s hole, try to pack */\n", bits / 8, (bits == 8) ? "" : "s");
+}
+
+static int cmp_align(void const *a, void const *b)
+{
+	struct layout_member const *x = a, *y = b;
+	if (x->align != y->align)
+		return (x->align < y->align) - (x->align > y->align);
+	/* keep declaration order otherwise */
+	return (x->die > y->die) - (x->die < y->die);
+}
+
+static int cmp_start(void const *a, void const *b)
+{
+	struct layout_member const *x = a, *y = b;
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+/* lowest aligned byte offset from `from` where `bytes` fit between the members placed so far */
+static size_t first_fit(struct layout_member const *placed, size_t cnt, size_t from, size_t bytes, size_t align)
+{
+	size_t best = SIZE_MAX;
+
+	/* a gap starts at `from` or where a placed member ends */
+	for (size_t i = 0; i <= cnt; i++) {
+		size_t off = (i == cnt) ? from : (placed[i].start + placed[i].bits + 7) / 8;
+		bool fits = off >= from;
+		off = (off + align - 1) / align * align;
+		for (size_t j = 0; j < cnt && fits; j++)
+			fits = off + bytes <= placed[j].start / 8 || off >= (placed[j].start + placed[j].bits + 7) / 8;
+		if (fits && off < best)
+			best = off;
+	}
+	return best;
+}
+
+/* suggest a declaration order without holes: members by decreasing alignment, each in the first gap it fits */
+static void suggest_order(struct layout_member *members, size_t cnt, size_t size, size_t align)
+{
+	size_t fixed = 0, from = 0, end = 0, packed;
+
+	for (size_t i = 0; i < cnt; i++) {
+		if (members[i].die->bit_size != SIZE_MAX) {
+			fprintf(stdout, "%s\n", "[layout: has bit-fields, no reordering suggested]");
+			return;
+		}
+	}
+	/* base classes and the vtable pointer stay in front */
+	for (; fixed < cnt && (members[fixed].die->tag == TAG_INHERITANCE || members[fixed].die->artificial); fixed++) {
+		if ((members[fixed].start + members[fixed].bits + 7) / 8 > from)
+			from = (members[fixed].start + members[fixed].bits + 7) / 8;
+	}
+	if (fixed == cnt)
+		return;
+	qsort(members + fixed, cnt - fixed, sizeof *members, cmp_align);
+	for (size_t i = fixed; i < cnt; i++) {
+		members[i].start = first_fit(members + fixed, i - fixed, from, members[i].bits / 8, members[i].align) * 8;
+		if (members[i].start + members[i].bits > end)
+			end = members[i].start + members[i].bits;
+	}
+	if (end / 8 < from)
+		end = from * 8;
+	packed = (end / 8 + align - 1) / align * align;
+	if (packed >= size) {
+		fprintf(stdout, "%s\n", "[layout: no member order is smaller]");
+		return;
+	}
+	qsort(members + fixed, cnt - fixed, sizeof *members, cmp_start);
+	fprintf(stdout, "[layout: reordering as ");
+	for (size_t i = fixed; i < cnt; i++)
+		fprintf(stdout, "%s%s", (i > fixed) ? ", " : "", members[i].die->name ? members[i].die->name : "(anonymous)");
+	fprintf(stdout, " takes %zu bytes (%zu cacheline%s), saving %zu]\n", packed,
+			(packed + LAYOUT_LINE - 1) / LAYOUT_LINE, ((packed + LAYOUT_LINE - 1) / LAYOUT_LINE == 1) ? "" : "s", size - packed);
+}
+
+/* pahole-style listing of one type */
+static void print_layout(struct layout_list const *dies, struct layout_die const *type, char const *alias)
+{
+	struct layout_member *members;
+	size_t cnt = collect_members(dies, type, &members, 0), size = type->byte_size, end = 0, line = 0;
+	size_t holes = 0, hole_bytes = 0, sum = 0, align = type_align(dies, type->off, 0);
+	bool is_union = type->tag == TAG_UNION;
+	char name[256];
+
+	type_name(dies, type->off, name, sizeof name, 0);
+	/* C names already carry the tag, and anonymous types are named by their typedef */
+	if (type->name)
+		fprintf(stdout, "%s%s {\n", !dies->cxx ? "" : is_union ? "union " : (type->tag == TAG_CLASS) ? "class " : "struct ", name);
+	else
+		fprintf(stdout, "%s { /* %s */\n", is_union ? "union" : (type->tag == TAG_CLASS) ? "class" : "struct", alias);
+	for (size_t i = 0; i < cnt; i++) {
+		struct layout_member const *member = members + i;
+		size_t off = member->start / 8, bytes = (member->bits + 7) / 8;
+		char decl[512], pos[32];
+
+		if (!is_union && member->start > end)
+			print_hole(member->start - end, &holes, &hole_bytes);
+		if (!is_union && off / LAYOUT_LINE > line) {
+			line = off / LAYOUT_LINE;
+			fprintf(stdout, "\t/* --- cacheline %zu boundary (%zu bytes) --- */\n", line, line * LAYOUT_LINE);
+		}
+		member_decl(dies, member->die, decl, sizeof decl);
+		if (member->die->bit_size != SIZE_MAX)
+			snprintf(pos, sizeof pos, "%zu:%zu", off, member->start % 8);
+		else
+			snprintf(pos, sizeof pos, "%zu", off);
+		fprintf(stdout, "\t%-40s /* %7s %5zu */", decl, pos, bytes);
+		if (bytes && off / LAYOUT_LINE != (off + bytes - 1) / LAYOUT_LINE)
+			fputs(" /* crosses a cacheline */", stdout);
+		fputc('\n', stdout);
+		sum += member->bits;
+		if (member->start + member->bits > end)
+			end = member->start + member->bits;
+	}
+	fprintf(stdout, "\n\t/* size: %zu, cachelines: %zu, members: %zu */\n", size, (size + LAYOUT_LINE - 1) / LAYOUT_LINE, cnt);
+	if (!is_union)
+		fprintf(stdout, "\t/* sum members: %zu, holes: %zu, sum holes: %zu */\n", sum / 8, holes, hole_bytes);
+	if (size * 8 > end)
+		fprintf(stdout, "\t/* padding: %zu */\n", size - (end + 7) / 8);
+	if (size % LAYOUT_LINE)
+		fprintf(stdout, "\t/* last cacheline: %zu bytes */\n", size % LAYOUT_LINE);
+	fputs("};\n", stdout);
+
+	if (!is_union && cnt && (holes || size * 8 > end))
+		suggest_order(members, cnt, size, align);
+	free(members);
+}
+
+/* `;layout <type>` */
+void layout_cmd(struct program *prog, char const *type)
+{
+	char *args[] = {"readelf", "--debug-dump=info", LAYOUT_OUT, NULL}, *dump = NULL;
+	struct layout_list dies = {0};
+	struct layout_die const *die;
+	char *const *flags = strstr(prog->cc_list.list[0], "clang") ? clang_flags
+		: (prog->state_flags & CXX_FLAG) ? gxx_flags : gcc_flags;
+
+	if (!*type) {
+		WARNX("%s", "usage: ;layout <type>");
+		return;
+	}
+	if (build_program(prog->src[1].total.buf, prog->cc_list.list, LAYOUT_OUT, flags, true)) {
+		unlink(LAYOUT_OUT);
+		return;
+	}
+	if (run_cmd(args, &dump, false) || !dump) {
+		WARNX("%s", "unable to read the debug information with readelf");
+		free(dump);
+		unlink(LAYOUT_OUT);
+		return;
+	}
+	unlink(LAYOUT_OUT);
+	parse_dies(dump, &dies);
+	free(dump);
+
+	if ((die = find_type(&dies, type)))
+		print_layout(&dies, die, type);
+	else
+		WARNX("no struct, union, or class named \"%s\"", type);
+	free_dies(&dies);
+}
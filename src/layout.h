@@ -0,0 +1,51 @@
+/*
+ * layout.h - struct layout and cache line inspection from DWARF
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(LAYOUT_H)
+#define LAYOUT_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* cache line size boundaries are marked at */
+#define LAYOUT_LINE	64
+/* array dimensions kept per array type */
+#define LAYOUT_DIMS	8
+/* deepest debug information entry nesting tracked */
+#define LAYOUT_DEPTH	64
+
+/* debug information entry tags used for layouts */
+enum layout_tag {
+	TAG_OTHER, TAG_STRUCT, TAG_UNION, TAG_CLASS, TAG_MEMBER, TAG_INHERITANCE,
+	TAG_BASE, TAG_ENUM, TAG_POINTER, TAG_REFERENCE, TAG_TYPEDEF, TAG_QUALIFIER,
+	TAG_ARRAY, TAG_SUBRANGE, TAG_SUBROUTINE,
+};
+
+/* struct definition for one debug information entry */
+struct layout_die {
+	char *name;
+	enum layout_tag tag;
+	unsigned depth;
+	/* section offsets of the entry and its type */
+	size_t off, type;
+	/* SIZE_MAX when absent */
+	size_t byte_size, align, member_loc, bit_size, bit_off;
+	size_t dims[LAYOUT_DIMS], dim_cnt;
+	bool declaration, artificial, complex;
+};
+
+/* struct definition for the entries of one build */
+struct layout_list {
+	struct layout_die *list;
+	size_t cnt, max;
+	bool cxx;
+};
+
+/* prototypes */
+void layout_cmd(struct program *prog, char const *type);
+
+#endif /* !defined(LAYOUT_H) */
@@ -0,0 +1,305 @@
+/*
+ * matrix.c - compiler and flag matrix evaluation
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "compile.h"
+#include "jobs.h"
+#include "matrix.h"
+#include "parseopts.h"
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <sys/wait.h>
+
+/* compilers tried alongside the current one */
+static struct {
+	char const *cc, *other;
+} const partner_list[] = {
+	{"gcc", "clang"}, {"clang", "gcc"},
+	{"g++", "clang++"}, {"clang++", "g++"},
+	{"cc", "clang"}, {"c++", "clang++"},
+};
+static char *const default_opts[] = {"0", "2", "3"};
+
+extern char const *prologue, *cxx_prologue;
+
+/* split a comma separated list of values */
+static void parse_axis(char *val, struct matrix_axis *axis)
+{
+	char *saved;
+	axis->cnt = 0;
+	for (char *tok = strtok_r(val, ",", &saved); tok && axis->cnt < MATRIX_AXIS; tok = strtok_r(NULL, ",", &saved))
+		axis->list[axis->cnt++] = tok;
+}
+
+/* parse `-c<cc,...> -s<std,...> -O<level,...>` */
+static bool parse_args(char *args, struct matrix_axis *ccs, struct matrix_axis *stds, struct matrix_axis *opts)
+{
+	char *saved;
+	for (char *tok = strtok_r(args, " \t", &saved); tok; tok = strtok_r(NULL, " \t", &saved)) {
+		struct matrix_axis *axis;
+		if (tok[0] != '-' || !tok[1] || !tok[2])
+			return false;
+		switch (tok[1]) {
+		case 'c':
+			axis = ccs;
+			break;
+		case 's':
+			axis = stds;
+			break;
+		case 'O':
+			axis = opts;
+			break;
+		default:
+			return false;
+		}
+		parse_axis(tok + 2, axis);
+	}
+	return true;
+}
+
+/* the current compiler and its counterpart from the other family if installed */
+static void default_axes(struct program *prog, struct matrix_axis *ccs, struct matrix_axis *stds, struct matrix_axis *opts)
+{
+	struct stat st;
+
+	if (!ccs->cnt) {
+		ccs->list[ccs->cnt++] = prog->cc_list.list[0];
+		for (size_t i = 0; i < arr_len(partner_list); i++) {
+			if (!strcmp(prog->cc_list.list[0], partner_list[i].cc) && stat_path(partner_list[i].other, &st))
+				ccs->list[ccs->cnt++] = (char *)partner_list[i].other;
+		}
+	}
+	if (!stds->cnt) {
+		/* the selected standard, or the compiler default */
+		stds->list[stds->cnt++] = "";
+		for (size_t i = 1; i < prog->cc_list.cnt && prog->cc_list.list[i]; i++) {
+			if (!strncmp(prog->cc_list.list[i], "-std=", 5))
+				stds->list[0] = prog->cc_list.list[i] + 5;
+		}
+	}
+	if (!opts->cnt) {
+		for (size_t i = 0; i < arr_len(default_opts); i++)
+			opts->list[opts->cnt++] = default_opts[i];
+	}
+}
+
+/* the std module and template library were built by the session's compiler, so other ones go without */
+static bool foreign_cc(struct program *prog, struct matrix_job const *job)
+{
+	return strcmp(job->cc, prog->cc_list.list[0]);
+}
+
+/* the program with the textual C++ prologue, or `NULL` if it already uses it */
+static char *textual_src(struct program *prog)
+{
+	char *src;
+	char const *total = prog->src[1].total.buf;
+	if (!(prog->state_flags & CXX_FLAG) || prologue == cxx_prologue || strncmp(total, prologue, strlen(prologue)))
+		return NULL;
+	if (asprintf(&src, "%s%s", cxx_prologue, total + strlen(prologue)) == -1)
+		ERR("asprintf()");
+	return src;
+}
+
+/* the current arguments with the job's compiler, standard, and optimization level */
+static void job_args(struct program *prog, struct matrix_job const *job, struct str_list *args)
+{
+	size_t end = foreign_cc(prog, job) ? cache_args_start() : prog->cc_list.cnt;
+	init_str_list(args, (char *)job->cc);
+	for (size_t i = 1; i < end && prog->cc_list.list[i]; i++) {
+		char const *arg = prog->cc_list.list[i];
+		if (!strncmp(arg, "-O", 2) || !strncmp(arg, "-std=", 5))
+			continue;
+		append_str(args, (char *)arg, 0);
+	}
+	if (*job->std) {
+		append_str(args, (char *)job->std, 5);
+		memcpy(args->list[args->cnt - 1], "-std=", 5);
+	}
+	append_str(args, (char *)job->opt, 2);
+	memcpy(args->list[args->cnt - 1], "-O", 2);
+	append_str(args, NULL, 0);
+}
+
+/* fork a worker which compiles one configuration */
+static void start_job(struct program *prog, struct matrix_job *job, struct timespec *start, char const *text_src)
+{
+	struct str_list args;
+	char const *src = (text_src && foreign_cc(prog, job)) ? text_src : prog->src[1].total.buf;
+
+	job_args(prog, job, &args);
+	clock_gettime(CLOCK_MONOTONIC, start);
+	switch ((job->pid = fork())) {
+	/* error */
+	case -1:
+		ERR("error forking matrix worker");
+		break;
+
+	/* child */
+	case 0:
+		reset_handlers();
+		_exit(build_program(src, args.list, job->bin, NULL, false) & 0xff);
+		break;
+	}
+	free_str_list(&args);
+}
+
+/* compile every job, keeping `workers` compilers busy */
+static void build_jobs(struct program *prog, struct matrix_job *jobs, size_t cnt, size_t workers)
+{
+	struct timespec start[MATRIX_MAX];
+	size_t next = 0, running = 0;
+	char *text_src = textual_src(prog);
+
+	while (next < cnt || running) {
+		int status;
+		pid_t pid;
+		while (running < workers && next < cnt) {
+			start_job(prog, jobs + next, start + next, text_src);
+			next++, running++;
+		}
+		if ((pid = waitpid(-1, &status, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			WARN("waitpid()");
+			break;
+		}
+		/* background jobs are children too */
+		if (jobs_collect(pid, status))
+			continue;
+		for (size_t i = 0; i < next; i++) {
+			if (jobs[i].pid != pid)
+				continue;
+			jobs[i].cc_ms = elapsed_ms(start + i);
+			jobs[i].cc_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+			jobs[i].pid = 0;
+			running--;
+		}
+	}
+	free(text_src);
+}
+
+/* bytes of allocated sections stored in the file (text, data, and read-only data) */
+static size_t alloc_size(char const *path)
+{
+	int fd;
+	size_t size = 0;
+	Elf *elf;
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+
+	if (elf_version(EV_CURRENT) == EV_NONE || (fd = open(path, O_RDONLY|O_CLOEXEC)) == -1)
+		return 0;
+	if ((elf = elf_begin(fd, ELF_C_READ, NULL))) {
+		while ((scn = elf_nextscn(elf, scn))) {
+			if (gelf_getshdr(scn, &shdr) && (shdr.sh_flags & SHF_ALLOC) && shdr.sh_type != SHT_NOBITS)
+				size += shdr.sh_size;
+		}
+		elf_end(elf);
+	}
+	close(fd);
+	return size;
+}
+
+/* run each binary alone so the timings don't compete for cores */
+static void run_jobs(struct matrix_job *jobs, size_t cnt)
+{
+	for (size_t i = 0; i < cnt; i++) {
+		char *const args[] = {jobs[i].bin, NULL};
+		struct timespec start;
+		if (jobs[i].cc_status)
+			continue;
+		jobs[i].size = alloc_size(jobs[i].bin);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		jobs[i].run_status = run_cmd(args, &jobs[i].out, false);
+		jobs[i].run_ms = elapsed_ms(&start);
+		if (unlink(jobs[i].bin) == -1)
+			WARN("unable to remove %s", jobs[i].bin);
+	}
+}
+
+static void print_jobs(struct matrix_job const *jobs, size_t cnt)
+{
+	struct matrix_job const *ref = NULL;
+
+	fprintf(stdout, "%-10s %-10s %-4s %12s %10s %12s  %s\n", "compiler", "std", "opt", "compile", "size", "run", "output");
+	for (size_t i = 0; i < cnt; i++) {
+		struct matrix_job const *job = jobs + i;
+		char opt[16];
+		snprintf(opt, sizeof opt, "-O%s", job->opt);
+		fprintf(stdout, "%-10s %-10s %-4s ", job->cc, *job->std ? job->std : "default", opt);
+		if (job->cc_status) {
+			fprintf(stdout, "%12s %10s %12s  %s\n", "error", "-", "-", "-");
+			continue;
+		}
+		fprintf(stdout, "%10.1fms %9zuB %10.2fms  ", job->cc_ms, job->size, job->run_ms);
+		/* compare against the first configuration which built */
+		if (!ref) {
+			ref = job;
+			fputs("reference", stdout);
+		} else if (job->run_status == ref->run_status && !strcmp(job->out, ref->out)) {
+			fputs("same", stdout);
+		} else {
+			fputs("DIFFERS", stdout);
+		}
+		if (job->run_status)
+			fprintf(stdout, " (exit status %d)", job->run_status);
+		fputc('\n', stdout);
+	}
+}
+
+/* `;matrix [-c<cc,...>] [-s<std,...>] [-O<level,...>]` */
+void matrix_cmd(struct program *prog, char *args)
+{
+	struct matrix_axis ccs = {0}, stds = {0}, opts = {0};
+	struct matrix_job *jobs;
+	size_t cnt = 0;
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (!parse_args(args, &ccs, &stds, &opts)) {
+		WARNX("%s", "usage: ;matrix [-c<cc,...>] [-s<std,...>] [-O<level,...>]");
+		return;
+	}
+	default_axes(prog, &ccs, &stds, &opts);
+	xcalloc(&jobs, MATRIX_MAX, sizeof *jobs, "matrix_cmd()");
+	for (size_t i = 0; i < ccs.cnt; i++) {
+		for (size_t j = 0; j < stds.cnt; j++) {
+			for (size_t k = 0; k < opts.cnt; k++) {
+				struct matrix_job *job = jobs + cnt;
+				job->cc = ccs.list[i];
+				job->std = stds.list[j];
+				/* accept both `O2` and `2` */
+				job->opt = opts.list[k] + (opts.list[k][0] == 'O');
+				snprintf(job->bin, sizeof job->bin, "/tmp/cepl_matrix%zu", cnt);
+				cnt++;
+			}
+		}
+	}
+	if (workers < 1)
+		workers = 1;
+	if ((size_t)workers > cnt)
+		workers = cnt;
+
+	fprintf(stdout, "[matrix: %zu configurations built on %ld worker%s, run one at a time]\n",
+			cnt, workers, (workers == 1) ? "" : "s");
+	/* workers must not inherit unflushed output */
+	fflush(stdout);
+	build_jobs(prog, jobs, cnt, workers);
+	run_jobs(jobs, cnt);
+	print_jobs(jobs, cnt);
+
+	for (size_t i = 0; i < cnt; i++) {
+		free(jobs[i].out);
+		unlink(jobs[i].bin);
+	}
+	free(jobs);
+}
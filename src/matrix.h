@@ -0,0 +1,40 @@
+/*
+ * matrix.h - compiler and flag matrix evaluation
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(MATRIX_H)
+#define MATRIX_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* maximum values per axis */
+#define MATRIX_AXIS	8
+/* maximum number of configurations */
+#define MATRIX_MAX	(MATRIX_AXIS * MATRIX_AXIS * MATRIX_AXIS)
+
+/* struct definition for one compiler, standard, and optimization level */
+struct matrix_job {
+	char const *cc, *std, *opt;
+	char bin[32];
+	pid_t pid;
+	int cc_status, run_status;
+	double cc_ms, run_ms;
+	/* bytes loaded at run time */
+	size_t size;
+	char *out;
+};
+
+/* struct definition for the values of one axis */
+struct matrix_axis {
+	char *list[MATRIX_AXIS];
+	size_t cnt;
+};
+
+/* prototypes */
+void matrix_cmd(struct program *prog, char *args);
+
+#endif /* !defined(MATRIX_H) */
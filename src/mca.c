@@ -0,0 +1,127 @@
+/*
+ * mca.c - static throughput analysis with llvm-mca
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "compile.h"
+#include "mca.h"
+
+#define MCA_ASM		"/tmp/cepl_mca.s"
+#define MCA_REGION	"/tmp/cepl_mca_region.s"
+
+/* an LLVM tool such as `llvm-mca` or the newest `llvm-mca-<version>` in $PATH */
+bool find_llvm(char const *tool, char *name, size_t len)
+{
+	struct stat st;
+	snprintf(name, len, "%s", tool);
+	if (stat_path(name, &st))
+		return true;
+	for (int i = MCA_VERSION_MAX; i >= MCA_VERSION_MIN; i--) {
+		snprintf(name, len, "%s-%d", tool, i);
+		if (stat_path(name, &st))
+			return true;
+	}
+	return false;
+}
+
+/* copy the instructions between `# LLVM-MCA-BEGIN` and `# LLVM-MCA-END` markers, returning the region count */
+static size_t extract_regions(void)
+{
+	FILE *in, *out;
+	char *line = NULL;
+	size_t len = 0, cnt = 0;
+	bool in_region = false;
+
+	if (!(in = fopen(MCA_ASM, "rb"))) {
+		WARN("unable to open %s", MCA_ASM);
+		return 0;
+	}
+	if (!(out = fopen(MCA_REGION, "wb"))) {
+		WARN("unable to open %s", MCA_REGION);
+		fclose(in);
+		return 0;
+	}
+	while (getline(&line, &len, in) != -1) {
+		if (strstr(line, "LLVM-MCA-BEGIN")) {
+			in_region = true;
+			cnt++;
+		} else if (!in_region) {
+			continue;
+		} else if (strstr(line, "LLVM-MCA-END")) {
+			in_region = false;
+		} else if (line[0] == '#' || (line[0] == '\t' && line[1] == '.')) {
+			/* `#APP` and assembler directives */
+			continue;
+		}
+		fputs(line, out);
+	}
+	free(line);
+	fclose(in);
+	fclose(out);
+	return cnt;
+}
+
+/* `;mca [llvm-mca flags]`: predicted throughput of the marked regions next to a measured run */
+void mca_cmd(struct program *prog, char *args)
+{
+	char *const extra[] = {"-S", NULL};
+	char name[32], *out = NULL, *saved;
+	struct str_list mca_args, cc_args;
+	struct phase_usage const *usage;
+	bool has_cpu = false;
+	size_t cnt;
+	int status;
+
+	if (!find_llvm("llvm-mca", name, sizeof name)) {
+		fprintf(stdout, "%s\n", "[mca: llvm-mca not found in $PATH]");
+		return;
+	}
+	compile_only_args(prog->cc_list.list, &cc_args);
+	status = build_program(prog->src[1].total.buf, cc_args.list, MCA_ASM, extra, true);
+	free_str_list(&cc_args);
+	if (status) {
+		unlink(MCA_ASM);
+		return;
+	}
+	cnt = extract_regions();
+	unlink(MCA_ASM);
+	if (!cnt) {
+		fprintf(stdout, "%s\n", "[mca: no CEPL_MCA_BEGIN/CEPL_MCA_END region in the program]");
+		unlink(MCA_REGION);
+		return;
+	}
+
+	/* measure the real program first */
+	status = compile(prog->src[1].total.buf, prog->cc_list.list, true);
+	if (status)
+		fprintf(stdout, "[exit status: %d]\n", status);
+
+	init_str_list(&mca_args, name);
+	for (char *tok = strtok_r(args, " \t", &saved); tok; tok = strtok_r(NULL, " \t", &saved)) {
+		has_cpu |= !strncmp(tok, "-mcpu", 5);
+		append_str(&mca_args, tok, 0);
+	}
+	if (!has_cpu)
+		append_str(&mca_args, "-mcpu=native", 0);
+	append_str(&mca_args, "-bottleneck-analysis", 0);
+	append_str(&mca_args, MCA_REGION, 0);
+	append_str(&mca_args, NULL, 0);
+	if (!run_cmd(mca_args.list, &out, true) && out)
+		fputs(out, stdout);
+	free(out);
+	free_str_list(&mca_args);
+	unlink(MCA_REGION);
+
+	fprintf(stdout, "[mca: %zu region%s built with %s", cnt, (cnt == 1) ? "" : "s", opt_level(prog->cc_list.list));
+	if ((usage = get_phase(PHASE_RUN)))
+		fprintf(stdout, ", program measured at %.2fms wall, %.2fms user",
+				usage->wall_ms, usage->ru.ru_utime.tv_sec * 1e3 + usage->ru.ru_utime.tv_usec / 1e3);
+	fputs("]\n", stdout);
+}
@@ -0,0 +1,22 @@
+/*
+ * mca.h - static throughput analysis with llvm-mca
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(MCA_H)
+#define MCA_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* versioned LLVM tool names tried when the unversioned one is missing */
+#define MCA_VERSION_MAX	30
+#define MCA_VERSION_MIN	10
+
+/* prototypes */
+bool find_llvm(char const *tool, char *name, size_t len);
+void mca_cmd(struct program *prog, char *args);
+
+#endif /* !defined(MCA_H) */
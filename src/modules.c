@@ -0,0 +1,214 @@
+/*
+ * modules.c - cached C++ standard library module
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "compile.h"
+#include "modules.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+/* copy the compiler and every argument that affects the module interface */
+static void copy_flags(struct program *prog, struct str_list *args)
+{
+	init_str_list(args, prog->cc_list.list[0]);
+	for (size_t i = 1; i < prog->cc_list.cnt && prog->cc_list.list[i]; i++) {
+		char const *arg = prog->cc_list.list[i];
+		if (!strcmp(arg, "-") || !strncmp(arg, "-o", 2) || !strncmp(arg, "-x", 2)
+				|| !strncmp(arg, "-l", 2) || !strncmp(arg, "-L", 2))
+			continue;
+		append_str(args, arg, 0);
+	}
+}
+
+/* run an argument list and release it */
+static bool run_args(struct str_list *args)
+{
+	int ret;
+	append_str(args, NULL, 0);
+	ret = run_cmd(args->list, NULL, false);
+	free_str_list(args);
+	return !ret;
+}
+
+/* find the libc++ `std.cppm` source through `libc++.modules.json` */
+static char *find_std_cppm(char const *cc)
+{
+	char *args[] = {(char *)cc, "-stdlib=libc++", "-print-file-name=libc++.modules.json", NULL};
+	char *manifest = NULL, *json = NULL, *cppm = NULL, *cur;
+	struct stat st;
+	int fd = -1;
+
+	if (run_cmd(args, &manifest, false) || !manifest)
+		goto done;
+	manifest[strcspn(manifest, "\n")] = '\0';
+	/* the compiler echoes the bare name back if it can't find the file */
+	if (!strchr(manifest, '/') || (fd = open(manifest, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+		goto done;
+	xcalloc(&json, 1, st.st_size + 1, "find_std_cppm()");
+	if (read(fd, json, st.st_size) != st.st_size)
+		goto done;
+	/* paths are relative to the manifest directory */
+	for (cur = json; (cur = strstr(cur, "\"source-path\"")); cur++) {
+		char *start, *end;
+		if (!(start = strchr(cur + strlen("\"source-path\""), '"')) || !(end = strchr(++start, '"')))
+			break;
+		*end = '\0';
+		if (end - start >= 9 && !strcmp(end - 9, "/std.cppm")) {
+			if (asprintf(&cppm, "%s/%s", dirname(manifest), start) == -1)
+				ERR("asprintf()");
+			break;
+		}
+		cur = end;
+	}
+
+done:
+	if (fd != -1)
+		close(fd);
+	free(json);
+	free(manifest);
+	return cppm;
+}
+
+/* build `std.gcm` and `std.o` from libstdc++ `bits/std.cc` */
+static bool build_gcc(struct program *prog, char const *dir, struct str_list *extra, bool cached)
+{
+	FILE *mapper_file;
+	struct str_list args;
+	char *mapper, *buf;
+
+	if (asprintf(&mapper, "%s/mapper", dir) == -1)
+		ERR("asprintf()");
+	init_str_list(extra, "-fmodules");
+	if (asprintf(&buf, "-fmodule-mapper=%s", mapper) == -1)
+		ERR("asprintf()");
+	append_str(extra, buf, 0);
+	free(buf);
+	if (cached) {
+		free(mapper);
+		return true;
+	}
+
+	/* map the module name to a fixed interface file */
+	if (!(mapper_file = fopen(mapper, "wb"))) {
+		free(mapper);
+		return false;
+	}
+	fprintf(mapper_file, "std %s/std.gcm\n", dir);
+	fclose(mapper_file);
+	free(mapper);
+
+	copy_flags(prog, &args);
+	for (size_t i = 0; i < extra->cnt; i++)
+		append_str(&args, extra->list[i], 0);
+	append_str(&args, "-fsearch-include-path", 0);
+	append_str(&args, "-c", 0);
+	append_str(&args, "bits/std.cc", 0);
+	if (asprintf(&buf, "-o%s/std.o", dir) == -1)
+		ERR("asprintf()");
+	append_str(&args, buf, 0);
+	free(buf);
+	return run_args(&args);
+}
+
+/* build `std.pcm` and `std.o` from libc++ `std.cppm` */
+static bool build_clang(struct program *prog, char const *dir, struct str_list *extra, bool cached)
+{
+	struct str_list args;
+	char *cppm, *pcm, *buf;
+	bool ret;
+
+	if (asprintf(&pcm, "%s/std.pcm", dir) == -1)
+		ERR("asprintf()");
+	init_str_list(extra, "-stdlib=libc++");
+	if (asprintf(&buf, "-fmodule-file=std=%s", pcm) == -1)
+		ERR("asprintf()");
+	append_str(extra, buf, 0);
+	free(buf);
+	if (cached || !(cppm = find_std_cppm(prog->cc_list.list[0]))) {
+		free(pcm);
+		return cached;
+	}
+
+	/* precompile the interface */
+	copy_flags(prog, &args);
+	append_str(&args, "-stdlib=libc++", 0);
+	append_str(&args, "-Wno-reserved-module-identifier", 0);
+	append_str(&args, "--precompile", 0);
+	append_str(&args, "-xc++-module", 0);
+	append_str(&args, cppm, 0);
+	append_str(&args, pcm, 2);
+	memcpy(args.list[args.cnt - 1], "-o", 2);
+	if ((ret = run_args(&args))) {
+		/* then the object holding its initializers */
+		copy_flags(prog, &args);
+		append_str(&args, "-c", 0);
+		append_str(&args, pcm, 0);
+		if (asprintf(&buf, "-o%s/std.o", dir) == -1)
+			ERR("asprintf()");
+		append_str(&args, buf, 0);
+		free(buf);
+		ret = run_args(&args);
+	}
+
+	free(pcm);
+	free(cppm);
+	return ret;
+}
+
+/* append the arguments needed to `import std;`, building the module on first use */
+bool std_module_args(struct program *prog)
+{
+	struct str_list extra = {0};
+	char name[32], *dir, *path;
+	bool clang = strstr(prog->cc_list.list[0], "clang");
+	bool cached, ret = false;
+
+	snprintf(name, sizeof name, "modules/%016jx", (uintmax_t)cc_hash(prog));
+	if (!(dir = cache_dir(name)))
+		return false;
+	if (asprintf(&path, "%s/failed", dir) == -1)
+		ERR("asprintf()");
+	/* don't retry a compiler that already failed with these flags */
+	if (path_exists(path))
+		goto done;
+
+	/* the object is written last, so its presence marks a complete build */
+	free(path);
+	if (asprintf(&path, "%s/std.o", dir) == -1)
+		ERR("asprintf()");
+	cached = path_exists(path);
+	trace_instant(cached ? "std module cache hit" : "std module cache miss", "cache");
+	if (!(ret = clang ? build_clang(prog, dir, &extra, cached) : build_gcc(prog, dir, &extra, cached))) {
+		int fd;
+		WARNX("%s", "unable to build the std module, falling back to textual includes");
+		free(path);
+		if (asprintf(&path, "%s/failed", dir) == -1)
+			ERR("asprintf()");
+		if ((fd = open(path, O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR)) != -1)
+			close(fd);
+		goto done;
+	}
+
+	for (size_t i = 0; i < extra.cnt; i++)
+		append_str(&prog->cc_list, extra.list[i], 0);
+	/* objects after `-xnone` so they aren't read as c++ source */
+	append_str(&prog->cc_list, "-xnone", 0);
+	append_str(&prog->cc_list, path, 0);
+
+done:
+	if (extra.list)
+		free_str_list(&extra);
+	free(path);
+	free(dir);
+	return ret;
+}
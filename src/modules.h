@@ -0,0 +1,17 @@
+/*
+ * modules.h - cached C++ standard library module
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(MODULES_H)
+#define MODULES_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* prototypes */
+bool std_module_args(struct program *prog);
+
+#endif /* !defined(MODULES_H) */
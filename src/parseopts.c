@@ -9,37 +9,68 @@
 #undef _GNU_SOURCE
 #define _GNU_SOURCE
 
+#include "compile.h"
 #include "hist.h"
+#include "modules.h"
 #include "parseopts.h"
 #include "readline.h"
+#include "templates.h"
+#include "trace.h"
 #include <getopt.h>
 #include <limits.h>
 
 /* globals */
 static struct option long_opts[] = {
 	{"asm", required_argument, 0, 'a'},
+	{"backend", required_argument, 0, 'b'},
 	{"compiler", required_argument, 0, 'c'},
 	{"eval", required_argument, 0, 'e'},
 	{"help", no_argument, 0, 'h'},
+	{"modules", no_argument, 0, 'M'},
 	{"output", required_argument, 0, 'o'},
 	{"parse", no_argument, 0, 'p'},
+	{"profile", required_argument, 0, 'P'},
 	{"std", required_argument , 0, 's'},
+	{"templates", no_argument, 0, 'T'},
+	{"trace", required_argument, 0, 't'},
 	{"version", no_argument, 0, 'v'},
 	{"warnings", no_argument, 0, 'w'},
 	{0}
 };
 static char *const cc_arg_list[] = {
-	"-g3", "-O0", "-pipe",
 	"-xc", "-",
 	"-o/tmp/cepl_program",
 	NULL
 };
 static char *const ccxx_arg_list[] = {
-	"-g3", "-O0", "-pipe",
 	"-xc++", "-",
 	"-o/tmp/cepl_program",
 	NULL
 };
+static char *const debug_flags[] = {
+	"-g3", "-O0", "-pipe",
+	NULL
+};
+static char *const fast_flags[] = {
+	"-g0", "-O0", "-pipe",
+	NULL
+};
+static char *const perf_flags[] = {
+	"-g", "-O3", "-march=native",
+	"-fno-omit-frame-pointer", "-pipe",
+	NULL
+};
+/* named build profiles (the first entry is the default) */
+static struct profile const profile_list[] = {
+	{"debug", "full debug information, no optimization", debug_flags},
+	{"fast", "no debug information for the lowest edit latency", fast_flags},
+	{"perf", "optimized for this CPU, keeping frame pointers for profilers", perf_flags},
+};
+static struct profile const *cur_profile = profile_list;
+/* position and length of the profile flags in `prog->cc_list` */
+static size_t profile_off, profile_cnt;
+/* start of the C++ cache arguments in `prog->cc_list` */
+static size_t cache_off;
 static char *const warn_list[] = {
 	"-Wall", "-Wextra",
 	"-pedantic",
@@ -207,6 +238,9 @@ static inline void build_arg_list(struct program *prog, char *const *cc_list)
 	/* default to gcc as a compiler */
 	if (!prog->cc_list.list[0][0])
 		strmv(0, prog->cc_list.list[0], "gcc");
+	profile_off = prog->cc_list.cnt;
+	for (profile_cnt = 0; cur_profile->flags[profile_cnt]; profile_cnt++)
+		append_str(&prog->cc_list, cur_profile->flags[profile_cnt], 0);
 	append_arg_list(prog, cc_list, NULL);
 
 	/* parse CFLAGS, LDFLAGS, LDLIBS, and LIBS from the environment */
@@ -229,11 +263,97 @@ static inline void build_arg_list(struct program *prog, char *const *cc_list)
 	free(ldlibs);
 	free(libs);
 
-	/* NULL-terminate lists */
-	append_str(&prog->cc_list, NULL, 0);
+	/* NULL-terminate library list (cc_list is terminated by `parse_opts()`) */
 	append_str(&prog->lib_list, NULL, 0);
 }
 
+static inline void append_cache_args(struct program *prog)
+{
+	cache_off = prog->cc_list.cnt;
+	if (!(prog->state_flags & CXX_FLAG))
+		return;
+	/* fall back to the textual prologue if the module can't be built */
+	if ((prog->state_flags & MODULE_FLAG) && !std_module_args(prog))
+		prog->state_flags &= ~MODULE_FLAG;
+	if ((prog->state_flags & TEMPLATE_FLAG) && !extern_template_args(prog))
+		prog->state_flags &= ~TEMPLATE_FLAG;
+}
+
+static inline struct profile const *find_profile(char const *name)
+{
+	for (size_t i = 0; i < arr_len(profile_list); i++) {
+		if (!strcmp(name, profile_list[i].name))
+			return profile_list + i;
+	}
+	return NULL;
+}
+
+static inline void copy_profile(void)
+{
+	if (!(cur_profile = find_profile(optarg)))
+		ERRX("unknown profile \"%s\"", optarg);
+}
+
+/* index of the first C++ cache argument in `prog->cc_list` */
+size_t cache_args_start(void)
+{
+	return cache_off;
+}
+
+/* swap the profile slice of `prog->cc_list` and rebuild cached arguments */
+static void apply_profile(struct program *prog, struct profile const *next)
+{
+	struct str_list new_list;
+	size_t old_cnt = profile_cnt;
+
+	init_str_list(&new_list, prog->cc_list.list[0]);
+	for (size_t i = 1; i < profile_off; i++)
+		append_str(&new_list, prog->cc_list.list[i], 0);
+	for (profile_cnt = 0; next->flags[profile_cnt]; profile_cnt++)
+		append_str(&new_list, next->flags[profile_cnt], 0);
+	/* drop the cache arguments, they depend on the profile and are rebuilt below */
+	for (size_t i = profile_off + old_cnt; i < cache_off; i++)
+		append_str(&new_list, prog->cc_list.list[i], 0);
+	free_str_list(&prog->cc_list);
+	prog->cc_list = new_list;
+	cur_profile = next;
+	append_cache_args(prog);
+	append_str(&prog->cc_list, NULL, 0);
+}
+
+/* switch build profiles without a full `parse_opts()` */
+bool set_profile(struct program *prog, char const *name)
+{
+	struct profile const *next = find_profile(name), *prev = cur_profile;
+	unsigned int cache_flags = prog->state_flags & (MODULE_FLAG|TEMPLATE_FLAG);
+
+	if (!next) {
+		WARNX("unknown profile \"%s\"", name);
+		return false;
+	}
+	apply_profile(prog, next);
+	/* the prologue was chosen for the old cache state, so switch back on a mismatch */
+	if ((prog->state_flags & (MODULE_FLAG|TEMPLATE_FLAG)) != cache_flags) {
+		WARNX("cached C++ arguments unavailable with profile \"%s\"", name);
+		prog->state_flags |= cache_flags;
+		apply_profile(prog, prev);
+		return false;
+	}
+	return true;
+}
+
+/* print available profiles and their flags */
+void list_profiles(void)
+{
+	for (size_t i = 0; i < arr_len(profile_list); i++) {
+		struct profile const *cur = profile_list + i;
+		fprintf(stdout, "%c %-6s %-62s [", (cur == cur_profile) ? '*' : ' ', cur->name, cur->desc);
+		for (size_t j = 0; cur->flags[j]; j++)
+			fprintf(stdout, j ? " %s" : "%s", cur->flags[j]);
+		fprintf(stdout, "]\n");
+	}
+}
+
 static inline void build_sym_list(struct program *prog)
 {
 	/* parse ELF shared libraries for completions */
@@ -317,6 +437,8 @@ char **parse_opts(struct program *prog, int argc, char **argv, char const *optst
 	free_str_list(&prog->cc_list);
 	free_str_list(&prog->lib_list);
 	free_str_list(&comp_list);
+	free(prog->tmpl_decls);
+	prog->tmpl_decls = NULL;
 	prog->cc_list.cnt = 0;
 	prog->cc_list.max = 1;
 	/* don't print an error if option not found */
@@ -330,6 +452,9 @@ char **parse_opts(struct program *prog, int argc, char **argv, char const *optst
 	init_str_list(&prog->lib_list, NULL);
 	/* re-zero prog->cc_list.list[0] so -c argument can be added */
 	memset(prog->cc_list.list[0], 0, strlen(prog->cc_list.list[0]) + 1);
+	/* reset to the exact backend and default profile */
+	set_backend(NULL);
+	cur_profile = profile_list;
 
 	while ((opt = getopt_long(argc, argv, optstring, long_opts, &option_index)) != -1) {
 		switch (opt) {
@@ -337,6 +462,11 @@ char **parse_opts(struct program *prog, int argc, char **argv, char const *optst
 		case 'a':
 			copy_asm_file(prog, &asm_name);
 			break;
+		/* compile backend */
+		case 'b':
+			set_backend(optarg);
+			break;
+
 		/* specify compiler */
 		case 'c':
 			copy_compiler(prog);
@@ -367,11 +497,31 @@ char **parse_opts(struct program *prog, int argc, char **argv, char const *optst
 			copy_std(prog);
 			break;
 
+		/* c++ modules flag */
+		case 'M':
+			prog->state_flags |= MODULE_FLAG;
+			break;
+
+		/* extern template flag */
+		case 'T':
+			prog->state_flags |= TEMPLATE_FLAG;
+			break;
+
+		/* trace event file */
+		case 't':
+			trace_open(optarg);
+			break;
+
 		/* output file flag */
 		case 'o':
 			copy_out_file(prog, &out_name);
 			break;
 
+		/* build profile */
+		case 'P':
+			copy_profile();
+			break;
+
 		/* parse flag */
 		case 'p':
 			prog->state_flags &= ~PARSE_FLAG;
@@ -417,6 +567,8 @@ char **parse_opts(struct program *prog, int argc, char **argv, char const *optst
 		}
 		build_arg_list(prog, cc_arg_list);
 	}
+	append_cache_args(prog);
+	append_str(&prog->cc_list, NULL, 0);
 	build_sym_list(prog);
 
 #ifdef _DEBUG
@@ -21,9 +21,18 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+/* struct definition for named build profiles */
+struct profile {
+	char const *name, *desc;
+	char *const *flags;
+};
+
 /* prototypes */
 void read_syms(struct str_list *tokens, char const *elf_file);
 void parse_libs(struct str_list *symbols, char **libs);
+size_t cache_args_start(void);
+bool set_profile(struct program *prog, char const *name);
+void list_profiles(void);
 char **parse_opts(struct program *prog, int argc, char **argv, char const *optstring);
 
 #endif /* !defined(PARSEOPTS_H) */
@@ -0,0 +1,236 @@
+/*
+ * perf.c - hardware performance counters
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "perf.h"
+#include <fcntl.h>
+
+#define CACHE_EVENT(cache, op, result) \
+	((cache) | ((op) << 8) | ((result) << 16))
+
+/* hardware events, in two groups so each fits the general purpose counters */
+static struct perf_event const hw_list[] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0},
+	{"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, 0},
+	{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 0},
+	{"L1d-loads", PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS), 4},
+	{"L1d-misses", PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 4},
+	{"LLC-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, 4},
+	{"LLC-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 4},
+	{0},
+};
+/* fallback when there is no PMU (e.g. most virtual machines) */
+static struct perf_event const sw_list[] = {
+	{"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, 0},
+	{"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 0},
+	{"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, 0},
+	{"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, 0},
+	{0},
+};
+static bool perf_on = false;
+
+bool perf_mode(void)
+{
+	return perf_on;
+}
+
+/* `;perf [on|off]`, toggling without an argument */
+void set_perf(char const *mode)
+{
+	if (!*mode)
+		perf_on = !perf_on;
+	else if (!strcmp(mode, "on"))
+		perf_on = true;
+	else if (!strcmp(mode, "off"))
+		perf_on = false;
+	else
+		WARNX("unknown perf mode \"%s\"", mode);
+	fprintf(stdout, "[perf counters %s]\n", perf_on ? "on" : "off");
+}
+
+/* explain why counters can't be opened */
+static void perf_unavailable(int err)
+{
+	char buf[16] = "?";
+	FILE *file;
+	if ((file = fopen("/proc/sys/kernel/perf_event_paranoid", "rb"))) {
+		if (!fgets(buf, sizeof buf, file))
+			strmv(0, buf, "?");
+		buf[strcspn(buf, "\n")] = '\0';
+		fclose(file);
+	}
+	if (err == EACCES || err == EPERM)
+		fprintf(stdout, "[perf: access denied (perf_event_paranoid is %s)]\n", buf);
+	else
+		fprintf(stdout, "[perf: counters unavailable (%s)]\n", strerror(err));
+}
+
+static size_t open_list(struct perf_counters *ctr, struct perf_event const *list, pid_t pid, bool on_exec, int *err)
+{
+	ctr->events = list;
+	ctr->cnt = 0;
+	for (size_t i = 0; list[i].name && i < arr_len(ctr->fd); i++) {
+		struct perf_event_attr attr = {
+			.size = sizeof attr,
+			.type = list[i].type,
+			.config = list[i].config,
+			.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+			.inherit = 1,
+			.exclude_kernel = 1,
+			.exclude_hv = 1,
+		};
+		int group = (list[i].leader == i) ? -1 : ctr->fd[list[i].leader];
+		/* leaders start the group when the child calls `execve()` */
+		if (list[i].leader == i) {
+			attr.disabled = on_exec;
+			attr.enable_on_exec = on_exec;
+		}
+		ctr->fd[i] = (list[i].leader == i || group != -1) ? perf_event_open(&attr, pid, -1, group, PERF_FLAG_FD_CLOEXEC) : -1;
+		if (ctr->fd[i] == -1 && !*err)
+			*err = errno;
+		ctr->cnt++;
+	}
+	/* count how many events opened */
+	size_t opened = 0;
+	for (size_t i = 0; i < ctr->cnt; i++)
+		opened += ctr->fd[i] != -1;
+	return opened;
+}
+
+static void close_counters(struct perf_counters *ctr)
+{
+	for (size_t i = 0; i < ctr->cnt; i++) {
+		if (ctr->fd[i] != -1)
+			close(ctr->fd[i]);
+		ctr->fd[i] = -1;
+	}
+}
+
+/* open counters on a child which is blocked until the caller releases it */
+bool perf_open(struct perf_counters *ctr, pid_t pid, bool on_exec)
+{
+	int err = 0;
+	if (open_list(ctr, hw_list, pid, on_exec, &err))
+		return true;
+	close_counters(ctr);
+	/* permission errors apply to software events as well */
+	if (err == EACCES || err == EPERM) {
+		perf_unavailable(err);
+		ctr->cnt = 0;
+		return false;
+	}
+	if (open_list(ctr, sw_list, pid, on_exec, &err))
+		return true;
+	close_counters(ctr);
+	perf_unavailable(err);
+	ctr->cnt = 0;
+	return false;
+}
+
+/* create the pipe a child blocks on until its counters are open */
+void perf_sync_init(int sync_fd[static 2])
+{
+	sync_fd[0] = sync_fd[1] = -1;
+	if (perf_on && pipe2(sync_fd, O_CLOEXEC) == -1)
+		ERR("error making sync_fd pipe");
+}
+
+/* block the child until the parent has attached counters */
+void perf_sync_child(int sync_fd[static 2])
+{
+	char buf;
+	if (sync_fd[0] == -1)
+		return;
+	close(sync_fd[1]);
+	while (read(sync_fd[0], &buf, 1) == -1 && errno == EINTR);
+	close(sync_fd[0]);
+}
+
+/* attach counters to the child and release it */
+void perf_sync_parent(struct perf_counters *ctr, int sync_fd[static 2], pid_t pid, bool on_exec)
+{
+	ctr->cnt = 0;
+	if (sync_fd[0] == -1)
+		return;
+	perf_open(ctr, pid, on_exec);
+	close(sync_fd[0]);
+	close(sync_fd[1]);
+}
+
+/* value of event `name`, or `false` if it wasn't counted */
+static bool event_value(struct perf_counters const *ctr, char const *name, double *value)
+{
+	for (size_t i = 0; i < ctr->cnt; i++) {
+		if (ctr->fd[i] != -1 && !strcmp(ctr->events[i].name, name)) {
+			*value = ctr->value[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+/* print a ratio of two events if both were counted */
+static void print_ratio(struct perf_counters const *ctr, char const *label, char const *num, char const *den, double scale, char const *unit)
+{
+	double x, y;
+	if (event_value(ctr, num, &x) && event_value(ctr, den, &y) && y > 0)
+		fprintf(stdout, ", %s %.2f%s", label, x / y * scale, unit);
+}
+
+/* read, print, and close counters after the child exits */
+void perf_report(struct perf_counters *ctr)
+{
+	bool first = true, scaled = false;
+
+	if (!ctr->cnt)
+		return;
+	for (size_t i = 0; i < ctr->cnt; i++) {
+		uint64_t buf[3];
+		if (ctr->fd[i] == -1)
+			continue;
+		if (read(ctr->fd[i], buf, sizeof buf) != sizeof buf) {
+			close(ctr->fd[i]);
+			ctr->fd[i] = -1;
+			continue;
+		}
+		/* scale multiplexed counts by enabled/running time */
+		ctr->value[i] = buf[0];
+		ctr->scaled[i] = buf[2] && buf[2] < buf[1];
+		if (ctr->scaled[i]) {
+			ctr->value[i] = (double)buf[0] * buf[1] / buf[2];
+			scaled = true;
+		}
+	}
+
+	fputs("[perf: ", stdout);
+	for (size_t i = 0; i < ctr->cnt; i++) {
+		if (ctr->fd[i] == -1)
+			continue;
+		if (ctr->events == sw_list && !strcmp(ctr->events[i].name, "task-clock"))
+			fprintf(stdout, "%s%s %.3fms", first ? "" : ", ", ctr->events[i].name, ctr->value[i] / 1e6);
+		else
+			fprintf(stdout, "%s%s %ju", first ? "" : ", ", ctr->events[i].name, (uintmax_t)ctr->value[i]);
+		first = false;
+	}
+	print_ratio(ctr, "IPC", "instructions", "cycles", 1, "");
+	print_ratio(ctr, "branch miss rate", "branch-misses", "branches", 100, "%");
+	print_ratio(ctr, "L1d miss rate", "L1d-misses", "L1d-loads", 100, "%");
+	print_ratio(ctr, "LLC miss rate", "LLC-misses", "LLC-references", 100, "%");
+	if (ctr->events == sw_list)
+		fputs(", no hardware counters", stdout);
+	if (scaled)
+		fputs(", scaled for multiplexing", stdout);
+	fputs("]\n", stdout);
+	close_counters(ctr);
+	ctr->cnt = 0;
+}
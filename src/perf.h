@@ -0,0 +1,48 @@
+/*
+ * perf.h - hardware performance counters
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(PERF_H)
+#define PERF_H 1
+
+#include "defs.h"
+#include "errs.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+/* struct definition for an event to count */
+struct perf_event {
+	char const *name;
+	uint32_t type;
+	uint64_t config;
+	/* index of the group leader */
+	size_t leader;
+};
+
+/* struct definition for open counters on a child */
+struct perf_counters {
+	int fd[16];
+	uint64_t value[16];
+	bool scaled[16];
+	size_t cnt;
+	struct perf_event const *events;
+};
+
+/* prototypes */
+bool perf_mode(void);
+void set_perf(char const *mode);
+bool perf_open(struct perf_counters *ctr, pid_t pid, bool on_exec);
+void perf_sync_init(int sync_fd[static 2]);
+void perf_sync_child(int sync_fd[static 2]);
+void perf_sync_parent(struct perf_counters *ctr, int sync_fd[static 2], pid_t pid, bool on_exec);
+void perf_report(struct perf_counters *ctr);
+
+static inline long perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags)
+{
+	return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+#endif /* !defined(PERF_H) */
@@ -0,0 +1,236 @@
+/*
+ * pgo.c - profile-guided optimization of the current program
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "mca.h"
+#include "pgo.h"
+#include "size.h"
+#include <ftw.h>
+#include <glob.h>
+
+/* profile data files written by the training run */
+static size_t profile_cnt;
+
+static int count_profile(char const *path, struct stat const *st, int type, struct FTW *ftw)
+{
+	size_t len = strlen(path);
+	(void)st, (void)ftw;
+	if (type == FTW_F && ((len > 5 && !strcmp(path + len - 5, ".gcda")) || (len > 8 && !strcmp(path + len - 8, ".profraw"))))
+		profile_cnt++;
+	return 0;
+}
+
+static int remove_entry(char const *path, struct stat const *st, int type, struct FTW *ftw)
+{
+	(void)st, (void)type, (void)ftw;
+	if (remove(path) == -1)
+		WARN("unable to remove %s", path);
+	return 0;
+}
+
+/* the current arguments followed by `extra` */
+static void pgo_args(char *const cc_args[], char *const extra[], struct str_list *args)
+{
+	init_str_list(args, cc_args[0]);
+	for (size_t i = 1; cc_args[i]; i++)
+		append_str(args, cc_args[i], 0);
+	for (size_t i = 0; extra[i]; i++)
+		append_str(args, extra[i], 0);
+	append_str(args, NULL, 0);
+}
+
+/* merge clang's raw profiles into `<dir>/default.profdata` */
+static bool merge_profiles(char const *dir)
+{
+	struct str_list args;
+	char tool[32], *pattern, *out;
+	glob_t raw;
+	int status;
+
+	if (!find_llvm("llvm-profdata", tool, sizeof tool)) {
+		WARNX("%s", "llvm-profdata not found in $PATH");
+		return false;
+	}
+	if (asprintf(&pattern, "%s/*.profraw", dir) == -1 || asprintf(&out, "-o=%s/default.profdata", dir) == -1)
+		ERR("asprintf()");
+	if (glob(pattern, 0, NULL, &raw)) {
+		free(pattern);
+		free(out);
+		return false;
+	}
+	init_str_list(&args, tool);
+	append_str(&args, "merge", 0);
+	append_str(&args, out, 0);
+	for (size_t i = 0; i < raw.gl_pathc; i++)
+		append_str(&args, raw.gl_pathv[i], 0);
+	append_str(&args, NULL, 0);
+	status = run_cmd(args.list, NULL, true);
+	free_str_list(&args);
+	globfree(&raw);
+	free(pattern);
+	free(out);
+	return !status;
+}
+
+/* run the binaries in turn so both see the same conditions */
+static void time_builds(char *const bins[2])
+{
+	static char const *const names[] = {"plain", "pgo"};
+	double ms[2][PGO_RUNS], median[2];
+	int status[2] = {0};
+
+	for (size_t i = 0; i < PGO_RUNS; i++) {
+		for (size_t j = 0; j < 2; j++) {
+			char *const args[] = {bins[j], NULL};
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			status[j] |= run_cmd(args, NULL, false);
+			ms[j][i] = elapsed_ms(&start);
+		}
+	}
+	for (size_t j = 0; j < 2; j++) {
+		qsort(ms[j], PGO_RUNS, sizeof *ms[j], cmp_double);
+		median[j] = ms[j][PGO_RUNS / 2];
+		fprintf(stdout, "%-6s %10.2fms median %10.2fms min", names[j], median[j], ms[j][0]);
+		if (status[j])
+			fputs(" (non-zero exit status)", stdout);
+		fputc('\n', stdout);
+	}
+	if (median[1] > 0)
+		fprintf(stdout, "speedup %.2fx over %d runs each\n", median[0] / median[1], PGO_RUNS);
+}
+
+static int cmp_change(void const *a, void const *b)
+{
+	struct pgo_change const *x = a, *y = b;
+	size_t dx = (x->plain == SIZE_MAX) ? x->pgo : (x->pgo == SIZE_MAX) ? x->plain
+		: (x->plain > x->pgo) ? x->plain - x->pgo : x->pgo - x->plain;
+	size_t dy = (y->plain == SIZE_MAX) ? y->pgo : (y->pgo == SIZE_MAX) ? y->plain
+		: (y->plain > y->pgo) ? y->plain - y->pgo : y->pgo - y->plain;
+	return (dx < dy) - (dx > dy);
+}
+
+static void print_size(size_t size)
+{
+	if (size == SIZE_MAX)
+		fprintf(stdout, "%8s", "-");
+	else
+		fprintf(stdout, "%8zu", size);
+}
+
+/* functions whose size differs, or which only one build has (inlined, split into `.cold` parts) */
+static size_t diff_funcs(char *const bins[2])
+{
+	struct size_func_list plain = {0}, pgo = {0};
+	struct pgo_change *changes;
+	size_t cnt = 0;
+
+	if (!read_funcs(bins[0], &plain) || !read_funcs(bins[1], &pgo)) {
+		WARNX("%s", "unable to read the function symbols");
+		free_funcs(&plain);
+		free_funcs(&pgo);
+		return 0;
+	}
+	xcalloc(&changes, plain.cnt + pgo.cnt + 1, sizeof *changes, "diff_funcs()");
+	for (size_t i = 0; i < plain.cnt; i++) {
+		size_t size = SIZE_MAX;
+		for (size_t j = 0; j < pgo.cnt; j++) {
+			if (!strcmp(plain.list[i].name, pgo.list[j].name))
+				size = pgo.list[j].size;
+		}
+		if (size != plain.list[i].size)
+			changes[cnt++] = (struct pgo_change){plain.list[i].name, plain.list[i].size, size};
+	}
+	for (size_t j = 0; j < pgo.cnt; j++) {
+		bool found = false;
+		for (size_t i = 0; i < plain.cnt && !found; i++)
+			found = !strcmp(plain.list[i].name, pgo.list[j].name);
+		if (!found)
+			changes[cnt++] = (struct pgo_change){pgo.list[j].name, SIZE_MAX, pgo.list[j].size};
+	}
+	qsort(changes, cnt, sizeof *changes, cmp_change);
+
+	if (cnt)
+		fprintf(stdout, "%8s %8s  %s\n", "plain", "pgo", "function");
+	for (size_t i = 0; i < cnt && i < PGO_FUNCS; i++) {
+		print_size(changes[i].plain);
+		fputc(' ', stdout);
+		print_size(changes[i].pgo);
+		fprintf(stdout, "  %.100s\n", changes[i].name);
+	}
+	if (cnt > PGO_FUNCS)
+		fprintf(stdout, "%17s  (%zu more)\n", "", cnt - PGO_FUNCS);
+	free(changes);
+	free_funcs(&plain);
+	free_funcs(&pgo);
+	return cnt;
+}
+
+/* `;pgo`: train, rebuild with the profile, and compare against the plain build */
+void pgo_cmd(struct program *prog)
+{
+	char dir[] = "/tmp/cepl_pgo-XXXXXX", *gen_flag, *use_flag, *base, *bins[2];
+	char *gen_extra[] = {NULL, "-dumpbase", NULL, NULL}, *use_extra[] = {NULL, "-dumpbase", NULL, NULL};
+	char const *cc = prog->cc_list.list[0], *opt = opt_level(prog->cc_list.list);
+	bool clang = strstr(cc, "clang");
+	struct str_list args;
+	size_t changed;
+	int status;
+
+	if (!mkdtemp(dir)) {
+		WARN("%s", "mkdtemp()");
+		return;
+	}
+	if (asprintf(&gen_flag, "-fprofile-generate=%s", dir) == -1
+			|| asprintf(&use_flag, clang ? "-fprofile-use=%s/default.profdata" : "-fprofile-use=%s", dir) == -1
+			|| asprintf(&base, "%s/program", dir) == -1
+			|| asprintf(&bins[0], "%s/plain", dir) == -1
+			|| asprintf(&bins[1], "%s/pgo", dir) == -1)
+		ERR("asprintf()");
+
+	/* gcc names the profile after the output file unless both builds share a dump base */
+	gen_extra[0] = gen_flag, use_extra[0] = use_flag;
+	gen_extra[2] = use_extra[2] = base;
+	if (clang)
+		gen_extra[1] = use_extra[1] = NULL;
+	pgo_args(prog->cc_list.list, gen_extra, &args);
+	fprintf(stdout, "[pgo: training run with %s]\n", gen_flag);
+	fflush(stdout);
+	status = compile(prog->src[1].total.buf, args.list, true);
+	free_str_list(&args);
+	profile_cnt = 0;
+	nftw(dir, count_profile, 16, FTW_PHYS);
+	if (!get_phase(PHASE_RUN) || !profile_cnt) {
+		fprintf(stdout, "%s\n", "[pgo: the training run wrote no profile]");
+		goto done;
+	}
+	if (status)
+		fprintf(stdout, "[pgo: training run exited with status %d, using its profile anyway]\n", status);
+	if (clang && !merge_profiles(dir))
+		goto done;
+
+	if (build_program(prog->src[1].total.buf, prog->cc_list.list, bins[0], NULL, true)
+			|| build_program(prog->src[1].total.buf, prog->cc_list.list, bins[1], use_extra, true))
+		goto done;
+	time_builds(bins);
+	changed = diff_funcs(bins);
+	if (!strcmp(opt, "-O0"))
+		fprintf(stdout, "%s\n", "[pgo: built with -O0, which ignores most of the profile; try ;profile perf]");
+	fprintf(stdout, "[pgo: %s %s, %zu function%s changed]\n", cc, opt, changed, (changed == 1) ? "" : "s");
+
+done:
+	nftw(dir, remove_entry, 16, FTW_DEPTH|FTW_PHYS);
+	free(gen_flag);
+	free(use_flag);
+	free(base);
+	free(bins[0]);
+	free(bins[1]);
+}
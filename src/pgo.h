@@ -0,0 +1,29 @@
+/*
+ * pgo.h - profile-guided optimization of the current program
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(PGO_H)
+#define PGO_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* alternating timed runs of each binary */
+#define PGO_RUNS	5
+/* number of changed functions listed */
+#define PGO_FUNCS	16
+
+/* struct definition for a function whose code differs between the builds */
+struct pgo_change {
+	char const *name;
+	/* SIZE_MAX when missing from a build */
+	size_t plain, pgo;
+};
+
+/* prototypes */
+void pgo_cmd(struct program *prog);
+
+#endif /* !defined(PGO_H) */
@@ -25,9 +25,9 @@ char *comp_arg_list[] = {
 	"__attribute__(", "malloc(", "calloc(", "free(", "memcpy(",
 	"memset(", "memcmp(", "fread(", "fwrite(", "strcat(", "strtok(",
 	"strcpy(", "strlen(", "puts(", "system(", "fopen(", "fclose(",
-	"sprintf(", "printf(", "scanf(", ";att", ";help", ";intel",
-	";macro", ";output", ";parse", ";quit", ";reset",
-	";tracking", ";undo", ";warnings", "typeof(", NULL
+	"sprintf(", "printf(", "scanf(", ";asm", ";att", ";backend", ";bench", ";bg", ";cachesim", ";compare", ";ctime", ";data", ";fg", ";help", ";intel",
+	";jobs", ";kill", ";layout", ";macro", ";matrix", ";mca", ";output", ";parse", ";perf", ";pgo", ";profile", ";profile-run", ";quit", ";reset", ";scale", ";size", ";stats", ";syscalls",
+	";tracking", ";undo", ";vec", ";warnings", "typeof(", NULL
 };
 /* global completion list struct */
 struct str_list comp_list;
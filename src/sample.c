@@ -0,0 +1,334 @@
+/*
+ * sample.c - sampling profiler
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "perf.h"
+#include "sample.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SAMPLE_BIN	"/tmp/cepl_sample"
+
+extern char **environ;
+
+/* struct definition for per-entry sample counts */
+struct entry_cost {
+	size_t self, total;
+	/* last sample counted towards `total` */
+	size_t seen;
+};
+
+static void add_ip(struct sample_list *list, uint64_t ip)
+{
+	if (list->ips_cnt == list->ips_max)
+		xrealloc(&list->ips, sizeof *list->ips * (list->ips_max = list->ips_max ? list->ips_max * 2 : PAGE_SIZE), "add_ip()");
+	list->ips[list->ips_cnt++] = ip;
+}
+
+/* finish the current sample and start the next one */
+static void end_sample(struct sample_list *list)
+{
+	if (list->cnt + 2 > list->off_max)
+		xrealloc(&list->off, sizeof *list->off * (list->off_max = list->off_max ? list->off_max * 2 : PAGE_SIZE), "end_sample()");
+	list->off[++list->cnt] = list->ips_cnt;
+}
+
+/* copy `len` bytes at `pos` out of the ring buffer, which may wrap */
+static void ring_copy(void *dest, unsigned char const *data, uint64_t pos, size_t len)
+{
+	size_t size = SAMPLE_PAGES * PAGE_SIZE, start = pos % size;
+	size_t first = (len < size - start) ? len : size - start;
+	memcpy(dest, data + start, first);
+	memcpy((unsigned char *)dest + first, data, len - first);
+}
+
+/* consume every record the kernel has written so far */
+static void drain(struct perf_event_mmap_page *meta, struct sample_list *list)
+{
+	unsigned char const *data = (unsigned char const *)meta + PAGE_SIZE;
+	uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+	uint64_t tail = meta->data_tail;
+
+	while (tail < head) {
+		struct perf_event_header hdr;
+		/* ip, callchain length, and callchain */
+		uint64_t rec[SAMPLE_STACK + 16];
+		ring_copy(&hdr, data, tail, sizeof hdr);
+		if (hdr.size < sizeof hdr)
+			break;
+		size_t len = hdr.size - sizeof hdr;
+		if (len > sizeof rec)
+			len = sizeof rec;
+		ring_copy(rec, data, tail + sizeof hdr, len);
+		tail += hdr.size;
+
+		if (hdr.type == PERF_RECORD_LOST && len >= 2 * sizeof *rec) {
+			list->lost += rec[1];
+			continue;
+		}
+		if (hdr.type != PERF_RECORD_SAMPLE || len < 2 * sizeof *rec)
+			continue;
+		size_t nr = rec[1], depth = 0;
+		if (nr > len / sizeof *rec - 2)
+			nr = len / sizeof *rec - 2;
+		for (size_t i = 0; i < nr && depth < SAMPLE_STACK; i++) {
+			/* skip context markers */
+			if (rec[i + 2] >= PERF_CONTEXT_MAX)
+				continue;
+			/* return addresses point past the call */
+			add_ip(list, depth++ ? rec[i + 2] - 1 : rec[i + 2]);
+		}
+		if (!depth)
+			add_ip(list, rec[0]);
+		end_sample(list);
+	}
+	__atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+/* open a cpu clock sampler on a child which is blocked until the caller releases it */
+static int open_sampler(pid_t pid, struct perf_event_mmap_page **meta)
+{
+	int fd;
+	size_t len = (SAMPLE_PAGES + 1) * PAGE_SIZE;
+	struct perf_event_attr attr = {
+		.size = sizeof attr,
+		.type = PERF_TYPE_SOFTWARE,
+		.config = PERF_COUNT_SW_TASK_CLOCK,
+		.sample_period = SAMPLE_PERIOD,
+		.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_CALLCHAIN,
+		.disabled = 1,
+		.enable_on_exec = 1,
+		.exclude_kernel = 1,
+		.exclude_hv = 1,
+		.exclude_callchain_kernel = 1,
+		.watermark = 1,
+		.wakeup_watermark = SAMPLE_PAGES * PAGE_SIZE / 2,
+		.sample_max_stack = SAMPLE_STACK,
+	};
+
+	if ((fd = perf_event_open(&attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC)) == -1) {
+		fprintf(stdout, "[profile: unable to sample the program (%s)]\n", strerror(errno));
+		return -1;
+	}
+	if ((*meta = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fprintf(stdout, "[profile: unable to map the sample buffer (%s)]\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* run the profiling binary, collecting samples until it exits; `sampled` is false if sampling never started */
+static int sample_child(struct sample_list *list, bool *sampled)
+{
+	char *exec_args[] = {SAMPLE_BIN, NULL};
+	struct perf_event_mmap_page *meta = NULL;
+	int fd = -1, sync_fd[2];
+	pid_t pid;
+
+	if (pipe2(sync_fd, O_CLOEXEC) == -1)
+		ERR("error making sync_fd pipe");
+	switch ((pid = fork())) {
+	/* error */
+	case -1:
+		ERR("error forking executable");
+		break;
+
+	/* child */
+	case 0:
+		reset_handlers();
+		perf_sync_child(sync_fd);
+		execve(SAMPLE_BIN, exec_args, environ);
+		/* execve() should never return */
+		ERR("error forking executable");
+		break;
+
+	/* parent */
+	default:
+		close(sync_fd[0]);
+		fd = open_sampler(pid, &meta);
+		*sampled = fd != -1;
+		/* release the child */
+		close(sync_fd[1]);
+		for (;;) {
+			siginfo_t info = {0};
+			if (waitid(P_PID, pid, &info, WEXITED|WNOHANG|WNOWAIT) == -1 && errno != EINTR)
+				break;
+			if (fd != -1)
+				drain(meta, list);
+			if (info.si_pid)
+				break;
+			/* a negative descriptor makes this a plain 10ms sleep */
+			poll(&(struct pollfd){.fd = fd, .events = POLLIN}, 1, 10);
+		}
+		if (fd != -1) {
+			drain(meta, list);
+			munmap(meta, (SAMPLE_PAGES + 1) * PAGE_SIZE);
+			close(fd);
+		}
+	}
+
+	return wait_status(pid, "executable", true);
+}
+
+static int cmp_ip(void const *a, void const *b)
+{
+	uint64_t x = *(uint64_t const *)a, y = *(uint64_t const *)b;
+	return (x > y) - (x < y);
+}
+
+/* parse the entry index from an addr2line location inside the generated source */
+static bool parse_entry(char const *loc, size_t *entry)
+{
+	char const *name = strstr(loc, "<stdin>:");
+	if (!name || (name != loc && name[-1] != '/'))
+		return false;
+	errno = 0;
+	*entry = strtoull(name + strlen("<stdin>:"), NULL, 10);
+	return !errno && *entry;
+}
+
+/* map each unique address to the innermost entry it was generated from (0 if none) */
+static void resolve(uint64_t const *uniq, size_t *entries, size_t cnt)
+{
+	for (size_t base = 0; base < cnt; base += SAMPLE_BATCH) {
+		struct str_list args;
+		char *out = NULL, *line, *saved;
+		size_t end = (cnt - base < SAMPLE_BATCH) ? cnt : base + SAMPLE_BATCH, cur = base - 1;
+
+		init_str_list(&args, "addr2line");
+		append_str(&args, "-a", 0);
+		append_str(&args, "-i", 0);
+		append_str(&args, "-e", 0);
+		append_str(&args, SAMPLE_BIN, 0);
+		for (size_t i = base; i < end; i++) {
+			append_str(&args, "", 20);
+			snprintf(args.list[args.cnt - 1], 20, "%#jx", (uintmax_t)uniq[i]);
+		}
+		append_str(&args, NULL, 0);
+		if (run_cmd(args.list, &out, false)) {
+			WARNX("addr2line failed");
+			free(out);
+			free_str_list(&args);
+			return;
+		}
+		/* each address is followed by its inlining chain, innermost first */
+		for (line = strtok_r(out, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+			size_t entry;
+			if (!strncmp(line, "0x", 2)) {
+				if (++cur >= end)
+					break;
+				continue;
+			}
+			if (cur >= base && cur < end && !entries[cur] && parse_entry(line, &entry))
+				entries[cur] = entry;
+		}
+		free(out);
+		free_str_list(&args);
+	}
+}
+
+/* attribute samples to entries and print the cost table */
+static void report(struct program *prog, struct sample_list const *list)
+{
+	uint64_t *uniq;
+	size_t *entries, cnt = 0, max = prog->src[1].lines.cnt;
+	size_t other = 0, generated = 0;
+	struct entry_cost *cost;
+
+	if (!list->cnt) {
+		fprintf(stdout, "[profile: no samples (the program ran for less than %.2fms of cpu time)]\n", SAMPLE_PERIOD / 1e6);
+		return;
+	}
+	/* sort and deduplicate addresses so each is only resolved once */
+	xcalloc(&uniq, list->ips_cnt, sizeof *uniq, "report()");
+	memcpy(uniq, list->ips, sizeof *uniq * list->ips_cnt);
+	qsort(uniq, list->ips_cnt, sizeof *uniq, cmp_ip);
+	for (size_t i = 0; i < list->ips_cnt; i++) {
+		if (!cnt || uniq[cnt - 1] != uniq[i])
+			uniq[cnt++] = uniq[i];
+	}
+	xcalloc(&entries, cnt, sizeof *entries, "report()");
+	resolve(uniq, entries, cnt);
+
+	/* `cost[max]` collects code generated around the entries */
+	xcalloc(&cost, max + 1, sizeof *cost, "report()");
+	for (size_t i = 0; i < list->cnt; i++) {
+		bool found = false;
+		for (size_t j = list->off[i]; j < list->off[i + 1]; j++) {
+			uint64_t *ip = bsearch(list->ips + j, uniq, cnt, sizeof *uniq, cmp_ip);
+			size_t entry = ip ? entries[ip - uniq] : 0;
+			if (!entry)
+				continue;
+			if (entry > max)
+				entry = max;
+			/* the first resolved frame is where the time was spent */
+			if (!found)
+				cost[entry].self++;
+			found = true;
+			if (cost[entry].seen != i + 1) {
+				cost[entry].seen = i + 1;
+				cost[entry].total++;
+			}
+		}
+		if (!found)
+			other++;
+	}
+	generated = cost[max].self;
+
+	fprintf(stdout, "[profile: %zu samples, %.2fms cpu", list->cnt, list->cnt * SAMPLE_PERIOD / 1e6);
+	if (list->lost)
+		fprintf(stdout, ", %ju lost", (uintmax_t)list->lost);
+	fputs("]\n", stdout);
+	fprintf(stdout, "%6s %7s %7s  %s\n", "entry", "self", "total", "line");
+	for (size_t i = 1; i < max; i++) {
+		if (!cost[i].total)
+			continue;
+		fprintf(stdout, "%6zu %6.1f%% %6.1f%%  %.60s\n", i, 100.0 * cost[i].self / list->cnt,
+				100.0 * cost[i].total / list->cnt, prog->src[0].lines.list[i]);
+	}
+	if (generated)
+		fprintf(stdout, "%6s %6.1f%% %7s  %s\n", "-", 100.0 * generated / list->cnt, "", "(generated main)");
+	if (other)
+		fprintf(stdout, "%6s %6.1f%% %7s  %s\n", "-", 100.0 * other / list->cnt, "", "(libraries and startup)");
+
+	free(cost);
+	free(entries);
+	free(uniq);
+}
+
+/* `;profile-run`: sample the program and attribute the samples to input lines */
+void profile_run(struct program *prog)
+{
+	/* line tables and frame pointers for the callchains; no-pie keeps addresses fixed */
+	char *const extra[] = {"-g", "-fno-omit-frame-pointer", "-no-pie", NULL};
+	struct sample_list list = {0};
+	bool sampled = false;
+	int status;
+
+	if (build_program(prog->src[1].total.buf, prog->cc_list.list, SAMPLE_BIN, extra, true)) {
+		unlink(SAMPLE_BIN);
+		return;
+	}
+	xcalloc(&list.off, PAGE_SIZE, sizeof *list.off, "profile_run()");
+	list.off_max = PAGE_SIZE;
+	if ((status = sample_child(&list, &sampled)))
+		fprintf(stdout, "[exit status: %d]\n", status);
+	/* open_sampler() already said why there is nothing to report */
+	if (sampled)
+		report(prog, &list);
+	if (unlink(SAMPLE_BIN) == -1)
+		WARN("unable to remove %s", SAMPLE_BIN);
+	free(list.off);
+	free(list.ips);
+}
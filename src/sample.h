@@ -0,0 +1,37 @@
+/*
+ * sample.h - sampling profiler
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(SAMPLE_H)
+#define SAMPLE_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* cpu time between samples in nanoseconds (4kHz) */
+#define SAMPLE_PERIOD	250000
+/* deepest callchain recorded per sample */
+#define SAMPLE_STACK	64
+/* data pages in the ring buffer (must be a power of two) */
+#define SAMPLE_PAGES	64
+/* addresses resolved per addr2line invocation */
+#define SAMPLE_BATCH	1024
+
+/* struct definition for collected callchains */
+struct sample_list {
+	/* user callchains flattened leaf first, with return addresses moved back into the call */
+	uint64_t *ips;
+	/* start of each sample in `ips` (`cnt + 1` entries) */
+	size_t *off;
+	size_t cnt, ips_cnt, ips_max, off_max;
+	/* samples dropped when the ring buffer was full */
+	uint64_t lost;
+};
+
+/* prototypes */
+void profile_run(struct program *prog);
+
+#endif /* !defined(SAMPLE_H) */
@@ -0,0 +1,225 @@
+/*
+ * scale.c - thread scaling of the current program
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "scale.h"
+#include <sched.h>
+#include <sys/resource.h>
+
+#define SCALE_OUT	"/tmp/cepl_scale"
+
+/* variables set to the thread count of each run */
+static char const *const thread_vars[] = {"CEPL_THREADS", "OMP_NUM_THREADS"};
+
+static inline double tv_ms(struct timeval const *tv)
+{
+	return tv->tv_sec * 1e3 + tv->tv_usec / 1e3;
+}
+
+/* `1..8` (every count), `1,2,4,8`, or `8` (same as `1..8`) */
+static bool parse_counts(char const *spec, size_t counts[], size_t *cnt)
+{
+	char *end;
+	size_t first = strtoull(spec, &end, 10), last;
+
+	if (end == spec || !first)
+		return false;
+	if (!*end) {
+		last = first;
+		first = 1;
+	} else if (end[0] == '.' && end[1] == '.') {
+		char const *num = end + 2;
+		last = strtoull(num, &end, 10);
+		if (end == num || *end || last < first)
+			return false;
+	} else {
+		/* comma separated counts */
+		for (char const *cur = spec; *cur && *cnt < SCALE_MAX; cur = end + (*end == ',')) {
+			size_t val = strtoull(cur, &end, 10);
+			if (end == cur || !val || (*end && *end != ','))
+				return false;
+			counts[(*cnt)++] = val;
+		}
+		return true;
+	}
+	for (size_t i = first; i <= last && *cnt < SCALE_MAX; i++)
+		counts[(*cnt)++] = i;
+	return true;
+}
+
+/* parse `[-a[compact|spread]] [counts]` */
+static bool parse_args(char *args, size_t counts[], size_t *cnt, enum scale_affinity *affinity)
+{
+	char *saved;
+	for (char *tok = strtok_r(args, " \t", &saved); tok; tok = strtok_r(NULL, " \t", &saved)) {
+		if (!strncmp(tok, "-a", 2)) {
+			if (!tok[2] || !strcmp(tok + 2, "compact"))
+				*affinity = AFFINITY_COMPACT;
+			else if (!strcmp(tok + 2, "spread"))
+				*affinity = AFFINITY_SPREAD;
+			else
+				return false;
+			continue;
+		}
+		if (*cnt || !parse_counts(tok, counts, cnt))
+			return false;
+	}
+	return true;
+}
+
+/* powers of two up to the number of usable CPUs, then that number */
+static void default_counts(size_t cpus, size_t counts[], size_t *cnt)
+{
+	for (size_t i = 1; i < cpus && *cnt < SCALE_MAX - 1; i *= 2)
+		counts[(*cnt)++] = i;
+	counts[(*cnt)++] = cpus;
+}
+
+/* pick `threads` of the usable CPUs, either the first ones or evenly spaced */
+static void pin_cpus(cpu_set_t const *allowed, size_t const ids[], size_t id_cnt, size_t threads, enum scale_affinity affinity, struct scale_row *row)
+{
+	cpu_set_t set;
+	size_t len = 0;
+
+	if (affinity == AFFINITY_NONE || threads >= id_cnt) {
+		sched_setaffinity(0, sizeof *allowed, allowed);
+		snprintf(row->cpus, sizeof row->cpus, "%s", "all");
+		return;
+	}
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < threads; i++) {
+		size_t id = ids[(affinity == AFFINITY_SPREAD) ? i * id_cnt / threads : i];
+		CPU_SET(id, &set);
+		if (len < sizeof row->cpus)
+			len += snprintf(row->cpus + len, sizeof row->cpus - len, "%s%zu", i ? "," : "", id);
+	}
+	if (sched_setaffinity(0, sizeof set, &set) == -1)
+		WARN("%s", "sched_setaffinity()");
+}
+
+/* run with the thread count in the environment, keeping the median run */
+static void run_count(struct scale_row *row)
+{
+	char *const args[] = {SCALE_OUT, NULL};
+	/* wall and CPU time of each run */
+	double runs[SCALE_RUNS][2];
+	char val[32];
+
+	snprintf(val, sizeof val, "%zu", row->threads);
+	for (size_t i = 0; i < arr_len(thread_vars); i++)
+		setenv(thread_vars[i], val, 1);
+	for (size_t i = 0; i < SCALE_RUNS; i++) {
+		struct rusage before, after;
+		struct timespec start;
+		char *out = NULL;
+		int status;
+
+		getrusage(RUSAGE_CHILDREN, &before);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		status = run_cmd(args, &out, false);
+		runs[i][0] = elapsed_ms(&start);
+		getrusage(RUSAGE_CHILDREN, &after);
+		runs[i][1] = tv_ms(&after.ru_utime) - tv_ms(&before.ru_utime) + tv_ms(&after.ru_stime) - tv_ms(&before.ru_stime);
+		/* keep the output and status of the first run */
+		if (!i) {
+			row->out = out;
+			row->status = status;
+		} else {
+			free(out);
+		}
+	}
+	qsort(runs, SCALE_RUNS, sizeof *runs, cmp_double);
+	row->ms = runs[SCALE_RUNS / 2][0];
+	row->cpu_ms = runs[SCALE_RUNS / 2][1];
+}
+
+static void print_rows(struct scale_row const *rows, size_t cnt, size_t cpus, bool pinned)
+{
+	struct scale_row const *ref = rows;
+
+	fprintf(stdout, "%7s %-12s %12s %12s %6s %8s %10s  %s\n", "threads", pinned ? "cpus" : "",
+			"time", "cpu time", "util", "speedup", "efficiency", "output");
+	for (size_t i = 0; i < cnt; i++) {
+		struct scale_row const *row = rows + i;
+		double speedup = (row->ms > 0) ? ref->ms / row->ms : 0;
+		fprintf(stdout, "%7zu %-12.12s %10.2fms %10.2fms %6.2f %7.2fx %9.0f%%  ", row->threads, pinned ? row->cpus : "",
+				row->ms, row->cpu_ms, (row->ms > 0) ? row->cpu_ms / row->ms : 0,
+				speedup, 100 * speedup * ref->threads / row->threads);
+		if (row == ref)
+			fputs("reference", stdout);
+		else if (row->status == ref->status && !strcmp(row->out, ref->out))
+			fputs("same", stdout);
+		else
+			fputs("DIFFERS", stdout);
+		if (row->status)
+			fprintf(stdout, " (exit status %d)", row->status);
+		if (row->threads > cpus)
+			fputs(" (oversubscribed)", stdout);
+		fputc('\n', stdout);
+	}
+}
+
+/* `;scale [-a[compact|spread]] [1..N|N,...]` */
+void scale_cmd(struct program *prog, char *args)
+{
+	size_t counts[SCALE_MAX], cnt = 0, ids[CPU_SETSIZE], id_cnt = 0;
+	enum scale_affinity affinity = AFFINITY_NONE;
+	struct scale_row *rows;
+	char *saved_vars[arr_len(thread_vars)];
+	cpu_set_t allowed;
+
+	if (!parse_args(args, counts, &cnt, &affinity)) {
+		WARNX("%s", "usage: ;scale [-a[compact|spread]] [1..N|N,...]");
+		return;
+	}
+	if (sched_getaffinity(0, sizeof allowed, &allowed) == -1)
+		ERR("%s", "sched_getaffinity()");
+	for (size_t i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &allowed))
+			ids[id_cnt++] = i;
+	}
+	if (!cnt)
+		default_counts(id_cnt, counts, &cnt);
+	if (build_program(prog->src[1].total.buf, prog->cc_list.list, SCALE_OUT, NULL, true)) {
+		unlink(SCALE_OUT);
+		return;
+	}
+
+	for (size_t i = 0; i < arr_len(thread_vars); i++) {
+		char const *val = getenv(thread_vars[i]);
+		if (val && !(saved_vars[i] = strdup(val)))
+			ERR("strdup()");
+		else if (!val)
+			saved_vars[i] = NULL;
+	}
+	xcalloc(&rows, cnt, sizeof *rows, "scale_cmd()");
+	for (size_t i = 0; i < cnt; i++) {
+		rows[i].threads = counts[i];
+		pin_cpus(&allowed, ids, id_cnt, counts[i], affinity, rows + i);
+		run_count(rows + i);
+	}
+	sched_setaffinity(0, sizeof allowed, &allowed);
+	for (size_t i = 0; i < arr_len(thread_vars); i++) {
+		if (saved_vars[i])
+			setenv(thread_vars[i], saved_vars[i], 1);
+		else
+			unsetenv(thread_vars[i]);
+		free(saved_vars[i]);
+	}
+	unlink(SCALE_OUT);
+
+	print_rows(rows, cnt, id_cnt, affinity != AFFINITY_NONE);
+	fprintf(stdout, "[scale: median of %d runs per count on %zu usable CPU%s, %s %s]\n",
+			SCALE_RUNS, id_cnt, (id_cnt == 1) ? "" : "s", prog->cc_list.list[0], opt_level(prog->cc_list.list));
+	for (size_t i = 0; i < cnt; i++)
+		free(rows[i].out);
+	free(rows);
+}
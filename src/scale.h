@@ -0,0 +1,37 @@
+/*
+ * scale.h - thread scaling of the current program
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(SCALE_H)
+#define SCALE_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* maximum number of thread counts */
+#define SCALE_MAX	64
+/* timed runs per thread count */
+#define SCALE_RUNS	3
+
+/* which CPUs a run is pinned to */
+enum scale_affinity {
+	AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SPREAD,
+};
+
+/* struct definition for the runs with one thread count */
+struct scale_row {
+	size_t threads;
+	/* median wall time and the CPU time of that run */
+	double ms, cpu_ms;
+	int status;
+	char *out;
+	char cpus[64];
+};
+
+/* prototypes */
+void scale_cmd(struct program *prog, char *args);
+
+#endif /* !defined(SCALE_H) */
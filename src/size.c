@@ -0,0 +1,361 @@
+/*
+ * size.c - section sizes, function sizes, and instruction set extensions of the program
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "compile.h"
+#include "size.h"
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+
+#define SIZE_OUT	"/tmp/cepl_size"
+/* largest sections listed */
+#define SIZE_SECTIONS	6
+/* example mnemonics kept per extension */
+#define SIZE_EXAMPLES	48
+
+/* functions the C runtime startup files link into every program */
+static char const *const crt_funcs[] = {
+	"_start", "_init", "_fini", "_dl_relocate_static_pie",
+	"deregister_tm_clones", "register_tm_clones", "__do_global_dtors_aux", "frame_dummy",
+	"__libc_csu_init", "__libc_csu_fini",
+};
+static char const *const isa_names[] = {
+	[ISA_SSE2] = "SSE/SSE2", [ISA_SSE3] = "SSE3", [ISA_SSSE3] = "SSSE3",
+	[ISA_SSE41] = "SSE4.1", [ISA_SSE42] = "SSE4.2", [ISA_POPCNT] = "POPCNT/LZCNT",
+	[ISA_BMI] = "BMI1/BMI2", [ISA_AVX] = "AVX", [ISA_AVX2] = "AVX2", [ISA_FMA] = "FMA",
+	[ISA_AVX512] = "AVX-512", [ISA_CRYPTO] = "AES/PCLMUL/SHA",
+};
+/* space separated mnemonics (or mnemonic prefixes ending in `*`) only encodable with each extension */
+static char const *const isa_mnemonics[] = {
+	[ISA_SSE3] = "addsubps addsubpd haddps haddpd hsubps hsubpd lddqu movddup movshdup movsldup",
+	[ISA_SSSE3] = "pabsb pabsw pabsd palignr phaddw phaddd phaddsw phsubw phsubd phsubsw "
+		"pmaddubsw pmulhrsw pshufb psignb psignw psignd",
+	[ISA_SSE41] = "blendps blendpd blendvps blendvpd dpps dppd extractps insertps movntdqa mpsadbw "
+		"packusdw pblendvb pblendw pcmpeqq pextrb pextrd pextrq phminposuw pinsrb pinsrd pinsrq "
+		"pmaxsb pmaxsd pmaxud pmaxuw pminsb pminsd pminud pminuw pmovsx* pmovzx* pmuldq pmulld "
+		"ptest roundps roundpd roundss roundsd",
+	[ISA_SSE42] = "crc32* pcmpestri pcmpestrm pcmpistri pcmpistrm pcmpgtq",
+	[ISA_POPCNT] = "popcnt lzcnt",
+	[ISA_BMI] = "andn bextr blsi blsmsk blsr tzcnt bzhi mulx pdep pext rorx sarx shlx shrx",
+	[ISA_AVX2] = "vpbroadcast* vbroadcasti128 vextracti128 vinserti128 vperm2i128 vpermd vpermq vpermps vpermpd "
+		"vpgather* vgather* vpmaskmov* vpsllv* vpsrlv* vpsrav* vpblendd",
+	[ISA_FMA] = "vfmadd* vfmsub* vfnmadd* vfnmsub*",
+	[ISA_AVX512] = "vpternlog* vpermi2* vpermt2* vpcompress* vpexpand* vcompress* vexpand* vprol* vpror* "
+		"vpconflict* vplzcnt* vpopcnt* valign* vrange* vreduce* vfixupimm* vgetexp* vgetmant* "
+		"vrcp14* vrsqrt14* vscalef* vpmovqd vpmovqw vpmovqb vpmovdw vpmovdb vpmovwb vcvtusi2* vcvtqq2* vcvtuqq2*",
+	[ISA_CRYPTO] = "aes* vaes* pclmul* vpclmul* sha1* sha256*",
+};
+/* AVX encodings of integer `vp*` instructions which don't need AVX2 at 256 bits */
+static char const avx_ymm[] = "vpermilps vpermilpd vperm2f128 vptest";
+static char const prefixes[] = "rep repz repe repnz repne lock notrack bnd data16 addr32 cs ds";
+
+/* whether `mnemonic` is a word of `list` */
+static bool in_list(char const *list, char const *mnemonic)
+{
+	size_t len = strlen(mnemonic);
+	while (*list) {
+		size_t word = strcspn(list, " ");
+		if (list[word - 1] == '*' ? !strncmp(list, mnemonic, word - 1) && len >= word - 1
+				: word == len && !strncmp(list, mnemonic, len))
+			return true;
+		list += word + strspn(list + word, " ");
+	}
+	return false;
+}
+
+/* the most specific extension an instruction needs, or `ISA_CNT` for the base instruction set */
+static enum isa_ext classify(char const *mnemonic, char const *operands)
+{
+	bool xmm = strstr(operands, "%xmm"), ymm = strstr(operands, "%ymm");
+
+	/* 512-bit vectors, mask registers, and EVEX only instructions */
+	if (strstr(operands, "%zmm") || strstr(operands, "{%k") || (mnemonic[0] == 'k' && strstr(operands, "%k"))
+			|| in_list(isa_mnemonics[ISA_AVX512], mnemonic))
+		return ISA_AVX512;
+	if (in_list(isa_mnemonics[ISA_CRYPTO], mnemonic))
+		return ISA_CRYPTO;
+	if (in_list(isa_mnemonics[ISA_FMA], mnemonic))
+		return ISA_FMA;
+	if (in_list(isa_mnemonics[ISA_AVX2], mnemonic) || (ymm && !strncmp(mnemonic, "vp", 2) && !in_list(avx_ymm, mnemonic)))
+		return ISA_AVX2;
+	/* VEX encodings of SSE instructions */
+	if (mnemonic[0] == 'v' && (xmm || ymm))
+		return ISA_AVX;
+	for (enum isa_ext ext = ISA_BMI; ext > ISA_SSE2; ext--) {
+		/* scalar instructions, then ones named like their general purpose counterparts */
+		if ((ext >= ISA_SSE42 || xmm) && in_list(isa_mnemonics[ext], mnemonic))
+			return ext;
+	}
+	return xmm ? ISA_SSE2 : ISA_CNT;
+}
+
+static void add_func(struct size_func_list *funcs, char const *name, size_t size, bool weak)
+{
+	if (funcs->cnt == funcs->max)
+		xrealloc(&funcs->list, sizeof *funcs->list * (funcs->max = funcs->max ? funcs->max * 2 : 64), "add_func()");
+	if (!(funcs->list[funcs->cnt].name = strdup(name)))
+		ERR("strdup()");
+	funcs->list[funcs->cnt].size = size;
+	funcs->list[funcs->cnt].weak = weak;
+	funcs->cnt++;
+}
+
+static bool is_crt(char const *name)
+{
+	for (size_t i = 0; i < arr_len(crt_funcs); i++) {
+		if (!strcmp(name, crt_funcs[i]))
+			return true;
+	}
+	return false;
+}
+
+static int cmp_func(void const *a, void const *b)
+{
+	struct size_func const *x = a, *y = b;
+	if (x->size != y->size)
+		return (x->size < y->size) - (x->size > y->size);
+	return strcmp(x->name, y->name);
+}
+
+static int cmp_section(void const *a, void const *b)
+{
+	GElf_Shdr const *x = a, *y = b;
+	return (x->sh_size < y->sh_size) - (x->sh_size > y->sh_size);
+}
+
+/* collect the functions defined by the program, leaving out the C runtime startup code */
+bool read_funcs(char const *path, struct size_func_list *funcs)
+{
+	int fd;
+	Elf *elf;
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+
+	if (elf_version(EV_CURRENT) == EV_NONE || (fd = open(path, O_RDONLY|O_CLOEXEC)) == -1)
+		return false;
+	if (!(elf = elf_begin(fd, ELF_C_READ, NULL))) {
+		close(fd);
+		return false;
+	}
+	while ((scn = elf_nextscn(elf, scn))) {
+		Elf_Data *syms;
+		GElf_Sym sym;
+		if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_SYMTAB || !shdr.sh_entsize || !(syms = elf_getdata(scn, NULL)))
+			continue;
+		for (size_t i = 0; i < shdr.sh_size / shdr.sh_entsize; i++) {
+			char const *name;
+			if (!gelf_getsym(syms, i, &sym) || GELF_ST_TYPE(sym.st_info) != STT_FUNC || sym.st_shndx == SHN_UNDEF || !sym.st_size)
+				continue;
+			if (!(name = elf_strptr(elf, shdr.sh_link, sym.st_name)) || is_crt(name))
+				continue;
+			add_func(funcs, name, sym.st_size, GELF_ST_BIND(sym.st_info) == STB_WEAK);
+		}
+	}
+	elf_end(elf);
+	close(fd);
+	return true;
+}
+
+void free_funcs(struct size_func_list *funcs)
+{
+	for (size_t i = 0; i < funcs->cnt; i++)
+		free(funcs->list[i].name);
+	free(funcs->list);
+	funcs->list = NULL;
+	funcs->cnt = funcs->max = 0;
+}
+
+/* print `size`-style totals and the largest sections */
+static bool read_elf(char const *path, bool *x86)
+{
+	int fd;
+	size_t text = 0, code = 0, data = 0, bss = 0, shstrndx, cnt = 0;
+	Elf *elf;
+	Elf_Scn *scn = NULL;
+	GElf_Ehdr ehdr;
+	GElf_Shdr shdr, *shdrs = NULL;
+
+	if (elf_version(EV_CURRENT) == EV_NONE || (fd = open(path, O_RDONLY|O_CLOEXEC)) == -1)
+		return false;
+	if (!(elf = elf_begin(fd, ELF_C_READ, NULL)) || !gelf_getehdr(elf, &ehdr) || elf_getshdrstrndx(elf, &shstrndx)) {
+		if (elf)
+			elf_end(elf);
+		close(fd);
+		return false;
+	}
+	*x86 = ehdr.e_machine == EM_X86_64 || ehdr.e_machine == EM_386;
+	while ((scn = elf_nextscn(elf, scn))) {
+		if (!gelf_getshdr(scn, &shdr))
+			continue;
+		if (!(shdr.sh_flags & SHF_ALLOC))
+			continue;
+		/* the same split as size(1): read-only data counts as text */
+		if (shdr.sh_type == SHT_NOBITS)
+			bss += shdr.sh_size;
+		else if (shdr.sh_flags & SHF_WRITE)
+			data += shdr.sh_size;
+		else
+			text += shdr.sh_size;
+		if (shdr.sh_flags & SHF_EXECINSTR)
+			code += shdr.sh_size;
+		xrealloc(&shdrs, sizeof *shdrs * (cnt + 1), "read_elf()");
+		shdrs[cnt++] = shdr;
+	}
+
+	fprintf(stdout, "text %zu (code %zu)  data %zu  bss %zu  total %zu\n", text, code, data, bss, text + data + bss);
+	qsort(shdrs, cnt, sizeof *shdrs, cmp_section);
+	fputs("sections:", stdout);
+	for (size_t i = 0; i < cnt && i < SIZE_SECTIONS; i++) {
+		char const *name = elf_strptr(elf, shstrndx, shdrs[i].sh_name);
+		fprintf(stdout, " %s %zu", name ? name : "?", (size_t)shdrs[i].sh_size);
+	}
+	fputc('\n', stdout);
+	free(shdrs);
+	elf_end(elf);
+	close(fd);
+	return true;
+}
+
+/* the largest functions, with C++ names demangled by `c++filt` if installed */
+static void print_funcs(struct size_func_list *funcs)
+{
+	char *args[SIZE_TOP + 2] = {"c++filt"}, *demangled = NULL, *saved, *line = NULL;
+	size_t shown = (funcs->cnt < SIZE_TOP) ? funcs->cnt : SIZE_TOP, total = 0, weak = 0, weak_cnt = 0;
+	bool mangled = false;
+	struct stat st;
+
+	qsort(funcs->list, funcs->cnt, sizeof *funcs->list, cmp_func);
+	for (size_t i = 0; i < funcs->cnt; i++) {
+		total += funcs->list[i].size;
+		if (funcs->list[i].weak) {
+			weak += funcs->list[i].size;
+			weak_cnt++;
+		}
+	}
+	for (size_t i = 0; i < shown; i++) {
+		args[i + 1] = funcs->list[i].name;
+		mangled |= !strncmp(funcs->list[i].name, "_Z", 2);
+	}
+	/* `c++filt` prints one line per argument */
+	if (mangled && stat_path(args[0], &st) && !run_cmd(args, &demangled, false) && demangled)
+		line = strtok_r(demangled, "\n", &saved);
+
+	fprintf(stdout, "%zu function%s, %zu bytes", funcs->cnt, (funcs->cnt == 1) ? "" : "s", total);
+	if (weak_cnt)
+		fprintf(stdout, " (%zu bytes in %zu inline or template instantiations)", weak, weak_cnt);
+	fputs(":\n", stdout);
+	for (size_t i = 0; i < shown; i++) {
+		fprintf(stdout, "%10zu  %s%.100s\n", funcs->list[i].size, funcs->list[i].weak ? "*" : "",
+				line ? line : funcs->list[i].name);
+		if (line)
+			line = strtok_r(NULL, "\n", &saved);
+	}
+	free(demangled);
+}
+
+/* append a mnemonic to the examples of an extension once */
+static void add_example(char *examples, char const *mnemonic)
+{
+	size_t len = strlen(examples);
+	if (in_list(examples, mnemonic) || len + strlen(mnemonic) + 2 > SIZE_EXAMPLES)
+		return;
+	snprintf(examples + len, SIZE_EXAMPLES - len, "%s%s", len ? " " : "", mnemonic);
+}
+
+/* disassemble the program's own functions and count instructions per extension */
+static void print_isa(struct program *prog)
+{
+	char *args[] = {"objdump", "-d", "--no-show-raw-insn", "-w", "-j", ".text", SIZE_OUT, NULL};
+	char *dis = NULL, *saved, *march = "default";
+	char examples[ISA_CNT][SIZE_EXAMPLES] = {0};
+	size_t counts[ISA_CNT] = {0}, insns = 0;
+	bool skip = false, any = false;
+	struct stat st;
+
+	for (size_t i = 1; i < prog->cc_list.cnt && prog->cc_list.list[i]; i++) {
+		if (!strncmp(prog->cc_list.list[i], "-march=", 7))
+			march = prog->cc_list.list[i] + 7;
+	}
+	if (!stat_path(args[0], &st) || run_cmd(args, &dis, false) || !dis) {
+		fprintf(stdout, "%s\n", "[size: objdump unavailable, skipping instruction set extensions]");
+		free(dis);
+		return;
+	}
+	for (char *line = strtok_r(dis, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+		char *tab, *name, *ops = "";
+		enum isa_ext ext;
+
+		/* `0000000000001139 <main>:` */
+		if ((name = strchr(line, '<')) && line[strlen(line) - 1] == ':' && !strchr(line, '\t')) {
+			name[strcspn(name, ">")] = '\0';
+			skip = is_crt(name + 1);
+			continue;
+		}
+		if (skip || !(tab = strchr(line, '\t')))
+			continue;
+		/* `    1139:\tvpaddd %ymm1,%ymm0,%ymm0`, skipping prefixes such as `rep` and `lock` */
+		for (name = tab + 1; *name; name += strspn(name, " ")) {
+			size_t len = strcspn(name, " ");
+			bool last = !name[len];
+			name[len] = '\0';
+			ops = name + len + !last;
+			if (!in_list(prefixes, name))
+				break;
+			name = ops;
+		}
+		if (!*name)
+			continue;
+		insns++;
+		if ((ext = classify(name, ops)) == ISA_CNT)
+			continue;
+		counts[ext]++;
+		add_example(examples[ext], name);
+	}
+	free(dis);
+
+	fprintf(stdout, "instruction set extensions in %zu instructions (-march=%s):\n", insns, march);
+	for (size_t i = 0; i < ISA_CNT; i++) {
+		if (!counts[i])
+			continue;
+		fprintf(stdout, "%10zu  %-14s %s\n", counts[i], isa_names[i], examples[i]);
+		any = true;
+	}
+	if (!any)
+		fprintf(stdout, "%12s%s\n", "", "(base instruction set only)");
+}
+
+/* `;size`: what the current program compiles to */
+void size_cmd(struct program *prog)
+{
+	struct size_func_list funcs = {0};
+	bool x86 = false;
+
+	if (build_program(prog->src[1].total.buf, prog->cc_list.list, SIZE_OUT, NULL, true)) {
+		unlink(SIZE_OUT);
+		return;
+	}
+	if (!read_elf(SIZE_OUT, &x86) || !read_funcs(SIZE_OUT, &funcs)) {
+		WARNX("%s", "unable to read " SIZE_OUT);
+		unlink(SIZE_OUT);
+		return;
+	}
+	print_funcs(&funcs);
+	if (x86)
+		print_isa(prog);
+	else
+		fprintf(stdout, "%s\n", "[size: instruction set extensions are only classified for x86]");
+	unlink(SIZE_OUT);
+
+	free_funcs(&funcs);
+	fprintf(stdout, "[size: %s %s, * marks inline functions and template instantiations]\n",
+			prog->cc_list.list[0], opt_level(prog->cc_list.list));
+}
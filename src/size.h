@@ -0,0 +1,42 @@
+/*
+ * size.h - section sizes, function sizes, and instruction set extensions of the program
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(SIZE_H)
+#define SIZE_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* number of functions listed */
+#define SIZE_TOP	12
+
+/* instruction set extensions, from the baseline up */
+enum isa_ext {
+	ISA_SSE2, ISA_SSE3, ISA_SSSE3, ISA_SSE41, ISA_SSE42, ISA_POPCNT, ISA_BMI,
+	ISA_AVX, ISA_AVX2, ISA_FMA, ISA_AVX512, ISA_CRYPTO, ISA_CNT,
+};
+
+/* struct definition for one function symbol */
+struct size_func {
+	char *name;
+	size_t size;
+	/* weak definitions are inline functions and template instantiations */
+	bool weak;
+};
+
+/* struct definition for a list of function symbols */
+struct size_func_list {
+	struct size_func *list;
+	size_t cnt, max;
+};
+
+/* prototypes */
+bool read_funcs(char const *path, struct size_func_list *funcs);
+void free_funcs(struct size_func_list *funcs);
+void size_cmd(struct program *prog);
+
+#endif /* !defined(SIZE_H) */
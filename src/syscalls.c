@@ -0,0 +1,298 @@
+/*
+ * syscalls.c - system call profile of program runs
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "jobs.h"
+#include "syscalls.h"
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define SYSCALL_NAME(name, bytes)	{SYS_##name, #name, bytes}
+
+/* how a system call moves data */
+enum syscall_bytes {
+	BYTES_NONE, BYTES_RET, BYTES_LEN,
+};
+
+/* struct definition for a named system call */
+struct syscall_name {
+	long nr;
+	char const *name;
+	/* the return value is a byte count, or the second argument is a length */
+	enum syscall_bytes bytes;
+};
+
+static struct syscall_name const name_list[] = {
+	SYSCALL_NAME(read, BYTES_RET), SYSCALL_NAME(write, BYTES_RET),
+	SYSCALL_NAME(pread64, BYTES_RET), SYSCALL_NAME(pwrite64, BYTES_RET),
+	SYSCALL_NAME(readv, BYTES_RET), SYSCALL_NAME(writev, BYTES_RET),
+	SYSCALL_NAME(preadv, BYTES_RET), SYSCALL_NAME(pwritev, BYTES_RET),
+	SYSCALL_NAME(sendfile, BYTES_RET), SYSCALL_NAME(splice, BYTES_RET),
+	SYSCALL_NAME(tee, BYTES_RET), SYSCALL_NAME(vmsplice, BYTES_RET),
+	SYSCALL_NAME(copy_file_range, BYTES_RET), SYSCALL_NAME(getrandom, BYTES_RET),
+	SYSCALL_NAME(sendto, BYTES_RET), SYSCALL_NAME(recvfrom, BYTES_RET),
+	SYSCALL_NAME(sendmsg, BYTES_RET), SYSCALL_NAME(recvmsg, BYTES_RET),
+	SYSCALL_NAME(mmap, BYTES_LEN), SYSCALL_NAME(munmap, BYTES_NONE),
+	SYSCALL_NAME(mremap, BYTES_NONE), SYSCALL_NAME(mprotect, BYTES_NONE),
+	SYSCALL_NAME(madvise, BYTES_NONE), SYSCALL_NAME(msync, BYTES_NONE),
+	SYSCALL_NAME(mlock, BYTES_NONE), SYSCALL_NAME(munlock, BYTES_NONE),
+	SYSCALL_NAME(brk, BYTES_NONE), SYSCALL_NAME(memfd_create, BYTES_NONE),
+	SYSCALL_NAME(openat, BYTES_NONE), SYSCALL_NAME(close, BYTES_NONE),
+	SYSCALL_NAME(fstat, BYTES_NONE), SYSCALL_NAME(newfstatat, BYTES_NONE),
+	SYSCALL_NAME(statx, BYTES_NONE), SYSCALL_NAME(lseek, BYTES_NONE),
+	SYSCALL_NAME(fcntl, BYTES_NONE), SYSCALL_NAME(ioctl, BYTES_NONE),
+	SYSCALL_NAME(dup, BYTES_NONE), SYSCALL_NAME(dup3, BYTES_NONE),
+	SYSCALL_NAME(pipe2, BYTES_NONE), SYSCALL_NAME(fsync, BYTES_NONE),
+	SYSCALL_NAME(fdatasync, BYTES_NONE), SYSCALL_NAME(ftruncate, BYTES_NONE),
+	SYSCALL_NAME(fallocate, BYTES_NONE), SYSCALL_NAME(getdents64, BYTES_NONE),
+	SYSCALL_NAME(getcwd, BYTES_NONE), SYSCALL_NAME(chdir, BYTES_NONE),
+	SYSCALL_NAME(mkdirat, BYTES_NONE), SYSCALL_NAME(unlinkat, BYTES_NONE),
+	SYSCALL_NAME(readlinkat, BYTES_NONE), SYSCALL_NAME(faccessat, BYTES_NONE),
+	SYSCALL_NAME(socket, BYTES_NONE), SYSCALL_NAME(connect, BYTES_NONE),
+	SYSCALL_NAME(accept, BYTES_NONE), SYSCALL_NAME(pselect6, BYTES_NONE),
+	SYSCALL_NAME(ppoll, BYTES_NONE), SYSCALL_NAME(epoll_ctl, BYTES_NONE),
+	SYSCALL_NAME(epoll_pwait, BYTES_NONE), SYSCALL_NAME(eventfd2, BYTES_NONE),
+	SYSCALL_NAME(io_uring_setup, BYTES_NONE), SYSCALL_NAME(io_uring_enter, BYTES_NONE),
+	SYSCALL_NAME(clone, BYTES_NONE), SYSCALL_NAME(clone3, BYTES_NONE),
+	SYSCALL_NAME(execve, BYTES_NONE), SYSCALL_NAME(wait4, BYTES_NONE),
+	SYSCALL_NAME(exit, BYTES_NONE), SYSCALL_NAME(exit_group, BYTES_NONE),
+	SYSCALL_NAME(kill, BYTES_NONE), SYSCALL_NAME(tgkill, BYTES_NONE),
+	SYSCALL_NAME(futex, BYTES_NONE), SYSCALL_NAME(sched_yield, BYTES_NONE),
+	SYSCALL_NAME(sched_setaffinity, BYTES_NONE), SYSCALL_NAME(sched_getaffinity, BYTES_NONE),
+	SYSCALL_NAME(set_tid_address, BYTES_NONE), SYSCALL_NAME(set_robust_list, BYTES_NONE),
+	SYSCALL_NAME(rseq, BYTES_NONE), SYSCALL_NAME(membarrier, BYTES_NONE),
+	SYSCALL_NAME(rt_sigaction, BYTES_NONE), SYSCALL_NAME(rt_sigprocmask, BYTES_NONE),
+	SYSCALL_NAME(nanosleep, BYTES_NONE), SYSCALL_NAME(clock_nanosleep, BYTES_NONE),
+	SYSCALL_NAME(clock_gettime, BYTES_NONE), SYSCALL_NAME(gettimeofday, BYTES_NONE),
+	SYSCALL_NAME(getrusage, BYTES_NONE), SYSCALL_NAME(prlimit64, BYTES_NONE),
+	SYSCALL_NAME(getpid, BYTES_NONE), SYSCALL_NAME(getppid, BYTES_NONE),
+	SYSCALL_NAME(gettid, BYTES_NONE), SYSCALL_NAME(getuid, BYTES_NONE),
+	SYSCALL_NAME(uname, BYTES_NONE), SYSCALL_NAME(sysinfo, BYTES_NONE),
+	/* only on architectures with the legacy calls */
+#if defined(SYS_open)
+	SYSCALL_NAME(open, BYTES_NONE), SYSCALL_NAME(stat, BYTES_NONE),
+	SYSCALL_NAME(lstat, BYTES_NONE), SYSCALL_NAME(access, BYTES_NONE),
+	SYSCALL_NAME(poll, BYTES_NONE), SYSCALL_NAME(select, BYTES_NONE),
+	SYSCALL_NAME(pipe, BYTES_NONE), SYSCALL_NAME(dup2, BYTES_NONE),
+	SYSCALL_NAME(fork, BYTES_NONE), SYSCALL_NAME(vfork, BYTES_NONE),
+	SYSCALL_NAME(getdents, BYTES_NONE), SYSCALL_NAME(mkdir, BYTES_NONE),
+	SYSCALL_NAME(unlink, BYTES_NONE), SYSCALL_NAME(rename, BYTES_NONE),
+	SYSCALL_NAME(readlink, BYTES_NONE), SYSCALL_NAME(epoll_wait, BYTES_NONE),
+#endif
+#if defined(SYS_arch_prctl)
+	SYSCALL_NAME(arch_prctl, BYTES_NONE),
+#endif
+};
+static bool trace_on = false;
+
+bool syscalls_mode(void)
+{
+	return trace_on;
+}
+
+/* `;syscalls [on|off]`, toggling without an argument */
+void set_syscalls(char const *mode)
+{
+	if (!*mode)
+		trace_on = !trace_on;
+	else if (!strcmp(mode, "on"))
+		trace_on = true;
+	else if (!strcmp(mode, "off"))
+		trace_on = false;
+	else
+		WARNX("unknown syscalls mode \"%s\"", mode);
+	fprintf(stdout, "[syscall tracing %s]\n", trace_on ? "on" : "off");
+}
+
+/* stop until the parent has attached, running untraced if it can't */
+void syscalls_child(void)
+{
+	if (!trace_on)
+		return;
+	if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) {
+		WARN("%s", "ptrace(PTRACE_TRACEME)");
+		return;
+	}
+	raise(SIGSTOP);
+}
+
+static struct syscall_name const *find_name(uint64_t nr)
+{
+	for (size_t i = 0; i < arr_len(name_list); i++) {
+		if ((uint64_t)name_list[i].nr == nr)
+			return name_list + i;
+	}
+	return NULL;
+}
+
+static struct syscall_tracee *find_tracee(struct syscall_counts *sc, pid_t tid)
+{
+	for (size_t i = 0; i < sc->cnt; i++) {
+		if (sc->list[i].tid == tid)
+			return sc->list + i;
+	}
+	xrealloc(&sc->list, (sc->cnt + 1) * sizeof *sc->list, "find_tracee()");
+	sc->list[sc->cnt] = (struct syscall_tracee){.tid = tid, .nr = UINT64_MAX};
+	return sc->list + sc->cnt++;
+}
+
+static void drop_tracee(struct syscall_counts *sc, struct syscall_tracee *cur)
+{
+	memmove(cur, cur + 1, (sc->list + --sc->cnt - cur) * sizeof *cur);
+}
+
+static bool stop_signal(int sig)
+{
+	return sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU;
+}
+
+/* wait for the next stop, leaving the exit of `pid` itself to be reaped by the caller */
+static pid_t next_stop(pid_t pid, int *status)
+{
+	siginfo_t info = {0};
+	if (waitid(P_ALL, 0, &info, WEXITED|WSTOPPED|WNOWAIT|__WALL) == -1 || !info.si_pid)
+		return -1;
+	if (info.si_pid == pid && info.si_code != CLD_TRAPPED && info.si_code != CLD_STOPPED)
+		return -1;
+	return waitpid(info.si_pid, status, WUNTRACED|__WALL);
+}
+
+/* record the entry or exit of a system call */
+static void syscall_stop(struct syscall_counts *sc, struct syscall_tracee *cur)
+{
+	struct __ptrace_syscall_info info;
+	struct syscall_name const *name;
+	struct syscall_stat *stat;
+
+	if (ptrace(PTRACE_GET_SYSCALL_INFO, cur->tid, sizeof info, &info) <= 0)
+		return;
+	if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+		cur->nr = info.entry.nr;
+		cur->len = info.entry.args[1];
+		clock_gettime(CLOCK_MONOTONIC, &cur->entry);
+		return;
+	}
+	if (info.op != PTRACE_SYSCALL_INFO_EXIT || cur->nr >= SYSCALLS_MAX)
+		return;
+	stat = sc->stat + cur->nr;
+	stat->calls++;
+	stat->ms += elapsed_ms(&cur->entry);
+	if (info.exit.is_error)
+		stat->errors++;
+	else if ((name = find_name(cur->nr)) && name->bytes == BYTES_RET && info.exit.rval > 0)
+		stat->bytes += info.exit.rval;
+	else if (name && name->bytes == BYTES_LEN)
+		stat->bytes += cur->len;
+	cur->nr = UINT64_MAX;
+}
+
+/* trace every thread of the stopped child until it exits */
+void syscalls_trace(struct syscall_counts *sc, pid_t pid)
+{
+	long const opts = PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACECLONE|PTRACE_O_TRACEEXEC|PTRACE_O_TRACEEXIT|PTRACE_O_EXITKILL;
+	int status;
+	pid_t tid;
+
+	memset(sc, 0, sizeof *sc);
+	if (!trace_on)
+		return;
+	find_tracee(sc, pid);
+	while (sc->cnt && (tid = next_stop(pid, &status)) > 0) {
+		struct syscall_tracee *cur;
+		int sig = 0;
+
+		/* background jobs are reported here as well */
+		if (jobs_collect(tid, status))
+			continue;
+		cur = find_tracee(sc, tid);
+		if (!WIFSTOPPED(status)) {
+			drop_tracee(sc, cur);
+			continue;
+		}
+		if (WSTOPSIG(status) == (SIGTRAP|0x80)) {
+			syscall_stop(sc, cur);
+		} else if (status >> 16 == PTRACE_EVENT_EXIT) {
+			/* let it finish exiting untraced */
+			ptrace(PTRACE_DETACH, tid, NULL, NULL);
+			drop_tracee(sc, cur);
+			continue;
+		} else if (status >> 16 == PTRACE_EVENT_CLONE) {
+			unsigned long child;
+			if (ptrace(PTRACE_GETEVENTMSG, tid, NULL, &child) != -1)
+				find_tracee(sc, child);
+		} else if (!(status >> 16) && (cur->started || WSTOPSIG(status) != SIGSTOP)) {
+			/* pass signals through, except stops which would be reported again as a group-stop */
+			if (!stop_signal(WSTOPSIG(status)))
+				sig = WSTOPSIG(status);
+		} else if (!cur->started) {
+			/* the stop each thread starts with */
+			if (tid == pid && ptrace(PTRACE_SETOPTIONS, tid, NULL, opts) == -1)
+				WARN("%s", "ptrace(PTRACE_SETOPTIONS)");
+			cur->started = sc->traced = true;
+			sc->threads++;
+		}
+		ptrace(PTRACE_SYSCALL, tid, NULL, sig);
+	}
+	free(sc->list);
+	sc->list = NULL;
+	sc->cnt = 0;
+}
+
+static int cmp_stat(void const *a, void const *b, void *arg)
+{
+	struct syscall_stat const *list = arg, *x = list + *(size_t const *)a, *y = list + *(size_t const *)b;
+	return (x->ms < y->ms) - (x->ms > y->ms);
+}
+
+/* print the system calls which took the most time */
+void syscalls_report(struct syscall_counts *sc)
+{
+	size_t order[SYSCALLS_MAX], cnt = 0, calls = 0, errors = 0;
+	double ms = 0;
+
+	if (!trace_on)
+		return;
+	if (!sc->traced) {
+		fprintf(stdout, "%s\n", "[syscalls: unable to trace the program]");
+		return;
+	}
+	for (size_t i = 0; i < SYSCALLS_MAX; i++) {
+		if (!sc->stat[i].calls)
+			continue;
+		order[cnt++] = i;
+		calls += sc->stat[i].calls;
+		errors += sc->stat[i].errors;
+		ms += sc->stat[i].ms;
+	}
+	qsort_r(order, cnt, sizeof *order, cmp_stat, sc->stat);
+
+	fprintf(stdout, "%8s %7s %12s %10s %14s  %s\n", "calls", "errors", "time", "avg", "bytes", "syscall");
+	for (size_t i = 0; i < cnt && i < SYSCALLS_TOP; i++) {
+		struct syscall_stat const *stat = sc->stat + order[i];
+		struct syscall_name const *name = find_name(order[i]);
+		char unknown[32];
+
+		snprintf(unknown, sizeof unknown, "syscall_%zu", order[i]);
+		fprintf(stdout, "%8zu %7zu %10.3fms %8.2fus ", stat->calls, stat->errors, stat->ms, stat->ms * 1e3 / stat->calls);
+		if (stat->bytes)
+			fprintf(stdout, "%14ju", (uintmax_t)stat->bytes);
+		else
+			fprintf(stdout, "%14s", "-");
+		fprintf(stdout, "  %s\n", name ? name->name : unknown);
+	}
+	if (cnt > SYSCALLS_TOP)
+		fprintf(stdout, "%8s  (%zu more)\n", "", cnt - SYSCALLS_TOP);
+	fprintf(stdout, "[syscalls: %zu call%s, %zu failed, %.3fms inside system calls across %zu thread%s, timed from ptrace stops]\n",
+			calls, (calls == 1) ? "" : "s", errors, ms, sc->threads, (sc->threads == 1) ? "" : "s");
+}
@@ -0,0 +1,52 @@
+/*
+ * syscalls.h - system call profile of program runs
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(SYSCALLS_H)
+#define SYSCALLS_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* system call numbers counted individually */
+#define SYSCALLS_MAX	1024
+/* rows in the report */
+#define SYSCALLS_TOP	16
+
+/* struct definition for the totals of one system call */
+struct syscall_stat {
+	size_t calls, errors;
+	double ms;
+	/* bytes read or written, or mapped for mmap() */
+	uint64_t bytes;
+};
+
+/* struct definition for a traced thread */
+struct syscall_tracee {
+	pid_t tid;
+	/* the stop it starts with has been suppressed */
+	bool started;
+	/* call in progress and its second argument */
+	uint64_t nr, len;
+	struct timespec entry;
+};
+
+/* struct definition for the profile of one run */
+struct syscall_counts {
+	bool traced;
+	struct syscall_stat stat[SYSCALLS_MAX];
+	struct syscall_tracee *list;
+	size_t cnt, threads;
+};
+
+/* prototypes */
+bool syscalls_mode(void);
+void set_syscalls(char const *mode);
+void syscalls_child(void);
+void syscalls_trace(struct syscall_counts *sc, pid_t pid);
+void syscalls_report(struct syscall_counts *sc);
+
+#endif /* !defined(SYSCALLS_H) */
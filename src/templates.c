@@ -0,0 +1,164 @@
+/*
+ * templates.c - prebuilt explicit template instantiations
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "compile.h"
+#include "templates.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* specializations instantiated when there is no user list */
+static char *const default_list[] = {
+	"std::vector<int>",
+	"std::vector<long>",
+	"std::vector<unsigned>",
+	"std::vector<double>",
+	"std::vector<char>",
+	"std::vector<bool>",
+	"std::vector<std::string>",
+	"std::map<std::string, int>",
+	"std::map<int, int>",
+	"std::set<int>",
+	"std::set<std::string>",
+	"std::deque<int>",
+	"std::list<int>",
+	"std::unique_ptr<int>",
+	"std::shared_ptr<int>",
+	NULL
+};
+
+extern char const *cxx_prologue;
+
+/* read `$XDG_CONFIG_HOME/cepl/templates`, one type per line (`#` starts a comment) */
+static void read_list(struct str_list *types)
+{
+	FILE *list_file;
+	char *path, *line = NULL;
+	size_t len = 0;
+
+	init_str_list(types, NULL);
+	if ((path = config_file("templates")) && (list_file = fopen(path, "rb"))) {
+		while (getline(&line, &len, list_file) != -1) {
+			char *start = line + strspn(line, " \t"), *end;
+			start[strcspn(start, "#\n")] = '\0';
+			for (end = start + strlen(start); end > start && strchr(" \t;", end[-1]); end--);
+			*end = '\0';
+			if (*start)
+				append_str(types, start, 0);
+		}
+		free(line);
+		fclose(list_file);
+	} else {
+		for (size_t i = 0; default_list[i]; i++)
+			append_str(types, default_list[i], 0);
+	}
+	free(path);
+}
+
+/* build the shared object holding every instantiation */
+static bool build_lib(struct program *prog, struct str_list *types, char const *dir, char const *lib)
+{
+	FILE *src_file;
+	struct str_list args;
+	char *src;
+	int ret;
+
+	if (asprintf(&src, "%s/templates.cc", dir) == -1)
+		ERR("asprintf()");
+	if (!(src_file = fopen(src, "wb"))) {
+		free(src);
+		return false;
+	}
+	fputs(cxx_prologue, src_file);
+	for (size_t i = 0; i < types->cnt; i++)
+		fprintf(src_file, "template class %s;\n", types->list[i]);
+	fclose(src_file);
+
+	init_str_list(&args, prog->cc_list.list[0]);
+	for (size_t i = 1; i < prog->cc_list.cnt && prog->cc_list.list[i]; i++) {
+		char const *arg = prog->cc_list.list[i];
+		/* stop at prebuilt objects */
+		if (!strcmp(arg, "-xnone"))
+			break;
+		if (!strcmp(arg, "-") || !strncmp(arg, "-o", 2) || !strncmp(arg, "-x", 2))
+			continue;
+		append_str(&args, arg, 0);
+	}
+	append_str(&args, "-fPIC", 0);
+	append_str(&args, "-shared", 0);
+	append_str(&args, src, 0);
+	append_str(&args, lib, 2);
+	memcpy(args.list[args.cnt - 1], "-o", 2);
+	append_str(&args, NULL, 0);
+	ret = run_cmd(args.list, NULL, false);
+	free_str_list(&args);
+	free(src);
+	return !ret;
+}
+
+/* link the prebuilt instantiations and record the matching `extern template` declarations */
+bool extern_template_args(struct program *prog)
+{
+	struct str_list types;
+	uint64_t hash = cc_hash(prog);
+	char name[32], *dir, *lib = NULL, *path = NULL;
+	bool cached, ret = false;
+	size_t len = 1;
+
+	free(prog->tmpl_decls);
+	prog->tmpl_decls = NULL;
+	read_list(&types);
+	for (size_t i = 0; i < types.cnt; i++)
+		hash = hash_str(hash, types.list[i]);
+	snprintf(name, sizeof name, "templates/%016jx", (uintmax_t)hash);
+	if (!types.cnt || !(dir = cache_dir(name))) {
+		free_str_list(&types);
+		return false;
+	}
+	if (asprintf(&path, "%s/failed", dir) == -1 || asprintf(&lib, "%s/libcepl_templates.so", dir) == -1)
+		ERR("asprintf()");
+	/* don't retry a list that already failed with these flags */
+	if (path_exists(path))
+		goto done;
+	cached = path_exists(lib);
+	trace_instant(cached ? "template library cache hit" : "template library cache miss", "cache");
+	if (!cached && !build_lib(prog, &types, dir, lib)) {
+		int fd;
+		WARNX("unable to build template instantiations (see %s/templates.cc)", dir);
+		if ((fd = open(path, O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR)) != -1)
+			close(fd);
+		goto done;
+	}
+
+	/* declarations injected after the prologue */
+	for (size_t i = 0; i < types.cnt; i++)
+		len += strlen(types.list[i]) + sizeof "extern template class ;\n";
+	xcalloc(&prog->tmpl_decls, 1, len, "extern_template_args()");
+	for (size_t i = 0; i < types.cnt; i++) {
+		strmv(CONCAT, prog->tmpl_decls, "extern template class ");
+		strmv(CONCAT, prog->tmpl_decls, types.list[i]);
+		strmv(CONCAT, prog->tmpl_decls, ";\n");
+	}
+	/* objects after `-xnone` so they aren't read as c++ source */
+	append_str(&prog->cc_list, "-xnone", 0);
+	append_str(&prog->cc_list, lib, 0);
+	append_str(&prog->cc_list, dir, strlen("-Wl,-rpath,"));
+	memcpy(prog->cc_list.list[prog->cc_list.cnt - 1], "-Wl,-rpath,", strlen("-Wl,-rpath,"));
+	ret = true;
+
+done:
+	free_str_list(&types);
+	free(path);
+	free(lib);
+	free(dir);
+	return ret;
+}
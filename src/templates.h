@@ -0,0 +1,17 @@
+/*
+ * templates.h - prebuilt explicit template instantiations
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(TEMPLATES_H)
+#define TEMPLATES_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* prototypes */
+bool extern_template_args(struct program *prog);
+
+#endif /* !defined(TEMPLATES_H) */
@@ -0,0 +1,211 @@
+/*
+ * trace.c - trace event export
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+
+/* unbuffered so forked children can't flush a duplicate of pending events */
+static int trace_fd = -1;
+static pid_t trace_pid;
+/* open "B" events to close on a longjmp() */
+static size_t trace_depth;
+static struct timespec trace_start;
+static bool trace_empty = true;
+
+static double since_start(struct timespec const *ts)
+{
+	return (ts->tv_sec - trace_start.tv_sec) * 1e6 + (ts->tv_nsec - trace_start.tv_nsec) / 1e3;
+}
+
+static double now_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return since_start(&now);
+}
+
+/* write a JSON string literal */
+static void put_str(FILE *out, char const *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(out, "\\u%04x", *str);
+		else
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+/* append a formatted event to the array */
+static void put_event(char const *buf, size_t len)
+{
+	/* one write with its separator so events from forked workers don't interleave */
+	struct iovec iov[] = {
+		{.iov_base = ",\n", .iov_len = trace_empty ? 0 : 2},
+		{.iov_base = (char *)buf, .iov_len = len},
+	};
+	trace_empty = false;
+	if (writev(trace_fd, iov, arr_len(iov)) != (ssize_t)(iov[0].iov_len + len))
+		WARN("unable to write trace event");
+}
+
+/* append one event, `fmt` being the fields after the common ones */
+static void emit(char const *name, char const *cat, char ph, pid_t pid, double ts, char const *fmt, ...)
+{
+	FILE *out;
+	char *buf;
+	size_t len;
+	va_list args;
+
+	if (!(out = open_memstream(&buf, &len)))
+		ERR("open_memstream()");
+	fputs("{\"name\":", out);
+	put_str(out, name);
+	fprintf(out, ",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":%jd,\"tid\":%jd,\"ts\":%.3f",
+			cat, ph, (intmax_t)pid, (intmax_t)pid, ts);
+	va_start(args, fmt);
+	vfprintf(out, fmt, args);
+	va_end(args);
+	fputc('}', out);
+	fclose(out);
+	put_event(buf, len);
+	free(buf);
+}
+
+/* name a process track */
+static void name_process(pid_t pid, char const *name)
+{
+	FILE *out;
+	char *buf;
+	size_t len;
+
+	if (!(out = open_memstream(&buf, &len)))
+		ERR("open_memstream()");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%jd,\"args\":{\"name\":", (intmax_t)pid);
+	put_str(out, name);
+	fputs("}}", out);
+	fclose(out);
+	put_event(buf, len);
+	free(buf);
+}
+
+static void trace_close(void)
+{
+	/* only the process which opened the trace finishes it */
+	if (trace_fd == -1 || getpid() != trace_pid)
+		return;
+	trace_unwind();
+	if (write(trace_fd, "\n]\n", 3) != 3)
+		WARN("unable to finish trace");
+	close(trace_fd);
+	trace_fd = -1;
+}
+
+/* start writing trace events to `path` */
+void trace_open(char const *path)
+{
+	/* parse_opts() runs again on `;reset` */
+	if (trace_fd != -1)
+		return;
+	if ((trace_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) == -1) {
+		WARN("unable to open trace file %s", path);
+		return;
+	}
+	trace_pid = getpid();
+	clock_gettime(CLOCK_MONOTONIC, &trace_start);
+	if (write(trace_fd, "[\n", 2) != 2)
+		WARN("unable to write trace header");
+	name_process(trace_pid, "cepl");
+	/* SIGHUP and SIGTERM leave through `quick_exit()` */
+	if (atexit(trace_close) || at_quick_exit(trace_close))
+		WARN("unable to register trace_close()");
+}
+
+/* open a span on the main track, with optional detail shown in its arguments */
+void trace_begin(char const *name, char const *cat, char const *detail)
+{
+	if (trace_fd == -1)
+		return;
+	trace_depth++;
+	if (!detail) {
+		emit(name, cat, 'B', trace_pid, now_us(), "");
+		return;
+	}
+	FILE *out;
+	char *arg;
+	size_t len;
+	if (!(out = open_memstream(&arg, &len)))
+		ERR("open_memstream()");
+	put_str(out, detail);
+	fclose(out);
+	emit(name, cat, 'B', trace_pid, now_us(), ",\"args\":{\"detail\":%s}", arg);
+	free(arg);
+}
+
+/* close the innermost span */
+void trace_end(void)
+{
+	if (trace_fd == -1 || !trace_depth)
+		return;
+	trace_depth--;
+	emit("", "", 'E', trace_pid, now_us(), "");
+}
+
+/* close every open span (when exiting from inside one) */
+void trace_unwind(void)
+{
+	while (trace_depth)
+		trace_end();
+}
+
+/* record a child process which ran from `start` until now on its own track */
+void trace_child(char const *name, pid_t pid, struct timespec const *start)
+{
+	double ts;
+	if (trace_fd == -1)
+		return;
+	ts = since_start(start);
+	name_process(pid, name);
+	emit(name, "child", 'X', pid, ts, ",\"dur\":%.3f", now_us() - ts);
+}
+
+/* record the current and peak resident set size as a counter */
+void trace_memory(void)
+{
+	struct rusage ru;
+	long pages = 0, resident = 0;
+	FILE *file;
+
+	if (trace_fd == -1)
+		return;
+	if ((file = fopen("/proc/self/statm", "rb"))) {
+		if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(file);
+	}
+	getrusage(RUSAGE_SELF, &ru);
+	emit("memory", "repl", 'C', trace_pid, now_us(), ",\"args\":{\"rss_kb\":%ld,\"max_rss_kb\":%ld}",
+			resident * (long)(sysconf(_SC_PAGESIZE) / 1024), ru.ru_maxrss);
+}
+
+/* mark a point event such as a cache hit */
+void trace_instant(char const *name, char const *cat)
+{
+	if (trace_fd == -1)
+		return;
+	emit(name, cat, 'i', trace_pid, now_us(), ",\"s\":\"p\"");
+}
@@ -0,0 +1,24 @@
+/*
+ * trace.h - trace event export
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(TRACE_H)
+#define TRACE_H 1
+
+#include "defs.h"
+#include "errs.h"
+#include <time.h>
+
+/* prototypes */
+void trace_open(char const *path);
+void trace_begin(char const *name, char const *cat, char const *detail);
+void trace_end(void);
+void trace_unwind(void);
+void trace_child(char const *name, pid_t pid, struct timespec const *start);
+void trace_memory(void);
+void trace_instant(char const *name, char const *cat);
+
+#endif /* !defined(TRACE_H) */
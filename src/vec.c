@@ -0,0 +1,153 @@
+/*
+ * vec.c - optimization remarks mapped to input lines
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+/* silence linter */
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include "compile.h"
+#include "vec.h"
+
+#define VEC_OUT		"/tmp/cepl_vec"
+
+static char *const gcc_flags[] = {"-fopt-info-all", NULL};
+static char *const clang_flags[] = {
+	"-Rpass=.*", "-Rpass-missed=.*", "-Rpass-analysis=.*",
+	/* remarks carry no location without line tables */
+	"-gline-tables-only",
+	NULL
+};
+static char const *const kind_names[] = {
+	[REMARK_DONE] = "optimized", [REMARK_MISSED] = "missed", [REMARK_REASON] = "reason",
+};
+
+static void add_remark(struct remark_list *remarks, size_t entry, enum remark_kind kind, char const *msg, size_t len)
+{
+	/* count repeats of the same remark */
+	for (size_t i = 0; i < remarks->cnt; i++) {
+		struct remark *cur = remarks->list + i;
+		if (cur->entry == entry && cur->kind == kind && strlen(cur->msg) == len && !strncmp(cur->msg, msg, len)) {
+			cur->cnt++;
+			return;
+		}
+	}
+	if (remarks->cnt == remarks->max)
+		xrealloc(&remarks->list, sizeof *remarks->list * (remarks->max = remarks->max ? remarks->max * 2 : 64), "add_remark()");
+	xcalloc(&remarks->list[remarks->cnt].msg, 1, len + 1, "add_remark()");
+	memcpy(remarks->list[remarks->cnt].msg, msg, len);
+	remarks->list[remarks->cnt].kind = kind;
+	remarks->list[remarks->cnt].entry = entry;
+	remarks->list[remarks->cnt].seq = remarks->cnt;
+	remarks->list[remarks->cnt].cnt = 1;
+	remarks->cnt++;
+}
+
+static int cmp_remark(void const *a, void const *b)
+{
+	struct remark const *x = a, *y = b;
+	if (x->entry != y->entry)
+		return (x->entry > y->entry) - (x->entry < y->entry);
+	return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/*
+ * keep remarks about the piped source: gcc prints `<stdin>:line:col: optimized|missed|note: msg`
+ * and clang prints `<stdin>:line:col: remark: msg [-Rpass|-Rpass-missed|-Rpass-analysis=pass]`
+ */
+static void parse_remarks(char *report, size_t max, struct remark_list *remarks)
+{
+	char *saved;
+	for (char *line = strtok_r(report, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+		enum remark_kind kind;
+		char *msg, *end;
+		size_t entry;
+
+		/* header code and pass statistics */
+		if (strncmp(line, "<stdin>:", 8))
+			continue;
+		entry = strtoull(line + 8, &end, 10);
+		if (end == line + 8 || !(msg = strstr(end, ": ")))
+			continue;
+		msg += 2;
+		if (!strncmp(msg, "optimized: ", 11)) {
+			kind = REMARK_DONE;
+			msg += 11;
+		} else if (!strncmp(msg, "missed: ", 8)) {
+			msg += 8;
+			kind = strncmp(msg + strspn(msg, " "), "not vectorized", 14) ? REMARK_MISSED : REMARK_REASON;
+		} else if (!strncmp(msg, "remark: ", 8)) {
+			msg += 8;
+			if (!(end = strstr(msg, " [-Rpass")))
+				continue;
+			kind = !strncmp(end, " [-Rpass=", 9) ? REMARK_DONE
+				: !strncmp(end, " [-Rpass-missed=", 16) ? REMARK_MISSED : REMARK_REASON;
+			*end = '\0';
+		} else {
+			/* gcc notes repeat the analysis steps */
+			continue;
+		}
+		msg += strspn(msg, " ");
+		/* everything after the last input line is generated */
+		add_remark(remarks, (entry < max) ? entry : max, kind, msg, strlen(msg));
+	}
+}
+
+static bool is_loop(char const *msg, bool done)
+{
+	if (done)
+		return strstr(msg, "loop vectorized") || strstr(msg, "vectorized loop");
+	return strstr(msg, "couldn't vectorize loop") || strstr(msg, "loop not vectorized");
+}
+
+/* `;vec`: what the optimizer did and didn't do to each input line */
+void vec_cmd(struct program *prog)
+{
+	char const *cc = prog->cc_list.list[0], *opt = opt_level(prog->cc_list.list);
+	bool clang = strstr(cc, "clang");
+	struct remark_list remarks = {0};
+	size_t max = prog->src[0].lines.cnt, entry = SIZE_MAX, done = 0, missed = 0;
+	char *report = NULL;
+
+	if (build_capture(prog->src[1].total.buf, prog->cc_list.list, VEC_OUT, clang ? clang_flags : gcc_flags, &report)) {
+		if (report)
+			fputs(report, stderr);
+		free(report);
+		unlink(VEC_OUT);
+		return;
+	}
+	unlink(VEC_OUT);
+	if (report)
+		parse_remarks(report, max, &remarks);
+	free(report);
+	if (!strcmp(opt, "-O0"))
+		fprintf(stdout, "%s\n", "[vec: built with -O0, which runs no loop optimizations; try ;profile perf]");
+
+	qsort(remarks.list, remarks.cnt, sizeof *remarks.list, cmp_remark);
+	for (size_t i = 0; i < remarks.cnt; i++) {
+		struct remark const *cur = remarks.list + i;
+		if (cur->entry != entry) {
+			entry = cur->entry;
+			if (entry == max || !entry)
+				fprintf(stdout, "%s\n", "(generated)");
+			else
+				fprintf(stdout, "[%zu] %.70s\n", entry, prog->src[0].lines.list[entry]);
+		}
+		/* reasons belong to the loop remark above them */
+		fprintf(stdout, "%s%-10s %s", (cur->kind == REMARK_REASON) ? "      " : "    ", kind_names[cur->kind], cur->msg);
+		if (cur->cnt > 1)
+			fprintf(stdout, " (x%zu)", cur->cnt);
+		fputc('\n', stdout);
+		if (is_loop(cur->msg, true))
+			done += cur->cnt;
+		else if (is_loop(cur->msg, false))
+			missed += cur->cnt;
+		free(cur->msg);
+	}
+	free(remarks.list);
+	fprintf(stdout, "[vec: %zu loop%s vectorized, %zu not vectorized, %s %s]\n",
+			done, (done == 1) ? "" : "s", missed, cc, opt);
+}
@@ -0,0 +1,36 @@
+/*
+ * vec.h - optimization remarks mapped to input lines
+ *
+ * AUTHOR: Joey Pabalinas <joeypabalinas@gmail.com>
+ * See LICENSE file for copyright and license details.
+ */
+
+#if !defined(VEC_H)
+#define VEC_H 1
+
+#include "defs.h"
+#include "errs.h"
+
+/* kinds of optimization remarks */
+enum remark_kind {
+	REMARK_DONE, REMARK_MISSED, REMARK_REASON,
+};
+
+/* struct definition for one distinct remark */
+struct remark {
+	char *msg;
+	enum remark_kind kind;
+	/* input line number, order of appearance, and number of repeats */
+	size_t entry, seq, cnt;
+};
+
+/* struct definition for a list of remarks */
+struct remark_list {
+	struct remark *list;
+	size_t cnt, max;
+};
+
+/* prototypes */
+void vec_cmd(struct program *prog);
+
+#endif /* !defined(VEC_H) */